@@ -0,0 +1,140 @@
+#pragma once
+
+// Hardware profiles: pins, polarities and switch debounce per board variant.
+//
+// Each profile is a struct of constexpr members. CHANNELS feeders (auger
+// motor relay plus step switch) hang off one board; switchPin(ch) and
+// relayPin(ch) give the pins of channel ch. The PlatformIO environment
+// picks one with -DBOARD_PROFILE=<struct> (see platformio.ini); without it the
+// original Wemos D1 Mini32 wiring is used. Code never compares levels itself:
+// it asks for "relay on" or "switch closed" through the helpers at the end,
+// which fold to a constant level at compile time.
+//
+// New variant: derive from the closest profile, override what differs and
+// add an environment for it.
+
+#include <stdint.h>
+
+#include "hal.h"
+
+// Most feeders one board drives. The settings blob always has room for this
+// many, so switching profiles keeps every channel's schedule.
+const uint8_t MAX_FEEDER_CHANNELS = 4;
+
+// Wemos D1 Mini32 as described in WIRING.md: switch between GPIO32 and 3.3V
+// with the internal pull-down, relay module switched on by a HIGH input.
+struct BoardD1Mini32 {
+  static constexpr uint8_t LED_PIN = 2;
+  static constexpr int LED_ON_LEVEL = HIGH;
+  static constexpr uint8_t CHANNELS = 1;
+  static constexpr uint8_t SWITCH_PULL = INPUT_PULLDOWN;
+  static constexpr int SWITCH_CLOSED_LEVEL = HIGH;
+  static constexpr uint32_t SWITCH_DEBOUNCE_MS = 50;
+  static constexpr int RELAY_ON_LEVEL = HIGH;
+  // Channel 0 is the original wiring; further channels use free GPIOs with
+  // internal pulls (switches) and ones that stay quiet at boot (relays).
+  static constexpr uint8_t switchPin(uint8_t ch) {
+    return ch == 0 ? 32 : ch == 1 ? 33 : ch == 2 ? 25 : 26;
+  }
+  static constexpr uint8_t relayPin(uint8_t ch) {
+    return ch == 0 ? 22 : ch == 1 ? 21 : ch == 2 ? 19 : 18;
+  }
+};
+
+// Same board, switch wired to GND instead of 3.3V.
+struct BoardD1Mini32SwitchToGnd : BoardD1Mini32 {
+  static constexpr uint8_t SWITCH_PULL = INPUT_PULLUP;
+  static constexpr int SWITCH_CLOSED_LEVEL = LOW;
+};
+
+// Same board with one of the common opto-isolated relay modules that pull
+// in when their input is LOW.
+struct BoardD1Mini32RelayActiveLow : BoardD1Mini32 {
+  static constexpr int RELAY_ON_LEVEL = LOW;
+};
+
+// Same board driving two or four feeders (see WIRING.md for the pins).
+struct BoardD1Mini32Dual : BoardD1Mini32 {
+  static constexpr uint8_t CHANNELS = 2;
+};
+
+struct BoardD1Mini32Quad : BoardD1Mini32 {
+  static constexpr uint8_t CHANNELS = 4;
+};
+
+#ifndef BOARD_PROFILE
+#define BOARD_PROFILE BoardD1Mini32
+#endif
+using Board = BOARD_PROFILE;
+
+// ESP32 pin rules, checked when the profile is compiled
+constexpr bool boardPinIsFlash(uint8_t pin) { return pin >= 6 && pin <= 11; }
+constexpr bool boardPinIsInputOnly(uint8_t pin) { return pin >= 34 && pin <= 39; }
+// Rules for the pins of channels ch..CHANNELS-1 (one return: C++11 constexpr)
+constexpr bool boardChannelPinsOnFlash(uint8_t ch = 0) {
+  return ch < Board::CHANNELS &&
+         (boardPinIsFlash(Board::switchPin(ch)) || boardPinIsFlash(Board::relayPin(ch)) || boardChannelPinsOnFlash(ch + 1));
+}
+constexpr bool boardRelayPinsInputOnly(uint8_t ch = 0) {
+  return ch < Board::CHANNELS && (boardPinIsInputOnly(Board::relayPin(ch)) || boardRelayPinsInputOnly(ch + 1));
+}
+constexpr bool boardSwitchPinsInputOnly(uint8_t ch = 0) {
+  return ch < Board::CHANNELS && (boardPinIsInputOnly(Board::switchPin(ch)) || boardSwitchPinsInputOnly(ch + 1));
+}
+// A pin used twice, by a channel from ch on or the LED
+constexpr bool boardPinUsedFrom(uint8_t pin, uint8_t ch) {
+  return ch < Board::CHANNELS &&
+         (Board::switchPin(ch) == pin || Board::relayPin(ch) == pin || boardPinUsedFrom(pin, ch + 1));
+}
+constexpr bool boardChannelPinsShared(uint8_t ch = 0) {
+  return ch < Board::CHANNELS &&
+         (Board::switchPin(ch) == Board::relayPin(ch) || boardPinUsedFrom(Board::switchPin(ch), ch + 1) ||
+          boardPinUsedFrom(Board::relayPin(ch), ch + 1) || Board::switchPin(ch) == Board::LED_PIN ||
+          Board::relayPin(ch) == Board::LED_PIN || boardChannelPinsShared(ch + 1));
+}
+static_assert(Board::CHANNELS >= 1 && Board::CHANNELS <= MAX_FEEDER_CHANNELS, "1 to MAX_FEEDER_CHANNELS channels");
+static_assert(!boardPinIsFlash(Board::LED_PIN) && !boardChannelPinsOnFlash(), "GPIO6..11 belong to the SPI flash");
+static_assert(!boardPinIsInputOnly(Board::LED_PIN) && !boardRelayPinsInputOnly(), "GPIO34..39 are input-only");
+static_assert(!boardSwitchPinsInputOnly() || Board::SWITCH_PULL == INPUT,
+              "GPIO34..39 have no internal pull resistors; use an external one and INPUT");
+static_assert(!boardChannelPinsShared(), "every channel needs its own switch and relay pin");
+static_assert(Board::SWITCH_PULL != INPUT_PULLDOWN || Board::SWITCH_CLOSED_LEVEL == HIGH,
+              "with a pull-down the closed switch must read HIGH");
+static_assert(Board::SWITCH_PULL != INPUT_PULLUP || Board::SWITCH_CLOSED_LEVEL == LOW,
+              "with a pull-up the closed switch must read LOW");
+
+// --- Level helpers (compile-time pin and polarity) ---
+
+// Channel ch's pins as template arguments: the channel is compared against
+// each constant in turn, so every branch is a single register access.
+template <uint8_t CH>
+struct BoardChannelIo {
+  static inline __attribute__((always_inline)) void relay(uint8_t ch, bool on) {
+    if (ch == CH) hal::writePin<Board::relayPin(CH)>(on ? Board::RELAY_ON_LEVEL : !Board::RELAY_ON_LEVEL);
+    else BoardChannelIo<CH + 1>::relay(ch, on);
+  }
+  static inline __attribute__((always_inline)) int readSwitch(uint8_t ch) {
+    return ch == CH ? hal::readPin<Board::switchPin(CH)>() : BoardChannelIo<CH + 1>::readSwitch(ch);
+  }
+};
+
+template <>
+struct BoardChannelIo<Board::CHANNELS> {
+  static inline void relay(uint8_t, bool) {}
+  static inline int readSwitch(uint8_t) { return !Board::SWITCH_CLOSED_LEVEL; }
+};
+
+inline __attribute__((always_inline)) void boardRelay(uint8_t ch, bool on) {
+  BoardChannelIo<0>::relay(ch, on);
+}
+
+inline __attribute__((always_inline)) void boardLed(bool on) {
+  hal::writePin<Board::LED_PIN>(on ? Board::LED_ON_LEVEL : !Board::LED_ON_LEVEL);
+}
+
+// Raw pin level (as captured by the edge ISR) -> switch closed
+constexpr bool boardSwitchClosed(int level) { return level == Board::SWITCH_CLOSED_LEVEL; }
+
+inline __attribute__((always_inline)) bool boardReadSwitch(uint8_t ch) {
+  return boardSwitchClosed(BoardChannelIo<0>::readSwitch(ch));
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+// Integrating switch debouncer.
+//
+// The raw switch is looked at on a fixed sample grid (config.sampleUs). Each
+// sample moves an integrator one step towards the raw level, clamped to
+// 0..integratorMax; the debounced state turns closed when the integrator
+// reaches riseAt and open again when it falls to fallAt. Bounce and short
+// glitches only nudge the integrator, so they never reach the output, and a
+// contact that chatters while it settles still switches once.
+//
+// The samples are not taken by a timer interrupt: the raw level is constant
+// between two edges, so feeding the timestamped edges (from the GPIO
+// interrupt) and advancing the integrator by the whole number of sample
+// ticks in between gives the same result as sampling, without waking the
+// CPU every tick. The result depends only on the edge times, never on when
+// the caller gets round to processing them.
+//
+// Pure logic with no hal dependency, so recorded edge traces can be replayed
+// through it on the host.
+
+#include <stdint.h>
+
+struct DebounceConfig {
+  uint32_t sampleUs;       // sample period
+  uint16_t integratorMax;  // integrator saturates here
+  uint16_t riseAt;         // closed once the integrator reaches this ...
+  uint16_t fallAt;         // ... open once it is back down to this
+};
+
+struct DebounceStats {
+  uint32_t pulses;      // accepted closed pulses (rising edges reported)
+  uint32_t glitches;    // raw excursions (with their bounce) that never reached the output
+  uint32_t maxGlitchUs; // longest of those
+  uint32_t minPulseMs;  // shortest / longest accepted closed pulse, 0 = none yet
+  uint32_t maxPulseMs;
+};
+
+class SwitchDebouncer {
+ public:
+  explicit SwitchDebouncer(const DebounceConfig &config) : config_(config) {}
+
+  // Start over at `closed`, fully settled, as of nowUs.
+  void reset(uint32_t nowUs, bool closed);
+  // Edges were lost: keep the debounced state, take the raw level as it is
+  // now and integrate from rest, as if it had only just changed.
+  void resync(uint32_t nowUs, bool closed);
+
+  // Feed one raw edge (in time order). Edges and polls must come at least
+  // every 35 minutes (half the 32-bit microsecond clock). Returns true if the debounced state
+  // changed before this edge; changedAtUs is the sample tick it changed on.
+  bool edge(uint32_t us, bool closed, uint32_t &changedAtUs);
+  // Advance to nowUs with no new edge; same result as edge().
+  bool poll(uint32_t nowUs, uint32_t &changedAtUs);
+
+  bool closed() const { return stable_; }
+  // Raw level differs from the debounced state: a change may still come
+  // without a further edge.
+  bool settling() const { return raw_ != stable_; }
+  // Time from nowUs until poll() reports the pending change, if the raw
+  // level stays as it is; 0 if settling() is false.
+  uint32_t usUntilSettled(uint32_t nowUs) const;
+
+  const DebounceStats &stats() const { return stats_; }
+
+ private:
+  bool advance(uint32_t toUs, uint32_t &changedAtUs);
+  uint32_t ticksToFlip() const;
+  void settle(bool closed, uint64_t pulseUs);
+
+  DebounceConfig config_;
+  DebounceStats stats_ = {};
+  uint32_t tickUs_ = 0;       // time of the last sample taken
+  uint16_t integrator_ = 0;
+  bool raw_ = false;
+  bool stable_ = false;
+  bool excursion_ = false;    // raw left the stable state and has not been back for a full window
+  uint32_t excursionUs_ = 0;  // when it left
+  uint32_t returnUs_ = 0;     // when it last came back
+  uint64_t stableUs_ = 0;     // time in the current debounced state (may exceed the 32-bit clock)
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+// Live events for /events (Server-Sent Events).
+//
+// Producers (feederService() for the control task's events, the WiFi event
+// handler) publish small JSON events into one ring of EVENT_STREAM_SLOTS
+// preformatted messages that all subscribers share. A subscriber is only a
+// read position in that ring, so publishing is a snprintf and a copy and
+// never waits for a client. A subscriber that falls more than the ring
+// behind (a slow or stalled connection) is dropped: its next read reports
+// it and the server ends the response. The browser reconnects on its own
+// with Last-Event-ID and picks up where it was if those events are still
+// in the ring.
+//
+// Pure logic on hal::SpinLock; the caller passes the time in.
+
+#include <stddef.h>
+#include <stdint.h>
+
+const uint8_t EVENT_STREAM_SLOTS = 32;
+const size_t EVENT_STREAM_MAX_MESSAGE = 112;     // "event: ...\ndata: {...}\n\n"
+const uint8_t EVENT_STREAM_MAX_SUBSCRIBERS = 4;
+const uint32_t EVENT_STREAM_HEARTBEAT_MS = 15000; // comment line on a quiet stream
+const uint32_t EVENT_STREAM_RETRY_MS = 3000;      // reconnect delay sent to the browser
+const int EVENT_STREAM_DROPPED = -1;
+
+// Publish event name with data from fmt (a JSON object). Any task, not from
+// an ISR. A message longer than EVENT_STREAM_MAX_MESSAGE is not sent.
+void eventStreamPublish(const char *name, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Anyone subscribed? Lock-free, for the control task.
+bool eventStreamActive();
+
+// New subscriber that gets the events after lastId if those are still in
+// the ring, else only new ones. -1 if all subscriber slots are taken.
+int eventStreamSubscribe(const uint32_t *lastId, uint32_t nowMs);
+// Whole messages for subscriber sub, at most len bytes: the byte count,
+// 0 if there is nothing to send yet, or EVENT_STREAM_DROPPED once it has
+// fallen behind. The first read sends the retry delay.
+int eventStreamRead(int sub, char *buf, size_t len, uint32_t nowMs);
+void eventStreamUnsubscribe(int sub);
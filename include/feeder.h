@@ -0,0 +1,128 @@
+#pragma once
+
+// Feeder control logic: switch debounce/step counting, relay control and the
+// daily schedule. Hardware access goes through hal.h so this runs unchanged
+// on the ESP32 and in the native simulator.
+//
+// A board drives FEEDER_CHANNELS feeders (board.h). Every channel has its
+// own switch, relay, schedule, run telemetry, cooldown and failsafe, kept
+// in one fixed array; feederLoop() steps each channel's state machine once
+// per pass. Channels are numbered from 0 in the API and from 1 on screen.
+
+#include <stdint.h>
+
+#include "board.h"
+#include "debounce.h"
+#include "hal.h"
+#include "logger.h"
+#include "run_telemetry.h"
+#include "schedule.h"
+#include "settings.h"
+
+// Pins and polarities come from the board profile (board.h, chosen by the
+// PlatformIO environment). The LED is lit while any channel's debounced
+// switch is closed.
+// Hardware note: drive the relay with a driver transistor/MOSFET or use a relay module with separate JD-VCC
+// and opto-isolation. Do NOT drive a relay coil directly from a GPIO pin. Use a flyback diode if you use
+// a bare coil and ensure a common ground between driver and MCU.
+const uint8_t LED_PIN = Board::LED_PIN;
+const uint8_t FEEDER_CHANNELS = Board::CHANNELS;
+static_assert(FEEDER_CHANNELS <= LOG_MAX_CHANNELS && FEEDER_CHANNELS <= hal::MAX_EDGE_PINS,
+              "the log and the edge capture hold up to 4 channels");
+
+// Configuration
+const unsigned long RELAY_PULSE_MS = 5000UL; // relay active time in ms (2s)
+const uint8_t REQUIRED_PRESSES = 3; // how many rising edges trigger the relay
+const uint8_t STEPS_PER_RUN = 3; // how many switch activations per scheduled motor run
+const uint8_t MAX_STEPS_PER_RUN = 20; // most the config portal accepts per entry (max in web/config.js)
+const bool ENABLE_MANUAL_TRIGGER = false; // if true, 3 presses will trigger a manual pulse
+const bool RUN_SELF_TEST = false; // set true to run the audible relay self-test at boot
+const bool ENABLE_IDLE_SLEEP = true; // light sleep between feeding events (battery/UPS units)
+const bool ENABLE_TRACE = false; // record switch/relay/schedule/clock traces to flash for replay (trace.h)
+
+// Safety / timing
+const unsigned long SWITCH_DEBOUNCE_MS = Board::SWITCH_DEBOUNCE_MS;
+const uint32_t SWITCH_SAMPLE_US = 1000; // debounce integrator sample period
+// A level has to win SWITCH_DEBOUNCE_MS worth of samples over bounce before it counts
+const DebounceConfig SWITCH_DEBOUNCE = {SWITCH_SAMPLE_US, (uint16_t)(SWITCH_DEBOUNCE_MS * 1000 / SWITCH_SAMPLE_US),
+                                        (uint16_t)(SWITCH_DEBOUNCE_MS * 1000 / SWITCH_SAMPLE_US), 0};
+const unsigned long SCHEDULED_RUN_MAX_MS = 60UL * 1000UL; // max time for a scheduled run (failsafe; jams usually stop it sooner, see run_telemetry.h)
+const unsigned long MOTOR_STOP_COOLDOWN_MS = 3000UL; // don't restart motor in this many ms after stopping
+
+// Timezone configuration: use a POSIX TZ string so DST is applied automatically.
+// Example below is for Central European Time (CET/CEST). Adjust if needed.
+// POSIX TZ example: "CET-1CEST,M3.5.0/02:00:00,M10.5.0/03:00:00"
+const char *const TZ_RULE = "CET-1CEST,M3.5.0/02:00:00,M10.5.0/03:00:00";
+
+// Feeding times per channel as edited by the config portal (web side, core 0)
+extern ScheduleEntry schedule[FEEDER_CHANNELS][MAX_SCHEDULE_ENTRIES];
+extern uint8_t scheduleCount[FEEDER_CHANNELS];
+
+// Switch inputs with edge capture, relay outputs (off) and the LED
+void setupPins();
+// Drive a channel's relay directly, outside the state machine: only for the
+// boot self-test and to hold the relays off before the control task runs.
+void setRelayActive(uint8_t channel);
+void setRelayInactive(uint8_t channel);
+// Settings blob in NVS (settings.h), migrating the old per-key layout once
+void loadScheduleFromPrefs();
+// Writes only if a schedule changed
+SettingsSaveResult saveScheduleToPrefs();
+// Hand schedule[channel] to the control task. Returns false if the command
+// queue was full; the channel keeps its previous schedule then.
+bool postScheduleToControl(uint8_t channel);
+
+// One pass of the control logic: commands, then for each channel the
+// schedule check, switch edge counting and relay pulse/failsafe timers,
+// then the LED. Runs in the control task
+// (hal::startControlTask) and returns how many ms it may sleep; switch edges
+// and commands wake it earlier. Wakes are logged individually while steps
+// are being counted and summarised (EV_IDLE_WAKES) at the next run otherwise.
+uint32_t feederLoop(const hal::ControlWake &wake);
+
+// Requests from the web side to the control task, each for one channel.
+// schedule[] is the web side's copy; changes only take effect once posted
+// here.
+enum FeederCommandType : uint8_t {
+  CMD_SET_SCHEDULE_ENTRY, // stage `entry` at `index`
+  CMD_COMMIT_SCHEDULE,    // use the first `index` staged entries from now on
+  CMD_FEED                // one run of `index` portions now, like a scheduled one
+};
+struct FeederCommand {
+  FeederCommandType type;
+  uint8_t channel;
+  uint8_t index;
+  ScheduleEntry entry;
+};
+// Returns false if the command queue is full.
+bool feederPostCommand(const FeederCommand &cmd);
+
+// Per-run telemetry of a channel for the web side (copies; safe from any
+// task): the last finished runs newest first, and the step model of each
+// schedule entry.
+uint8_t feederRunHistory(uint8_t channel, RunRecord *out, uint8_t max);
+void feederStepModels(uint8_t channel, StepModel *out, uint8_t count);
+// What the control task is doing on a channel, as of the end of its last
+// pass (copy; safe from any task). Fields are zeroed first, so the bytes
+// can be hashed.
+struct FeederStatus {
+  bool relayActive;
+  bool motorRunActive;    // a scheduled (or /api/feed) run is in progress
+  int8_t runEntry;        // its schedule entry, -1 for a feed request
+  uint8_t steps;          // steps counted so far in that run
+  uint8_t stepsWanted;
+  int8_t nextEntry;       // entry that fires next, -1 if none is armed
+  uint32_t nextFireEpoch; // when, 0 if none
+};
+FeederStatus feederStatus(uint8_t channel);
+// Debouncer statistics of a channel's switch (glitches rejected, accepted
+// pulse widths) since boot. Written by the control task; a read may be
+// torn, like the metrics.
+DebounceStats feederSwitchStats(uint8_t channel);
+
+// Drain events queued by the control task into the logger (and trace
+// records to flash, see trace.h). Call regularly from the web/logging side
+// (core 0), or let feederStartService() run it in a background task that
+// each event wakes.
+void feederService();
+void feederStartService();
@@ -0,0 +1,46 @@
+#pragma once
+
+// Allocation-free reader for urlencoded form bodies ("a=1&b=x%3Ay").
+//
+// The web handlers receive the raw POST body into a fixed buffer and walk
+// it with FormReader: each field is percent-decoded in place (decoding only
+// ever shortens it) and NUL-terminated, and comes back as a view into the
+// buffer. The number helpers check digits and ranges on the view, so a
+// value is rejected before anything is stored.
+//
+// Pure logic with no hal dependency.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Decoded text inside the form buffer; data[len] is always '\0'.
+struct FormView {
+  const char *data;
+  size_t len;
+
+  bool is(const char *s) const;
+};
+
+class FormReader {
+ public:
+  // body[len] must be writable (it may receive the last terminator).
+  FormReader(char *body, size_t len) : p_(body), end_(body + len) {}
+
+  // Next field in order; false at the end. A field without '=' has an
+  // empty value, empty fields ("a=1&&b=2") are skipped.
+  bool next(FormView &key, FormView &value);
+  // A '%' escape was malformed somewhere so far (it is kept as is).
+  bool malformed() const { return malformed_; }
+
+ private:
+  char *p_;
+  char *end_;
+  bool malformed_ = false;
+};
+
+// Decimal digits only, within min..max. False if empty, not a number or out
+// of range.
+bool formUInt(const FormView &v, uint32_t min, uint32_t max, uint32_t &out);
+// "H:MM" or "HH:MM" with hour 0..23 and minute 0..59, as sent by
+// <input type=time>; a ":SS" part is accepted and ignored.
+bool formHourMinute(const FormView &v, uint8_t &hour, uint8_t &minute);
@@ -0,0 +1,267 @@
+#pragma once
+
+// Hardware abstraction layer
+//
+// The control logic (feeder.cpp) and the logger only talk to the hardware
+// through these functions. src/esp32/hal_esp32.cpp maps them onto the Arduino
+// core, SPIFFS/LittleFS, Preferences and FreeRTOS; src/native/hal_native.cpp
+// provides in-memory fakes driven by a virtual clock so the same logic runs
+// as a Linux executable ([env:native]).
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <memory>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <FS.h>
+#include <hal/gpio_ll.h>
+#else
+
+// Arduino-compatible pin levels/modes for the native build
+#define LOW 0x0
+#define HIGH 0x1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+#endif
+
+// Functions called from interrupt context must live in IRAM on the ESP32 so
+// they keep running while flash is busy (e.g. during a log flush).
+#ifdef ARDUINO
+#define HAL_ISR_ATTR IRAM_ATTR
+#else
+#define HAL_ISR_ATTR
+#endif
+
+namespace hal {
+
+// --- Clock ---
+uint32_t millis();
+uint64_t micros();
+// Wall clock in epoch seconds (0 or close to it until SNTP has synced).
+time_t epochNow();
+// Same in milliseconds, for tracing clock adjustments.
+uint64_t epochMs();
+// Set the wall clock (settimeofday on target).
+void setEpochMs(uint64_t epochMs);
+
+// --- Retained memory (RTC slow memory on target) ---
+// RETAINED_BYTES that survive a software reset, watchdog or panic but not a
+// power cut, and then hold garbage: callers check what they read. Get
+// copies at most len bytes and returns how many.
+const size_t RETAINED_BYTES = 32;
+size_t retainedGet(void *buf, size_t len);
+void retainedPut(const void *buf, size_t len);
+
+// --- GPIO ---
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, int level);
+
+// Pin number fixed at compile time (see board.h): on target a single store
+// to the GPIO set/clear register or a load of the input register, no pin
+// table lookup. Safe in ISRs. The pin must already be configured.
+template <uint8_t PIN>
+inline __attribute__((always_inline)) void writePin(int level) {
+#ifdef ARDUINO
+  gpio_ll_set_level(&GPIO, (gpio_num_t)PIN, level);
+#else
+  digitalWrite(PIN, level);
+#endif
+}
+
+template <uint8_t PIN>
+inline __attribute__((always_inline)) int readPin() {
+#ifdef ARDUINO
+  return gpio_ll_get_level(&GPIO, (gpio_num_t)PIN);
+#else
+  return digitalRead(PIN);
+#endif
+}
+
+// Edge capture: on every level change of pin, the HAL's interrupt handler
+// calls sink with the tag given here, a microsecond timestamp and the new
+// level. sink runs in interrupt context and must be HAL_ISR_ATTR, short and
+// non-blocking. Up to MAX_EDGE_PINS pins.
+const uint8_t MAX_EDGE_PINS = 4;
+typedef void (*EdgeSink)(uint8_t tag, uint32_t us, int level);
+void captureEdges(uint8_t pin, EdgeSink sink, uint8_t tag = 0);
+
+// --- Console (Serial on target, stdout on native) ---
+void consoleWrite(const char *text);
+
+// --- Non-volatile storage (Preferences on target) ---
+uint32_t nvsGetUInt(const char *ns, const char *key, uint32_t def);
+void nvsPutUInt(const char *ns, const char *key, uint32_t value);
+// Byte blobs. Get returns the stored length (0 if missing) and copies the
+// value only if it fits in len. Put replaces the value in one NVS write.
+size_t nvsGetBlob(const char *ns, const char *key, void *buf, size_t len);
+bool nvsPutBlob(const char *ns, const char *key, const void *buf, size_t len);
+// Remove every key in the namespace.
+void nvsClear(const char *ns);
+
+// --- Memory ---
+struct HeapStats {
+  uint32_t freeBytes;
+  uint32_t largestFreeBlock; // biggest single allocation that would succeed
+  uint32_t minFreeBytes;     // low-water mark since boot
+};
+// All zero on native.
+HeapStats heapStats();
+// malloc/calloc/realloc calls since boot, all tasks (String and new go
+// through malloc too). A delta around some code is its allocation count,
+// give or take what the WiFi stack allocates meanwhile. 0 on native.
+uint32_t heapAllocations();
+
+// --- Locking ---
+// Short critical section around shared RAM state (portMUX on target).
+class SpinLock {
+ public:
+  void lock();
+  void unlock();
+ private:
+#ifdef ARDUINO
+  portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;
+#endif
+};
+
+// Blocking mutex for longer sections such as file access.
+class Mutex {
+ public:
+  Mutex();
+  void lock();
+  void unlock();
+ private:
+#ifdef ARDUINO
+  SemaphoreHandle_t sem_ = nullptr;
+#endif
+};
+
+// --- Background work ---
+// Run fn every periodMs in a low-priority background context: a FreeRTOS task
+// on core 0 on target, the simulation loop on native. Returns a handle for
+// wakePeriodic(), or -1 (reported on the console) once MAX_PERIODIC tasks
+// run; the firmware starts four (logFlush, feederEvents, net, clock).
+const int MAX_PERIODIC = 8;
+typedef void (*PeriodicFn)();
+int startPeriodic(const char *name, PeriodicFn fn, uint32_t periodMs, uint32_t stackBytes = 4096);
+// Run the periodic function as soon as possible instead of waiting for its period.
+void wakePeriodic(int handle);
+// Change the period; takes effect after the current wait.
+void setPeriod(int handle, uint32_t periodMs);
+
+// --- Real-time control task ---
+// Run fn in a high-priority task pinned to its own core (core 1 on target;
+// WiFi, web and log flushing stay on core 0). fn returns how many ms it may
+// sleep before its next pass; wakeControl() ends that sleep early.
+// The native build never starts a task: the simulator calls fn itself.
+enum WakeReason : uint8_t {
+  WAKE_DEADLINE, // the sleep time returned by fn ran out
+  WAKE_SWITCH,   // wakeControlFromIsr() (switch edge)
+  WAKE_REQUEST   // wakeControl() (command from core 0)
+};
+// Why and how late fn runs. latencyUs is measured from the deadline or the
+// edge interrupt; 0 for requests. sleepCause is esp_sleep_get_wakeup_cause()
+// when the chip was in light sleep, else 0.
+struct ControlWake {
+  WakeReason reason;
+  uint32_t sleptMs;
+  uint32_t latencyUs;
+  uint8_t sleepCause;
+};
+typedef uint32_t (*ControlFn)(const ControlWake &wake);
+void startControlTask(ControlFn fn);
+// Control task timing since the last reset: how long fn() took per pass and
+// the worst wake latency. Stays flat if nothing on core 0 gets in its way.
+struct ControlStats {
+  uint32_t passes;
+  uint32_t maxPassUs;
+  uint64_t totalPassUs;
+  uint32_t maxLatencyUs;
+};
+ControlStats controlStats(bool reset);
+void wakeControl();
+void HAL_ISR_ATTR wakeControlFromIsr();
+
+// Let the chip drop into automatic light sleep whenever all tasks are blocked
+// (needs an SDK built with power management and tickless idle; without them
+// the CPU just idles in WAITI between deadlines).
+// Any level change on a captureEdges() pin wakes the chip, so call it after
+// those are set up. No-op on native.
+void enableIdleSleep();
+
+// --- Filesystem ---
+// Log and trace storage. Each backend implements FileSystem and FileImpl;
+// File is the handle callers pass around, with fs::File semantics: copies
+// share the open file, which closes with the last copy or close().
+class FileImpl {
+ public:
+  virtual ~FileImpl() = default;
+  virtual size_t read(uint8_t *buf, size_t len) = 0;
+  virtual size_t write(const uint8_t *buf, size_t len) = 0;
+  virtual size_t size() = 0;
+  virtual bool seek(size_t pos) = 0;
+};
+
+class File {
+ public:
+  File() = default;
+  explicit File(std::shared_ptr<FileImpl> impl) : impl_(std::move(impl)) {}
+  explicit operator bool() const { return impl_ != nullptr; }
+  size_t read(uint8_t *buf, size_t len) { return impl_ ? impl_->read(buf, len) : 0; }
+  size_t write(const uint8_t *buf, size_t len) { return impl_ ? impl_->write(buf, len) : 0; }
+  size_t size() const { return impl_ ? impl_->size() : 0; }
+  bool seek(size_t pos) { return impl_ && impl_->seek(pos); }
+  void close() { impl_.reset(); }
+ private:
+  std::shared_ptr<FileImpl> impl_;
+};
+
+class FileSystem {
+ public:
+  virtual ~FileSystem() = default;
+  // mode is FILE_READ, FILE_WRITE or FILE_APPEND; a false File on failure.
+  virtual File open(const char *path, const char *mode) = 0;
+  virtual bool exists(const char *path) = 0;
+  virtual bool remove(const char *path) = 0;
+  virtual bool rename(const char *from, const char *to) = 0;
+};
+
+// Storage backends. All of them use the "spiffs" data partition, so the
+// first mount after switching formats it and the old logs are gone.
+// STORAGE_RING is ring_fs.h on the raw partition. Native runs SPIFFS and
+// LittleFS on the same in-memory filesystem and the ring on a NOR flash
+// model.
+enum StorageBackend : uint8_t { STORAGE_SPIFFS, STORAGE_LITTLEFS, STORAGE_RING };
+#ifndef STORAGE_BACKEND
+#define STORAGE_BACKEND STORAGE_SPIFFS
+#endif
+const StorageBackend STORAGE_DEFAULT = STORAGE_BACKEND; // -DSTORAGE_BACKEND=STORAGE_RING etc.
+inline const char *storageBackendName(StorageBackend backend) {
+  return backend == STORAGE_RING ? "ring" : backend == STORAGE_LITTLEFS ? "littlefs" : "spiffs";
+}
+
+// Unmount the current backend and mount this one as filesystem(),
+// formatting the partition if it holds anything else (always with format).
+bool mountFilesystem(StorageBackend backend = STORAGE_DEFAULT, bool format = false);
+// The mounted filesystem. Opens fail until mountFilesystem() succeeded
+// (native starts out with the in-memory one mounted).
+FileSystem &filesystem();
+
+// Bytes programmed and erased on the storage partition since boot, by
+// whatever backend, metadata included. For write amplification.
+struct FlashStats {
+  uint32_t programmedBytes;
+  uint32_t erasedBytes;
+};
+FlashStats flashStats();
+
+}  // namespace hal
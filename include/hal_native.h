@@ -0,0 +1,33 @@
+#pragma once
+
+// Controls for the native HAL fakes (simulator only). The virtual clock only
+// moves when advance() is called, so a simulation can skip idle stretches.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+namespace hal {
+namespace native {
+
+// Wall clock at virtual time zero.
+void setEpoch(time_t epoch);
+void setEpochMs(uint64_t epochMs);
+// Move the virtual clock forward and run background work that became due.
+void advance(uint32_t ms);
+void advanceUs(uint64_t us);
+uint64_t nowUs();
+
+// Drive an input pin (edges go to captureEdges() sinks like the GPIO
+// interrupt would deliver them) / read back an output pin.
+void setPin(uint8_t pin, int level);
+int pinLevel(uint8_t pin);
+
+// Echo consoleWrite() to stdout (off by default).
+void setConsoleEcho(bool on);
+
+// Size of a file on the mounted filesystem (0 if it doesn't exist).
+size_t fileSize(const char *path);
+
+}  // namespace native
+}  // namespace hal
@@ -0,0 +1,71 @@
+#pragma once
+
+// Small JSON helpers for the REST API (/api/...), without heap or String.
+//
+// JsonOut renders a document from printf-style pieces but keeps only the
+// bytes that fall into a window [from, from + len) of the output. A response
+// is streamed by rendering the (small) document again for every chunk the
+// TCP stack asks for, from a snapshot of the state taken when the request
+// came in; with no window it just counts the bytes for Content-Length.
+//
+// JsonIn is a pull reader over a request body: the caller walks the
+// structure it expects and skips the rest. Strings with escapes are only
+// skipped, never returned.
+//
+// Pure logic with no hal dependency.
+
+#include <stddef.h>
+#include <stdint.h>
+
+const size_t JSON_MAX_PIECE = 128; // longest single printf() piece
+
+class JsonOut {
+ public:
+  // Count only (size() for Content-Length).
+  JsonOut() {}
+  // Copy output bytes from..from+len into buf.
+  JsonOut(char *buf, size_t from, size_t len) : buf_(buf), from_(from), len_(len) {}
+
+  void print(const char *s);
+  void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+  size_t size() const { return pos_; }      // bytes rendered so far
+  size_t copied() const { return copied_; } // of those, bytes put into buf
+
+ private:
+  void write(const char *s, size_t n);
+
+  char *buf_ = nullptr;
+  size_t from_ = 0;
+  size_t len_ = 0;
+  size_t pos_ = 0;
+  size_t copied_ = 0;
+};
+
+class JsonIn {
+ public:
+  JsonIn(const char *data, size_t len) : p_(data), end_(data + len) {}
+
+  // Skip whitespace, then take c if it comes next.
+  bool consume(char c);
+  // An object key and its ':'; false if the key (unescaped) doesn't fit.
+  bool key(char *buf, size_t len);
+  // Unsigned integer of at most 9 digits.
+  bool uint(uint32_t &out);
+  // Any value, nested up to JSON_MAX_DEPTH.
+  bool skipValue();
+  // Nothing but whitespace left.
+  bool atEnd();
+
+ private:
+  static const int JSON_MAX_DEPTH = 8;
+  void skipSpace();
+  bool skipString();
+  bool skipValue(int depth);
+
+  const char *p_;
+  const char *end_;
+};
+
+// FNV-1a, for ETags over a state snapshot.
+uint32_t jsonHash(const void *data, size_t len, uint32_t hash = 2166136261u);
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <initializer_list>
+
+#include "wall_clock.h"
+
+// Logging
+//
+// Log entries are stored as compact binary records: a timestamp, level,
+// event ID, up to LOG_MAX_ARGS integer arguments and an optional short text.
+// The text form is only produced for Serial and when /log is downloaded.
+// Records about one feeder channel carry its number and render with a
+// "[chN]" prefix (N counting from 1); the feeder only passes it when the
+// board has more than one channel.
+//
+// Timestamps are clockStamp() (wall_clock.h): uptime seconds until the clock
+// has synced. Records still in the RAM ring at the sync are moved to epoch
+// time; the flusher holds off the age limit for LOG_UNSYNCED_HOLD_MS after
+// boot so that usually covers all boot records. Older ones render as
+// "boot+hh:mm:ss".
+//
+// logEvent() appends a record to a fixed-size RAM ring. A background task
+// writes the ring to /log.bin in batches (size threshold or age) and rotates
+// /log.bin -> /log.N.bin at batch boundaries, so no caller ever waits on flash.
+//
+// For every file a small RAM index is kept as records are flushed: a mark
+// every LOG_INDEX_STRIDE bytes with the record offset, the offset in the
+// rendered text and per-level record counts and the newest timestamp of the
+// segment it starts. Queries (tail, since, byte range) seek through it
+// instead of reading the files front to back. It is rebuilt by one scan of
+// the files in logInit().
+//
+// Levels are filtered twice: calls below LOG_COMPILE_LEVEL are removed at
+// compile time, and the runtime level (logSetLevel(), kept in NVS) drops
+// records before anything is formatted, queued or written.
+
+const size_t LOG_RING_SIZE = 8 * 1024;           // RAM ring for not-yet-flushed records
+const size_t LOG_FLUSH_THRESHOLD = 2 * 1024;     // flush once this many bytes are pending
+const unsigned long LOG_FLUSH_MAX_AGE_MS = 5000; // ... or once the oldest pending record is this old
+const uint32_t LOG_UNSYNCED_HOLD_MS = 60000;     // after boot, age flushes wait this long for the clock
+const size_t MAX_LOG_SIZE = 64 * 1024;           // rotate /log.bin when it reaches this size
+const int LOG_ROTATE_COUNT = 3;                  // keep /log.1.bin .. /log.3.bin
+const uint8_t LOG_MAX_ARGS = 4;
+const size_t LOG_MAX_TEXT = 96;                  // longer texts are truncated
+const size_t LOG_MAX_LINE = LOG_MAX_TEXT + 160;  // one rendered text line
+const uint32_t LOG_INDEX_STRIDE = 4096;          // file bytes between index marks
+const uint8_t LOG_INDEX_MAX_MARKS = 24;          // per file; covers MAX_LOG_SIZE plus one flush
+const int8_t LOG_NO_CHANNEL = -1;                // record is not about a feeder channel
+const uint8_t LOG_MAX_CHANNELS = 4;              // channel numbers a record can hold
+
+enum LogLevel : uint8_t { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR };
+
+// Lowest level compiled in, e.g. -DLOG_COMPILE_LEVEL=LOG_INFO in
+// platformio.ini; levels below it can't be enabled at runtime.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+const LogLevel LOG_DEFAULT_LEVEL = LOG_INFO; // runtime level until one is stored
+
+// Event table: ID and printf format. Formats take exactly the integer
+// arguments of the record (as %d) followed by at most one %s for the text.
+// IDs are stored on flash: only append new entries at the end.
+#define LOG_EVENTS(X) \
+  X(EV_TEXT,                   "%s") \
+  X(EV_RESET_REASON,           "Reset reason: %s") \
+  X(EV_FS_MOUNT_FAILED,        "Filesystem mount failed (%s)") \
+  X(EV_SELF_TEST,              "Relay self-test: activating briefly (2 cycles)") \
+  X(EV_STARTED,                "Example started") \
+  X(EV_PINS_INIT,              "Pins initialized") \
+  X(EV_MANUAL_DISABLED,        "Manual trigger disabled in configuration") /* no longer written */ \
+  X(EV_MANUAL_BUSY,            "Manual pulse requested but scheduled run active - ignoring") \
+  X(EV_MANUAL_COOLDOWN,        "Manual trigger ignored due to motor stop cooldown") \
+  X(EV_MANUAL_PULSE_START,     "3 presses reached -> activating manual relay pulse (LOW for configured time)") \
+  X(EV_MANUAL_PULSE_ACTIVE,    "3 presses reached but manual relay pulse already active") \
+  X(EV_MANUAL_PULSE_END,       "Manual relay pulse ended, relay set HIGH (inactive)") \
+  X(EV_RUN_TIMEOUT,            "Scheduled run timeout reached - stopping motor as failsafe") \
+  X(EV_RUN_STEP,               "Scheduled run: switch rising edge, scheduled count=%d") \
+  X(EV_RUN_COMPLETE,           "Scheduled run completed: stopping motor/relay") \
+  X(EV_SWITCH_EDGE,            "Switch rising edge detected, count=%d") \
+  X(EV_SWITCH_IGNORED,         "Switch rising edge ignored (manual trigger disabled)") \
+  X(EV_WIFI_STORED,            "Found stored credentials SSID=%s") \
+  X(EV_WIFI_OK_STORED,         "WiFi connected (stored credentials)") \
+  X(EV_WIFI_FAIL_STORED,       "Stored credentials didn't connect") \
+  X(EV_WIFI_COMPILED,          "Trying compile-time credentials SSID=%s") \
+  X(EV_WIFI_OK_COMPILED,       "WiFi connected (compile-time credentials)") \
+  X(EV_WIFI_FAIL_COMPILED,     "Compile-time credentials didn't connect") \
+  X(EV_WIFI_NONE,              "No usable WiFi connection at this time (portal runs in background)") \
+  X(EV_WIFI_IP,                "IP: %s") \
+  X(EV_WIFI_GOT_IP,            "WiFi GOT IP: %s") \
+  X(EV_WIFI_DISCONNECTED,      "WiFi disconnected") \
+  X(EV_MDNS_STARTED,           "mDNS responder started: http://katzefroh.local") \
+  X(EV_MDNS_FAILED,            "mDNS responder failed to start") \
+  X(EV_MDNS_STARTED_AP,        "mDNS responder started on AP: http://katzefroh.local") \
+  X(EV_MDNS_FAILED_AP,         "mDNS responder failed to start on AP") \
+  X(EV_MDNS_STARTED_EVENT,     "mDNS responder started (event): http://katzefroh.local") /* no longer written */ \
+  X(EV_MDNS_FAILED_EVENT,      "mDNS responder failed to start (event)") /* no longer written */ \
+  X(EV_AP_START,               "Starting AP '%s'") \
+  X(EV_AP_IP,                  "AP IP: %s") \
+  X(EV_PORTAL_AP,              "Config portal started on AP. Connect and open http://192.168.4.1/") \
+  X(EV_PORTAL_STA,             "Config portal started on STA IP: %s") \
+  X(EV_RUN_BUSY,               "Scheduled run requested but motor already running") \
+  X(EV_RUN_START,              "Starting scheduled motor run: activating relay") \
+  X(EV_MOTOR_STOP,             "Stopping motor (relay inactive)") \
+  X(EV_RELAY_ACTIVE,           "Relay set ACTIVE") \
+  X(EV_RELAY_INACTIVE,         "Relay set INACTIVE") \
+  X(EV_TZ_SET,                 "Time zone set: %s") \
+  X(EV_TIME_WAIT,              "Waiting for time sync...") \
+  X(EV_TIME_NOW,               "Current time: %02d:%02d:%02d") /* no longer written */ \
+  X(EV_SCHEDULE_DUE,           "Scheduled time reached: %02d:%02d -> starting motor run") \
+  X(EV_SCHEDULE_DONE_TODAY,    "Scheduled time already triggered today") /* no longer written */ \
+  X(EV_SCHEDULE_SAVED,         "Saved schedule: [%d] %02d:%02d x%d%s") \
+  X(EV_LOG_DROPPED,            "%d log records dropped (buffer full)") \
+  X(EV_SWITCH_QUEUE_OVERFLOW,  "Switch edge queue overflow - resynchronised from pin level") \
+  X(EV_CONTROL_EVENTS_DROPPED, "Control event queue full - %d events dropped") \
+  X(EV_SCHEDULE_MISSED,        "Missed scheduled time %02d:%02d by %d s (clock jump?) - skipped") \
+  X(EV_SCHEDULE_LATE,          "Scheduled time %02d:%02d running %d s late") \
+  X(EV_WAKE_DEADLINE,          "Wake (deadline): slept %d ms, %d us late, sleep cause %d") \
+  X(EV_WAKE_SWITCH,            "Wake (switch): slept %d ms, %d us after edge, sleep cause %d") \
+  X(EV_WAKE_REQUEST,           "Wake (request): slept %d ms, %d us, sleep cause %d") \
+  X(EV_IDLE_WAKES,             "Idle since last run: %d deadline, %d switch, %d request wakes, max %d us late") \
+  X(EV_BOOT_PHASE,             "Boot: %d ms after reset (+%d ms): %s ready") \
+  X(EV_SETTINGS_INVALID,       "Stored settings invalid (CRC, length or version) - using defaults") \
+  X(EV_SETTINGS_MIGRATED,      "Settings migrated from per-key NVS layout (%d schedule entries)") \
+  X(EV_SETTINGS_WRITE_FAILED,  "Writing settings to NVS failed") \
+  X(EV_SETTINGS_UNCHANGED,     "Settings unchanged - nothing written") \
+  X(EV_RUN_JAMMED,             "Jam: step %d running %d ms, limit %d ms (%d ms p95) - stopping motor") \
+  X(EV_RUN_SUMMARY,            "Run finished: %d/%d steps in %d ms, slowest step %d ms") \
+  X(EV_FEED_REQUESTED,         "Feed requested over the API: %d portions") \
+  X(EV_CLOCK_SYNCED,           "Clock synced at uptime %d s (earlier boot+ times count from reset)") \
+  X(EV_CLOCK_KEPT,             "Clock kept through reset: error up to %d ms, drift %d ppb") \
+  X(EV_CLOCK_RESUMED,          "Clock resumed from NVS checkpoint: error up to %d ms plus the time without power, drift %d ppb") \
+  X(EV_CLOCK_LOST,             "No clock checkpoint - schedule waits for time sync") \
+  X(EV_CLOCK_CORRECTED,        "Time sync moved the clock by %d ms, %d s after it was set (estimated error %d ms, drift %d ppb, source %s)") \
+  X(EV_TASK_START_FAILED,      "Background task %s did not start (hal::MAX_PERIODIC)")
+
+#define LOG_EVENT_ENUM(id, fmt) id,
+enum LogEvent : uint8_t { LOG_EVENTS(LOG_EVENT_ENUM) LOG_EVENT_COUNT };
+#undef LOG_EVENT_ENUM
+
+// Runtime level; read by logEnabled() on every call.
+extern std::atomic<uint8_t> logRuntimeLevel;
+
+// True if a record at level would be kept. With a constant level below
+// LOG_COMPILE_LEVEL this is constant false and the call folds away.
+inline bool logEnabled(LogLevel level) {
+  return level >= LOG_COMPILE_LEVEL && level >= logRuntimeLevel.load(std::memory_order_relaxed);
+}
+
+// Append a record stamped now, whatever its level (see logEvent()).
+void logEventNow(LogLevel level, LogEvent event, const int32_t *args, uint8_t argc, const char *text,
+                 int8_t channel = LOG_NO_CHANNEL);
+// printf into a LOG_MAX_TEXT stack buffer, then an EV_TEXT record (see LOG_TEXT).
+void logText(LogLevel level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Append one record. args beyond LOG_MAX_ARGS are ignored, text and channel
+// are optional.
+inline void logEvent(LogLevel level, LogEvent event, std::initializer_list<int32_t> args = {}, const char *text = nullptr,
+                     int8_t channel = LOG_NO_CHANNEL) {
+  if (logEnabled(level)) {
+    logEventNow(level, event, args.begin(), args.size() > LOG_MAX_ARGS ? LOG_MAX_ARGS : args.size(), text, channel);
+  }
+}
+// Same with an explicit timestamp, for events that were queued elsewhere first.
+void logEventAt(uint32_t epoch, LogLevel level, LogEvent event, const int32_t *args, uint8_t argc,
+                const char *text = nullptr, int8_t channel = LOG_NO_CHANNEL);
+// Free-form printf-style record without a table entry, for diagnostics:
+//   LOG_TEXT(LOG_DEBUG, "heap %u, largest %u", free, largest);
+// A macro so the arguments aren't even evaluated when the level is off.
+#define LOG_TEXT(level, ...) \
+  do { \
+    if (logEnabled(level)) logText(level, __VA_ARGS__); \
+  } while (0)
+
+// Runtime level, stored in NVS; logInit() restores it. Clamped to
+// LOG_COMPILE_LEVEL.
+void logSetLevel(LogLevel level);
+LogLevel logLevel();
+// "DEBUG", "INFO", ...
+const char *logLevelName(LogLevel level);
+
+// Start the background flusher (hal::startPeriodic). Call once the filesystem
+// is mounted; records logged before that are kept in the ring and written on
+// the first flush.
+void logInit();
+// Write all pending records to flash now (blocking).
+void logFlush();
+// Number of records dropped because the ring was full (since boot).
+uint32_t logDroppedCount();
+
+// True if there is anything to render (in RAM or on flash).
+bool logAvailable();
+// Flush, then return the length of the whole log rendered as text; byte
+// ranges in LogQuery refer to that text. `rotations` receives the rotation
+// count under the same lock: a rotation drops the oldest file and shifts
+// every offset, so a range only holds while the count is unchanged.
+uint32_t logTextSize(uint32_t &rotations);
+// Parse "DEBUG"/"INFO"/"WARN"/"ERROR"; false if unknown.
+bool logLevelFromName(const char *name, LogLevel &level);
+
+const uint32_t LOG_ANY_ROTATIONS = UINT32_MAX;
+
+// Selects part of the log for LogReader. The filters combine: tail counts
+// records at minLevel or above from the end, since then drops older ones.
+// A byte range always refers to the unfiltered text.
+struct LogQuery {
+  uint32_t tail = 0;              // last N records, 0 = all
+  uint32_t since = 0;             // epoch seconds, 0 = all
+  LogLevel minLevel = LOG_DEBUG;
+  uint32_t rangeStart = 0;        // first byte of the text
+  uint32_t rangeLen = UINT32_MAX; // bytes from there
+  uint32_t rotations = LOG_ANY_ROTATIONS; // from logTextSize(), for a range
+};
+
+// Renders the log as text lines (rotated files oldest first, then the
+// current file) a buffer at a time, for streaming to slow clients. Each
+// read() holds off the flusher only while it runs, and rotations between
+// calls are followed. The first read() (or start()) flushes the RAM ring and
+// seeks to the start of the query via the index. When the reader reaches the end of
+// /log.bin it flushes once more and reads on, so the output ends with the
+// records that were pending at that point.
+class LogReader {
+ public:
+  explicit LogReader(const LogQuery &query = LogQuery()) : query_(query) {}
+
+  // Flush and seek to the query now rather than on the first read(). False
+  // if query.rotations is set and the log has rotated since (the range no
+  // longer points at the same text); read() then returns nothing.
+  bool start();
+  // Rotation count the reader started at; with a boot id, an ETag for the
+  // text it renders (later flushes only append to it).
+  uint32_t startRotations() const { return startRotations_; }
+
+  // Fill buf with up to len bytes; 0 means the end of the log.
+  size_t read(char *buf, size_t len);
+
+ private:
+  size_t drainLine(char *buf, size_t len);
+  void startLocked();
+  void followRotations();
+  void seekToQuery();
+  bool wanted(const uint8_t *rec);
+
+  LogQuery query_;
+  int file_ = LOG_ROTATE_COUNT; // rotation index being read, 0 = /log.bin
+  uint32_t offset_ = 0;         // next record in that file
+  uint32_t rotations_ = 0;      // rotation count file_ refers to
+  uint32_t startRotations_ = 0;
+  uint32_t skipText_ = 0;       // bytes to drop before the range starts
+  uint32_t skipMatches_ = 0;    // records to drop before the tail starts
+  bool started_ = false;
+  bool flushed_ = false;
+  bool done_ = false;
+  ClockFormatter clock_;
+  char line_[LOG_MAX_LINE];     // current rendered line, handed out from lineOff_
+  uint16_t lineLen_ = 0;
+  uint16_t lineOff_ = 0;
+};
+
+// Render the whole log through a LogReader and hand it to sink in chunks.
+// Returns false if there is nothing to render.
+bool logRenderText(const std::function<void(const char *, size_t)> &sink);
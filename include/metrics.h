@@ -0,0 +1,82 @@
+#pragma once
+
+// Runtime metrics, served at /metrics in Prometheus text format.
+//
+// Timings go into fixed log2 histograms (bucket i: up to 2^i us, the last
+// one open-ended), from which p50/p99 are read as bucket upper bounds; max
+// is exact. Every histogram and counter is written by one task only, so
+// recording is a few plain increments. A scrape may see a sample half
+// applied, which is harmless for monitoring.
+//
+// Times come from hal::micros() (esp_timer on target). The CPU cycle counter
+// would be cheaper, but with idle sleep enabled the CPU clock switches
+// between 80 and 240 MHz, so cycle counts could not be converted to time.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+#include "hal.h"
+
+const uint8_t METRIC_BUCKETS = 18; // up to 65536 us, then +Inf
+
+// Histograms: ID, metric name (after "katzefroh_"), help text.
+#define METRIC_HISTOGRAMS(X) \
+  X(HIST_CONTROL_PASS,   "control_pass_us",         "Duration of one control task pass (feederLoop)") \
+  X(HIST_CONTROL_WAKE,   "control_wake_latency_us", "Control task start after its deadline or a switch edge") \
+  X(HIST_SCHEDULE,       "schedule_check_us",       "Schedule check within a control pass") \
+  X(HIST_SWITCH,         "switch_edges_us",         "Switch edge debouncing and step counting within a control pass") \
+  X(HIST_EVENT_SERVICE,  "event_service_us",        "Moving control task events into the log") \
+  X(HIST_LOG_FLUSH,      "log_flush_us",            "Writing a batch of log records to flash") \
+  X(HIST_HTTP,           "http_handler_us",         "HTTP request handlers (streamed bodies not included)") \
+  X(HIST_HTTP_ALLOCS,    "http_handler_allocs",     "Heap allocations per HTTP request handler (a count, not us)")
+
+// Counters: ID, metric name (after "katzefroh_"), help text.
+#define METRIC_COUNTERS(X) \
+  X(CTR_FS_WRITES,        "fs_writes_total",        "Log batches appended to flash") \
+  X(CTR_FS_WRITE_BYTES,   "fs_write_bytes_total",   "Bytes appended to log files") \
+  X(CTR_FS_RENAMES,       "fs_renames_total",       "Log file renames during rotation") \
+  X(CTR_WIFI_DISCONNECTS, "wifi_disconnects_total", "WiFi station disconnects") \
+  X(CTR_WIFI_RECONNECTS,  "wifi_reconnects_total",  "WiFi station got an IP again after a disconnect") \
+  X(CTR_RUN_JAMS,         "run_jams_total",         "Scheduled runs stopped as jammed (step over the learned limit)") \
+  X(CTR_RUN_TIMEOUTS,     "run_timeouts_total",     "Scheduled runs stopped by the SCHEDULED_RUN_MAX_MS failsafe")
+
+#define METRIC_ENUM(id, name, help) id,
+enum MetricHistogram : uint8_t { METRIC_HISTOGRAMS(METRIC_ENUM) METRIC_HISTOGRAM_COUNT };
+enum MetricCounter : uint8_t { METRIC_COUNTERS(METRIC_ENUM) METRIC_COUNTER_COUNT };
+#undef METRIC_ENUM
+
+class Histogram {
+ public:
+  void record(uint32_t us);
+  uint32_t count() const { return count_; }
+  uint64_t sum() const { return sum_; }
+  uint32_t max() const { return max_; }
+  uint32_t bucket(uint8_t i) const { return buckets_[i]; }
+  // Upper bound of the bucket holding quantile q (0..1), capped at max().
+  uint32_t quantile(float q) const;
+
+ private:
+  uint32_t buckets_[METRIC_BUCKETS] = {0};
+  uint32_t count_ = 0;
+  uint64_t sum_ = 0;
+  uint32_t max_ = 0;
+};
+
+void metricsRecord(MetricHistogram h, uint32_t us);
+void metricsCount(MetricCounter c, uint32_t n = 1);
+
+// Times the enclosing scope into histogram h.
+class MetricTimer {
+ public:
+  explicit MetricTimer(MetricHistogram h) : h_(h), start_(hal::micros()) {}
+  ~MetricTimer() { metricsRecord(h_, (uint32_t)(hal::micros() - start_)); }
+
+ private:
+  MetricHistogram h_;
+  uint64_t start_;
+};
+
+// Render all metrics plus heap, uptime and logger gauges as Prometheus text,
+// a line at a time.
+void metricsRender(const std::function<void(const char *, size_t)> &sink);
@@ -0,0 +1,25 @@
+#pragma once
+
+// Trace replay for the native simulator (--replay).
+//
+// Feeds a trace recorded on a unit (trace.h) through the real control logic
+// on the virtual clock: the switch pin follows the recorded edges at their
+// recorded times, the wall clock follows the recorded offsets and schedule
+// changes are posted as the web side did. Relay changes and schedule fires
+// of the replay are then matched one by one against the recorded ones.
+// A day of trace replays in well under a second.
+
+#include <stdint.h>
+
+#include <vector>
+
+struct ReplayOptions {
+  std::vector<const char *> files; // concatenated in order (e.g. trace.1.bin trace.bin)
+  int segment = 0;                 // start at this snapshot (0 = first in the files)
+  uint32_t toleranceMs = 1000;     // relay changes and fires this close still match
+  bool verbose = false;            // list every relay change, not only mismatches
+};
+
+// Returns the process exit code: 0 if the timelines match, 1 if not, 2 if
+// the trace could not be used.
+int replayTrace(const ReplayOptions &options);
@@ -0,0 +1,115 @@
+#pragma once
+
+// Append-only log store on a raw flash partition (STORAGE_RING).
+//
+// The partition is a ring of 4 KB sectors. Each sector belongs to one file
+// and starts with a header: the file id, the sector's position in the file
+// and an allocation sequence number, which tells mount where the ring
+// stopped. After the header come RING_NAME_SLOTS name slots (used in a
+// file's first sector only), then the data. The end slots fill the sector
+// from its last bytes downwards, towards the data: a sector is full when
+// the two meet, so it holds as many bytes as the appends leave room for
+// (2 bytes of end slot each), however small they are.
+//
+// Nothing is rewritten in place. An append programs the data after what the
+// sector already holds, then the next end slot with the new fill level, so
+// a torn append is simply not there after a reset. A rename programs the
+// next name slot (a torn one leaves the old name); a remove clears a flag
+// in the first sector's header. Rotating the logs therefore costs a few
+// small writes instead of a filesystem metadata update. Sectors of removed
+// files (and anything another filesystem left behind) are erased when the
+// ring comes round to them, so erases land on appends, one sector at a
+// time.
+//
+// Only what the logger and trace need: appends (writes always go to the
+// end), reads with seek, exists, remove and rename onto a free name. Names
+// are up to RING_NAME_LEN - 1 characters, at most RING_MAX_FILES files. A
+// full ring fails appends. Space goes by bytes, so the logger's rotation
+// keeps it from filling: the four log files of MAX_LOG_SIZE take about 80
+// sectors even with 12-byte appends.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+#include "hal.h"
+
+const size_t FLASH_SECTOR_SIZE = 4096;
+
+// Raw flash: erase sets whole sectors to 0xFF, write can only clear bits.
+// Offsets are relative to the partition.
+class FlashPartition {
+ public:
+  virtual ~FlashPartition() = default;
+  virtual size_t size() const = 0;
+  virtual bool read(size_t offset, void *buf, size_t len) = 0;
+  virtual bool write(size_t offset, const void *buf, size_t len) = 0;
+  virtual bool erase(size_t offset, size_t len) = 0;
+};
+
+const uint16_t RING_MAX_SECTORS = 256;  // 1 MB; the rest of a bigger partition stays unused
+const uint8_t RING_MAX_FILES = 8;
+const size_t RING_NAME_LEN = 16;
+const uint8_t RING_NAME_SLOTS = 8;      // renames per file
+const size_t RING_HEADER_SIZE = 16;
+const size_t RING_DATA_OFFSET = RING_HEADER_SIZE + RING_NAME_SLOTS * RING_NAME_LEN;
+const size_t RING_END_SLOT_SIZE = 2;
+
+class RingFs : public hal::FileSystem {
+ public:
+  explicit RingFs(FlashPartition &flash) : flash_(flash) {}
+
+  // Scan the partition and rebuild the file table. false if the partition
+  // has fewer than two sectors.
+  bool mount();
+  // Erase the ring and start empty.
+  bool format();
+
+  hal::File open(const char *path, const char *mode) override;
+  bool exists(const char *path) override;
+  bool remove(const char *path) override;
+  bool rename(const char *from, const char *to) override;
+
+  // For the file handles; 0 once the file is gone.
+  size_t read(uint32_t id, size_t pos, uint8_t *buf, size_t len);
+  size_t append(uint32_t id, const uint8_t *buf, size_t len);
+  size_t size(uint32_t id);
+
+ private:
+  struct Sector {
+    uint32_t file;  // file id, or RING_FREE / RING_STALE
+    uint16_t index; // position in the file
+    uint16_t used;  // data bytes
+    uint16_t next;  // next sector of the file, RING_NONE after the last
+    uint16_t ends;  // end slots programmed
+    bool sealed;    // no more appends (full, or damaged)
+  };
+  struct Entry {
+    uint32_t id;    // 0 for an unused entry
+    char name[RING_NAME_LEN];
+    uint8_t names;  // name slots programmed
+    uint16_t first;
+    uint16_t last;
+    uint32_t size;
+  };
+
+  bool prepare();
+  bool blank(uint16_t sector, size_t from, size_t to);
+  void readEnds(uint16_t sector);
+  bool addEntry(uint16_t sector, uint32_t id);
+  uint16_t allocate(uint32_t file, uint16_t index);
+  Entry *find(const char *name);
+  Entry *find(uint32_t id);
+  Entry *create(const char *name);
+  void removeLocked(Entry &e);
+
+  FlashPartition &flash_;
+  hal::Mutex mutex_;
+  std::unique_ptr<Sector[]> sectors_;
+  uint16_t count_ = 0;
+  uint16_t cursor_ = 0;
+  uint32_t nextId_ = 1;
+  uint32_t nextSeq_ = 1;
+  Entry files_[RING_MAX_FILES] = {};
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+// Per-run step telemetry and jam detection for scheduled motor runs.
+//
+// Every step (debounced rising edge of the auger switch) is timestamped; the
+// time since the previous step, or since the relay went on for the first
+// one, is kept with the run. Each schedule entry has a StepModel: a window
+// of the last STEP_MODEL_SAMPLES step times, from which the jam limit is
+// derived as JAM_FACTOR x p95. Once a model has STEP_MODEL_MIN_SAMPLES, a
+// step that takes longer than that limit ends the run as jammed instead of
+// running the motor until SCHEDULED_RUN_MAX_MS. Until then, and for runs
+// without a schedule entry, only the fixed failsafe applies.
+//
+// Models live in RAM and are relearned after a reboot (a few runs). The last
+// RUN_HISTORY finished runs are kept for /runs.
+//
+// Written by the control task only; history() and models() copy under a
+// spin lock for the web side.
+
+#include <stdint.h>
+
+#include "hal.h"
+#include "schedule.h"
+
+const uint8_t RUN_MAX_STEPS = 16;         // step times kept per run
+const uint8_t RUN_HISTORY = 16;           // finished runs kept
+const uint8_t STEP_MODEL_SAMPLES = 32;    // step times per schedule entry model
+const uint8_t STEP_MODEL_MIN_SAMPLES = 8; // before that, no jam limit
+const uint8_t JAM_FACTOR = 3;             // k: jam once a step takes k x p95
+const uint32_t JAM_MIN_MS = 2000;         // lower bound for the jam limit
+
+enum RunOutcome : uint8_t { RUN_ACTIVE, RUN_COMPLETE, RUN_JAMMED, RUN_TIMEOUT, RUN_STOPPED };
+
+// "active", "complete", "jammed", "timeout", "stopped"
+const char *runOutcomeName(RunOutcome outcome);
+
+struct RunRecord {
+  uint32_t startEpoch;
+  uint32_t durationMs;
+  uint32_t limitMs;               // jam limit at the end, 0 if none was learned yet
+  int8_t entry;                   // schedule entry, -1 if none
+  uint8_t stepsWanted;
+  uint8_t steps;                  // steps seen (may exceed RUN_MAX_STEPS)
+  RunOutcome outcome;
+  uint16_t stepMs[RUN_MAX_STEPS]; // per step: ms since the previous step
+};
+
+// Rolling window of step times for one schedule entry.
+class StepModel {
+ public:
+  void add(uint32_t ms);
+  void reset() { *this = StepModel(); }
+  uint8_t samples() const { return count_; }
+  uint32_t p50() const { return p50_; }
+  uint32_t p95() const { return p95_; }
+  // Jam limit in ms, 0 while there are too few samples.
+  uint32_t limitMs() const { return count_ >= STEP_MODEL_MIN_SAMPLES ? limitMs_ : 0; }
+
+ private:
+  uint16_t samples_[STEP_MODEL_SAMPLES] = {0};
+  uint8_t next_ = 0;
+  uint8_t count_ = 0;
+  uint32_t p50_ = 0;
+  uint32_t p95_ = 0;
+  uint32_t limitMs_ = 0;
+};
+
+class RunTelemetry {
+ public:
+  // Relay went on for a run of `steps` steps for schedule entry `entry` (-1: none).
+  void begin(uint32_t nowUs, uint32_t epoch, int entry, uint8_t steps);
+  // A step was seen at edgeUs (the debounced edge, not when it was processed).
+  void step(uint32_t edgeUs);
+  // Run is over; files it into the history. No-op if no run is active.
+  void end(uint32_t nowUs, RunOutcome outcome);
+
+  bool active() const { return active_; }
+  // The active run, or the one that ended last
+  const RunRecord &last() const { return current_; }
+  uint8_t steps() const { return current_.steps; }
+  // Jam limit for the step in progress, 0 if none, and the p95 it comes from
+  uint32_t limitMs() const;
+  uint32_t p95Ms() const;
+  // ms the step in progress has been running
+  uint32_t stepElapsedMs(uint32_t nowUs) const { return (nowUs - lastStepUs_) / 1000; }
+  bool jammed(uint32_t nowUs) const;
+  // ms until jammed() turns true, UINT32_MAX if there is no limit
+  uint32_t msUntilJam(uint32_t nowUs) const;
+  // Slowest step of the active (or just ended) run
+  uint32_t slowestStepMs() const { return slowestMs_; }
+
+  // Schedule entry i changed; its step times no longer apply.
+  void resetModel(uint8_t i);
+
+  // Copy up to max finished runs, newest first; returns how many.
+  uint8_t history(RunRecord *out, uint8_t max) const;
+  // Copy the models of the first count schedule entries.
+  void models(StepModel *out, uint8_t count) const;
+
+ private:
+  StepModel models_[MAX_SCHEDULE_ENTRIES];
+  RunRecord current_ = {};
+  RunRecord history_[RUN_HISTORY];
+  uint8_t historyNext_ = 0;
+  uint8_t historyCount_ = 0;
+  uint32_t startUs_ = 0;
+  uint32_t lastStepUs_ = 0;
+  uint32_t slowestMs_ = 0;
+  bool active_ = false;
+  mutable hal::SpinLock lock_;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+// Feeding schedule: a variable number of daily entries, each optionally
+// restricted to some weekdays. ScheduleEngine keeps the entries ordered by
+// their next fire time (absolute epoch, so DST is handled by mktime) and
+// exposes one monotonic deadline; nothing needs to be recomputed until that
+// deadline passes, the entries change or the wall clock jumps.
+//
+// Missed fires: when the wall clock is found to be past an entry's fire
+// time (clock jump forward, task stalled), the entry still runs if it is at
+// most SCHEDULE_CATCH_UP_S late, otherwise it is skipped and reported.
+// Several overdue entries are handled one per poll, oldest first. After a
+// jump backwards an entry does not fire again for a slot it already ran.
+// The first valid wall time after boot only arms the entries; slots before
+// it are not caught up, so a reboot right after feeding cannot feed twice.
+
+#include <stdint.h>
+#include <time.h>
+
+#include "wall_clock.h"
+
+const uint8_t MAX_SCHEDULE_ENTRIES = 16;
+const uint8_t ALL_WEEKDAYS = 0x7F;                  // bit n = tm_wday n (0 = Sunday)
+const uint32_t SCHEDULE_CATCH_UP_S = 5 * 60;        // run a missed entry if at most this late
+const uint32_t SCHEDULE_RECHECK_MS = 60UL * 1000UL; // longest deadline, bounds clock jump detection
+const time_t SCHEDULE_MIN_VALID_EPOCH = CLOCK_MIN_VALID_EPOCH;
+
+struct ScheduleEntry {
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t steps;
+  uint8_t weekdays; // ALL_WEEKDAYS for every day, 0 disables the entry
+};
+
+// First local time strictly after `after` matching the entry, 0 if none
+// (no weekday selected).
+time_t scheduleNextFire(const ScheduleEntry &e, time_t after);
+
+class ScheduleEngine {
+ public:
+  // Result of poll()
+  static const int NONE = -1;
+
+  // Replace all entries (config change). Their fire times are recomputed on
+  // the next poll(), which is due immediately.
+  void setEntries(const ScheduleEntry *entries, uint8_t count, uint32_t nowMs);
+
+  // Call when nowMs has reached deadlineMs() (cheap to call earlier). Returns
+  // the index of the entry to run now, or NONE. `lateS` is how late that fire
+  // is; skippedOut receives an entry that was skipped as too late (or NONE).
+  int poll(time_t nowEpoch, uint32_t nowMs, uint32_t &lateS, int &skippedOut);
+
+  // millis() value at which poll() has something to do.
+  uint32_t deadlineMs() const { return deadlineMs_; }
+
+  uint8_t count() const { return count_; }
+  const ScheduleEntry &entry(uint8_t i) const { return entries_[i]; }
+  // Next fire time of entry i (0 if unarmed or disabled).
+  time_t nextFire(uint8_t i) const { return next_[i]; }
+
+ private:
+  void arm(uint8_t i, time_t after);
+  void sortOrder();
+  void updateDeadline(time_t nowEpoch, uint32_t nowMs);
+
+  ScheduleEntry entries_[MAX_SCHEDULE_ENTRIES];
+  time_t next_[MAX_SCHEDULE_ENTRIES] = {0};
+  time_t lastFired_[MAX_SCHEDULE_ENTRIES] = {0};
+  uint8_t order_[MAX_SCHEDULE_ENTRIES]; // entry indices by next_, disabled last
+  uint8_t count_ = 0;
+  bool armed_ = false;                  // wall time was valid when next_ was computed
+  uint32_t deadlineMs_ = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+// Persistent settings, stored in NVS as a single blob:
+//   uint16 version  SETTINGS_VERSION when written
+//   uint16 length   payload bytes
+//   payload         Settings, packed
+//   uint32 crc      CRC-32 of everything before it
+// One NVS write replaces the whole blob, so a power loss leaves either the
+// old or the new settings, never a mix. settingsSave() skips the write when
+// the content is unchanged.
+//
+// Adding a setting: append the field to Settings, give it a default in
+// settingsDefaults() and bump SETTINGS_VERSION. Older blobs load with their
+// shorter payload and keep the defaults for the new fields.
+//
+// Version 2 has a schedule per feeder channel. Channel 0 sits where the
+// single schedule of version 1 was, so a version 1 blob loads as channel 0.
+
+#include <stdint.h>
+
+#include "board.h"
+#include "schedule.h"
+
+const uint16_t SETTINGS_VERSION = 2;
+
+struct __attribute__((packed)) ChannelSettings {
+  uint8_t scheduleCount;
+  ScheduleEntry schedule[MAX_SCHEDULE_ENTRIES];
+};
+
+// Room for MAX_FEEDER_CHANNELS whatever the board profile uses
+struct __attribute__((packed)) Settings {
+  ChannelSettings channels[MAX_FEEDER_CHANNELS];
+};
+
+enum SettingsLoadResult : uint8_t {
+  SETTINGS_LOADED,
+  SETTINGS_MISSING, // nothing stored yet
+  SETTINGS_INVALID  // bad CRC, length or a newer version
+};
+
+// Built-in defaults for every field.
+void settingsDefaults(Settings &s);
+// Read the blob into s. On anything but SETTINGS_LOADED, s is left as passed
+// in (callers fill it with defaults first).
+SettingsLoadResult settingsLoad(Settings &s);
+enum SettingsSaveResult : uint8_t { SETTINGS_SAVED, SETTINGS_UNCHANGED, SETTINGS_WRITE_FAILED };
+
+// Write s unless it equals what was last loaded or saved.
+SettingsSaveResult settingsSave(const Settings &s);
@@ -0,0 +1,75 @@
+#pragma once
+
+// Field traces for deterministic replay (ENABLE_TRACE in feeder.h).
+//
+// The control task records what drives the feeder and what it did as fixed
+// 16-byte records stamped with hal::micros(): raw switch edges (with their
+// interrupt timestamps), relay changes, schedule fires, wall clock offsets,
+// schedule changes and feed requests. Records about a feeder channel carry
+// its number in aux (0 in traces from before channels). A snapshot
+// (TR_START, the clock, every channel's switch level and schedule) opens
+// every trace and is repeated after
+// each file rotation, so a replay can start at the beginning of either file.
+//
+// Records go through a lock-free queue to feederService(), which appends
+// them to TRACE_PATH in batches and moves the file to TRACE_OLD_PATH once
+// it reaches TRACE_MAX_SIZE. About 2 KB per day at three feedings.
+//
+// The native simulator replays a trace (--replay) through the same control
+// logic on its virtual clock and diffs the relay timeline against the
+// recorded one.
+
+#include <stddef.h>
+#include <stdint.h>
+
+const size_t TRACE_MAX_SIZE = 64 * 1024;        // rotate TRACE_PATH at this size
+const uint8_t TRACE_FLUSH_RECORDS = 32;         // append once this many are queued
+const uint32_t TRACE_FLUSH_MAX_AGE_MS = 10000;  // ... or the oldest is this old
+const uint32_t TRACE_CLOCK_TOLERANCE_MS = 10;   // wall clock drift that gets a TR_CLOCK
+const char *const TRACE_PATH = "/trace.bin";
+const char *const TRACE_OLD_PATH = "/trace.1.bin";
+
+// Record types. Stored on flash: only append.
+enum TraceType : uint8_t {
+  TR_START = 1,       // snapshot follows; arg 1 = first since reset, value = channels (0: one)
+  TR_SWITCH,          // raw edge; arg bit 0 = closed, bit 1 = resync after lost edges; aux = channel
+  TR_RELAY,           // arg 1 = on, 0 = off; aux = channel
+  TR_FIRE,            // schedule entry arg fired; value = epoch seconds; aux = channel
+  TR_CLOCK,           // wall clock now: value = epoch seconds, aux = ms
+  TR_SCHEDULE_ENTRY,  // arg = index, value = the ScheduleEntry bytes; aux = channel
+  TR_SCHEDULE_COMMIT, // arg = entry count; the staged entries apply from here; aux = channel
+  TR_DROPPED,         // value = records lost before this one (queue full)
+  TR_FEED             // run of arg portions requested (/api/feed); aux = channel
+};
+
+struct TraceRecord {
+  uint64_t us;    // hal::micros() when it happened
+  uint32_t value;
+  uint16_t aux;
+  uint8_t type;
+  uint8_t arg;
+};
+static_assert(sizeof(TraceRecord) == 16, "trace records are 16 bytes on flash");
+
+// --- Control task (the only producer) ---
+// True once traceStart() ran.
+bool traceActive();
+// No-op unless active. Drops (and counts) the record if the queue is full.
+void traceRecord(TraceType type, uint64_t us, uint8_t arg = 0, uint32_t value = 0, uint16_t aux = 0);
+// A snapshot is wanted (trace start, file rotation): returns true once, then
+// the caller writes TR_START and the state records at the next idle moment.
+bool traceSnapshotDue();
+
+// --- Web side ---
+// Start recording; call once the filesystem is mounted.
+void traceStart();
+// Append queued records to the file when a batch is due. Called from
+// feederService(), the only consumer.
+void traceFlushPoll();
+// Read len bytes at offset of TRACE_PATH (old = false) or TRACE_OLD_PATH;
+// returns the bytes read, 0 at the end. Safe against concurrent appends.
+size_t traceRead(bool old, uint32_t offset, uint8_t *buf, size_t len);
+
+// Replay (native): deliver records to sink right away instead of queueing
+// them for the file, and mark tracing active.
+void traceCapture(void (*sink)(const TraceRecord &));
@@ -0,0 +1,109 @@
+#pragma once
+
+// Wall clock for log timestamps.
+//
+// Records are stamped with clockStamp(): epoch seconds once the system clock
+// is valid, and before that (cold boot, no SNTP yet) seconds of uptime.
+// Stamps below CLOCK_MIN_VALID_EPOCH are uptime stamps; once the clock has
+// synced, clockFixStamp() turns them into epoch seconds with the boot time
+// it noted at the sync. What is still uptime-stamped then renders as
+// "boot+hh:mm:ss" instead of a meaningless 1970 date.
+//
+// Local time comes from a cached UTC offset that holds until the next DST
+// transition of the TZ rule, so rendering needs no localtime_r() except
+// twice a year. ClockFormatter renders "YYYY-MM-DD hh:mm:ss" incrementally:
+// the date part is rebuilt only when a stamp falls on another local day.
+//
+// Offline continuity: clockPoll() checkpoints the time every
+// CLOCK_CHECKPOINT_MS to RTC memory (survives resets, not a power cut) and
+// every CLOCK_NVS_CHECKPOINT_S to NVS. At boot clockResume() sets the clock
+// from the newest checkpoint if nothing kept it, so the schedule runs before
+// the network is up. An NVS checkpoint is behind by the time the unit was
+// without power; SNTP corrects that later. Between syncs the clock runs on
+// the crystal; the drift learned from successive SNTP syncs is stepped out
+// while there is none, and the error estimate grows with the time since the
+// clock was last set.
+
+#include <stddef.h>
+#include <stdint.h>
+
+const uint32_t CLOCK_MIN_VALID_EPOCH = 1577836800; // 2020-01-01: before that, time is not synced
+const size_t CLOCK_TEXT_LEN = 20;                  // "2026-03-23 07:30:00" and NUL
+const uint32_t CLOCK_CHECKPOINT_MS = 60UL * 1000UL; // clockPoll() period: RTC checkpoint, drift steps
+const uint32_t CLOCK_NVS_CHECKPOINT_S = 600;        // 144 NVS writes a day, spread over its pages
+const uint32_t CLOCK_SNTP_ERROR_MS = 50;            // right after a sync
+const uint32_t CLOCK_DRIFT_MIN_SPAN_S = 1800;       // shorter sync intervals give no drift sample
+const int32_t CLOCK_DRIFT_MAX_PPB = 500000;         // larger is a clock change, not crystal drift
+const uint32_t CLOCK_DRIFT_UNKNOWN_PPB = 50000;     // error growth until a drift estimate exists
+const uint32_t CLOCK_DRIFT_RESIDUAL_PPB = 5000;     // error growth with one
+const uint32_t CLOCK_STEP_MIN_MS = 100;             // drift corrections are stepped in this size
+const int32_t CLOCK_DRIFT_UNKNOWN = INT32_MIN;
+
+// Where the current wall time came from.
+enum ClockSource : uint8_t {
+  CLOCK_NONE, // not set: schedules wait for a sync
+  CLOCK_NVS,  // NVS checkpoint after a power cut, behind by the time without power
+  CLOCK_RTC,  // kept through a reset (RTC timer or RTC memory checkpoint)
+  CLOCK_SNTP  // synced since boot
+};
+
+struct ClockStatus {
+  ClockSource source;
+  uint32_t errorMs;  // estimated, grows since the clock was last set
+  int32_t driftPpb;  // crystal drift (positive: runs slow), CLOCK_DRIFT_UNKNOWN before two syncs
+  uint32_t sinceSetS; // since the sync or resume the error counts from
+  bool errorLowerBound; // errorMs leaves out the unknown time without power (CLOCK_NVS)
+};
+
+// Set the POSIX TZ rule for local time (also for localtime_r/mktime) and
+// drop the cached offset. Call before the first log record.
+void clockInit(const char *tzRule);
+
+// True once the wall clock has been valid; notes the boot time then.
+bool clockSynced();
+// Epoch seconds once synced, else seconds since boot.
+uint32_t clockStamp();
+// Epoch seconds at boot, 0 before the sync.
+uint32_t clockBootEpoch();
+
+inline bool clockIsUptime(uint32_t stamp) { return stamp < CLOCK_MIN_VALID_EPOCH; }
+// An uptime stamp of this boot as epoch seconds, once that is known;
+// anything else unchanged.
+inline uint32_t clockFixStamp(uint32_t stamp) {
+  uint32_t boot = clockIsUptime(stamp) ? clockBootEpoch() : 0;
+  return boot ? boot + stamp : stamp;
+}
+
+// Set the clock from a checkpoint if nothing kept it across the reset, log
+// where the time came from, and start the checkpoints (hal::startPeriodic).
+// Call right after clockInit(), before the schedule is loaded. If the clock
+// already has a source (clockNoteSync()), only loads the drift estimate.
+void clockResume();
+// SNTP has just set the clock: rebase the error, learn the drift. Any task.
+void clockNoteSync();
+// Write both checkpoints now, e.g. before a planned restart.
+void clockCheckpoint();
+// Periodic work: drift correction and checkpoints. clockResume() schedules it.
+void clockPoll();
+ClockStatus clockStatus();
+// "none", "nvs", "rtc", "sntp"
+const char *clockSourceName(ClockSource source);
+
+// Offset of local time from UTC at epoch, in seconds, and the epoch range
+// [from, until) it holds for.
+int32_t clockUtcOffset(uint32_t epoch, uint32_t *from = nullptr, uint32_t *until = nullptr);
+
+// Renders stamps for one caller (not thread safe; give each task its own).
+// Sequential stamps, as in a log, mostly just rewrite the time of day.
+class ClockFormatter {
+ public:
+  // Write stamp to buf (at least CLOCK_TEXT_LEN bytes); returns the length.
+  size_t format(uint32_t stamp, char *buf);
+
+ private:
+  uint32_t from_ = 0;      // offset_ holds for epochs [from_, until_)
+  uint32_t until_ = 0;
+  int32_t offset_ = 0;
+  int64_t dayStart_ = -1;  // local seconds at midnight of the date in text_
+  char text_[CLOCK_TEXT_LEN] = {};
+};
@@ -0,0 +1,195 @@
+// Log storage benchmark ([env:bench] on the board, [env:bench_native] on
+// the host).
+//
+// Formats the storage partition for each backend in turn and replays the
+// logger's write pattern on it: batches of BENCH_BATCH_MIN..BENCH_BATCH_MAX
+// bytes appended to /log.bin with one open/write/close each, as
+// flushPendingLocked() does, and the /log.1.bin../log.3.bin rename chain of
+// rotateLogs() whenever /log.bin reaches MAX_LOG_SIZE. A second pass runs
+// next to a ballast file, where SPIFFS has to garbage collect. A third one
+// appends BENCH_SMALL_MIN..BENCH_SMALL_MAX bytes at a time, as the age
+// flush does on a quiet device with a record or two per flush; the file
+// count and rotation stay the same, so a backend that charges per append
+// rather than per byte runs out of room there. Per backend and pass it
+// reports
+//
+//   append  time of one batch: count, p50/p99 (log2 bucket bounds), max
+//   rotate  time of one rename chain, same
+//   mount   time to mount the filled partition again (the boot cost)
+//   amp     bytes programmed, and bytes erased, per payload byte
+//   verify  /log.bin read back after the remount
+//
+// On the host SPIFFS and LittleFS are the same in-memory filesystem, and
+// only the ring's NOR flash model charges time, so there the numbers are
+// mostly a check of the ring's bookkeeping.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+#include "logger.h"
+#include "metrics.h"
+#ifndef ARDUINO
+#include "hal_native.h"
+#endif
+
+const size_t BENCH_PAYLOAD_BYTES = 1024 * 1024; // per pass, about 16 rotations
+const size_t BENCH_BALLAST_BYTES = 512 * 1024;
+const size_t BENCH_BATCH_MIN = 256;
+const size_t BENCH_BATCH_MAX = 2048;            // LOG_FLUSH_THRESHOLD and a bit
+const size_t BENCH_SMALL_PAYLOAD_BYTES = 384 * 1024; // the rotation set and half again
+const size_t BENCH_SMALL_MIN = 8;                // one record per flush
+const size_t BENCH_SMALL_MAX = 16;
+
+enum BenchPass : uint8_t { PASS_EMPTY, PASS_BALLAST, PASS_SMALL };
+
+struct BenchResult {
+  Histogram append;
+  Histogram rotate;
+  uint32_t mountUs;
+  size_t payload;
+  hal::FlashStats flash; // during the appends and rotations only
+  bool verified;
+};
+
+static void report(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void report(const char *fmt, ...) {
+  char line[200];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  hal::consoleWrite(line);
+}
+
+// Payload byte at position pos of the whole appended stream.
+static uint8_t pattern(size_t pos) {
+  return (uint8_t)(pos ^ (pos >> 8) ^ (pos >> 16));
+}
+
+// Same chain as rotateLogs() in logger.cpp.
+static void rotate(hal::FileSystem &fs) {
+  char src[16], dst[16];
+  for (int i = LOG_ROTATE_COUNT; i >= 1; --i) {
+    if (i == 1) snprintf(src, sizeof(src), "/log.bin");
+    else snprintf(src, sizeof(src), "/log.%d.bin", i - 1);
+    snprintf(dst, sizeof(dst), "/log.%d.bin", i);
+    if (fs.exists(dst)) fs.remove(dst);
+    if (fs.exists(src)) fs.rename(src, dst);
+  }
+}
+
+static bool fillBallast(hal::FileSystem &fs) {
+  static uint8_t chunk[4096];
+  memset(chunk, 0x5A, sizeof(chunk));
+  hal::File f = fs.open("/ballast.bin", FILE_WRITE);
+  for (size_t n = 0; f && n < BENCH_BALLAST_BYTES; n += sizeof(chunk)) {
+    if (f.write(chunk, sizeof(chunk)) != sizeof(chunk)) return false;
+  }
+  return (bool)f;
+}
+
+// /log.bin must hold stream bytes start..start+len.
+static bool verify(hal::FileSystem &fs, size_t start, size_t len) {
+  hal::File f = fs.open("/log.bin", FILE_READ);
+  if (!f || f.size() != len) return false;
+  uint8_t buf[256];
+  for (size_t pos = 0; pos < len;) {
+    size_t n = f.read(buf, sizeof(buf));
+    if (n == 0) return false;
+    for (size_t i = 0; i < n; ++i) {
+      if (buf[i] != pattern(start + pos + i)) return false;
+    }
+    pos += n;
+  }
+  return true;
+}
+
+static bool runPass(hal::StorageBackend backend, BenchPass pass, BenchResult &r) {
+  if (!hal::mountFilesystem(backend, true)) return false;
+  hal::FileSystem &fs = hal::filesystem();
+  if (pass == PASS_BALLAST && !fillBallast(fs)) return false;
+  size_t payload = pass == PASS_SMALL ? BENCH_SMALL_PAYLOAD_BYTES : BENCH_PAYLOAD_BYTES;
+  size_t batchMin = pass == PASS_SMALL ? BENCH_SMALL_MIN : BENCH_BATCH_MIN;
+  size_t batchMax = pass == PASS_SMALL ? BENCH_SMALL_MAX : BENCH_BATCH_MAX;
+
+  static uint8_t batch[BENCH_BATCH_MAX];
+  hal::FlashStats before = hal::flashStats();
+  uint32_t rng = 1;
+  size_t pos = 0;
+  size_t fileStart = 0; // stream position of the first byte in /log.bin
+  while (pos < payload) {
+    rng = rng * 1103515245u + 12345u;
+    size_t len = batchMin + (rng >> 16) % (batchMax - batchMin + 1);
+    for (size_t i = 0; i < len; ++i) batch[i] = pattern(pos + i);
+    uint64_t start = hal::micros();
+    hal::File f = fs.open("/log.bin", FILE_APPEND);
+    size_t written = f.write(batch, len);
+    size_t size = f.size();
+    f.close();
+    r.append.record((uint32_t)(hal::micros() - start));
+    if (written != len) return false;
+    pos += len;
+    if (size >= MAX_LOG_SIZE) {
+      start = hal::micros();
+      rotate(fs);
+      r.rotate.record((uint32_t)(hal::micros() - start));
+      fileStart = pos;
+    }
+  }
+  hal::FlashStats after = hal::flashStats();
+  r.payload = pos;
+  r.flash = {after.programmedBytes - before.programmedBytes, after.erasedBytes - before.erasedBytes};
+
+  uint64_t start = hal::micros();
+  if (!hal::mountFilesystem(backend)) return false;
+  r.mountUs = (uint32_t)(hal::micros() - start);
+  r.verified = verify(hal::filesystem(), fileStart, pos - fileStart);
+  return true;
+}
+
+static void runBench() {
+  report("storage benchmark: %u KB per pass, batches %u..%u B, rotation at %u KB, ballast %u KB, "
+         "small %u KB in %u..%u B\n",
+         (unsigned)(BENCH_PAYLOAD_BYTES / 1024), (unsigned)BENCH_BATCH_MIN, (unsigned)BENCH_BATCH_MAX,
+         (unsigned)(MAX_LOG_SIZE / 1024), (unsigned)(BENCH_BALLAST_BYTES / 1024),
+         (unsigned)(BENCH_SMALL_PAYLOAD_BYTES / 1024), (unsigned)BENCH_SMALL_MIN, (unsigned)BENCH_SMALL_MAX);
+  for (hal::StorageBackend backend : {hal::STORAGE_SPIFFS, hal::STORAGE_LITTLEFS, hal::STORAGE_RING}) {
+    for (BenchPass p : {PASS_EMPTY, PASS_BALLAST, PASS_SMALL}) {
+      const char *name = hal::storageBackendName(backend);
+      const char *pass = p == PASS_SMALL ? "small" : p == PASS_BALLAST ? "ballast" : "empty";
+      BenchResult r = {};
+      if (!runPass(backend, p, r)) {
+        report("%-8s %-7s FAILED\n", name, pass);
+        continue;
+      }
+      report("%-8s %-7s append n=%u p50<=%u p99<=%u max=%u us, rotate n=%u p50<=%u max=%u us\n", name, pass,
+             (unsigned)r.append.count(), (unsigned)r.append.quantile(0.5f), (unsigned)r.append.quantile(0.99f),
+             (unsigned)r.append.max(), (unsigned)r.rotate.count(), (unsigned)r.rotate.quantile(0.5f),
+             (unsigned)r.rotate.max());
+      report("%-8s %-7s mount %u us, amp %.3f programmed / %.3f erased per byte, verify %s\n", name, pass,
+             (unsigned)r.mountUs, (double)r.flash.programmedBytes / r.payload,
+             (double)r.flash.erasedBytes / r.payload, r.verified ? "ok" : "FAILED");
+    }
+  }
+  // Leave the partition to the firmware's backend, empty
+  hal::mountFilesystem(hal::STORAGE_DEFAULT, true);
+  report("done\n");
+}
+
+#ifdef ARDUINO
+void setup() {
+  Serial.begin(115200);
+  delay(2000);
+  runBench();
+}
+
+void loop() { delay(1000); }
+#else
+int main() {
+  hal::native::setConsoleEcho(true);
+  runBench();
+  return 0;
+}
+#endif
@@ -0,0 +1,92 @@
+#include "debounce.h"
+
+void SwitchDebouncer::reset(uint32_t nowUs, bool closed) {
+  tickUs_ = nowUs;
+  integrator_ = closed ? config_.integratorMax : 0;
+  raw_ = stable_ = closed;
+  excursion_ = false;
+  stableUs_ = 0;
+}
+
+void SwitchDebouncer::resync(uint32_t nowUs, bool closed) {
+  tickUs_ = excursionUs_ = nowUs;
+  integrator_ = stable_ ? config_.integratorMax : 0;
+  raw_ = closed;
+  excursion_ = closed != stable_;
+}
+
+// Samples needed from the current integrator value to flip the output
+// towards the raw level (only meaningful while raw_ != stable_).
+uint32_t SwitchDebouncer::ticksToFlip() const {
+  if (raw_) return integrator_ >= config_.riseAt ? 1 : config_.riseAt - integrator_;
+  return integrator_ <= config_.fallAt ? 1 : integrator_ - config_.fallAt;
+}
+
+// pulseUs is how long the previous state lasted.
+void SwitchDebouncer::settle(bool closed, uint64_t pulseUs) {
+  stable_ = closed;
+  excursion_ = false;
+  stableUs_ = 0;
+  if (closed) {
+    stats_.pulses++;
+    return;
+  }
+  uint32_t width = (uint32_t)(pulseUs / 1000);
+  if (!stats_.minPulseMs || width < stats_.minPulseMs) stats_.minPulseMs = width;
+  if (width > stats_.maxPulseMs) stats_.maxPulseMs = width;
+}
+
+// The raw level held from tickUs_ to toUs; take the samples in between in
+// one step. The output can flip at most once while the raw level is constant.
+bool SwitchDebouncer::advance(uint32_t toUs, uint32_t &changedAtUs) {
+  uint32_t ticks = (toUs - tickUs_) / config_.sampleUs;
+  if (!ticks) return false;
+  bool changed = false;
+  uint64_t elapsedUs = (uint64_t)ticks * config_.sampleUs;
+  if (raw_ != stable_) {
+    uint32_t need = ticksToFlip();
+    if (ticks >= need) {
+      changedAtUs = tickUs_ + need * config_.sampleUs;
+      settle(raw_, stableUs_ + (uint64_t)need * config_.sampleUs);
+      elapsedUs -= (uint64_t)need * config_.sampleUs;
+      changed = true;
+    }
+  } else if (excursion_ && toUs - returnUs_ >= config_.integratorMax * config_.sampleUs) {
+    // Back at the stable level for a full integration window: the
+    // excursion and its bounce were one glitch
+    uint32_t width = returnUs_ - excursionUs_;
+    stats_.glitches++;
+    if (width > stats_.maxGlitchUs) stats_.maxGlitchUs = width;
+    excursion_ = false;
+  }
+  stableUs_ += elapsedUs;
+  uint32_t step = ticks > config_.integratorMax ? config_.integratorMax : ticks;
+  if (raw_) integrator_ = integrator_ + step > config_.integratorMax ? config_.integratorMax : integrator_ + step;
+  else integrator_ = integrator_ > step ? integrator_ - step : 0;
+  tickUs_ += ticks * config_.sampleUs;
+  return changed;
+}
+
+bool SwitchDebouncer::edge(uint32_t us, bool closed, uint32_t &changedAtUs) {
+  bool changed = advance(us, changedAtUs);
+  if (closed == raw_) return changed; // coalesced interrupt, no change
+  if (closed != stable_) {
+    if (!excursion_) excursionUs_ = us;
+    excursion_ = true;
+  } else {
+    returnUs_ = us;
+  }
+  raw_ = closed;
+  return changed;
+}
+
+bool SwitchDebouncer::poll(uint32_t nowUs, uint32_t &changedAtUs) {
+  return advance(nowUs, changedAtUs);
+}
+
+uint32_t SwitchDebouncer::usUntilSettled(uint32_t nowUs) const {
+  if (raw_ == stable_) return 0;
+  uint32_t dueUs = tickUs_ + ticksToFlip() * config_.sampleUs;
+  int32_t left = (int32_t)(dueUs - nowUs);
+  return left > 0 ? left : 0;
+}
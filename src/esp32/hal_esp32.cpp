@@ -0,0 +1,427 @@
+// hal.h on the ESP32: thin wrappers around the Arduino core, SPIFFS,
+// LittleFS, Preferences and FreeRTOS.
+
+#include "hal.h"
+#include "ring_fs.h"
+
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <SPIFFS.h>
+#include <driver/gpio.h>
+#include <esp_heap_caps.h>
+#include <esp_partition.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <hal/gpio_ll.h>
+#include <sys/time.h>
+
+#include <atomic>
+
+// The linker routes every malloc/calloc/realloc call to these
+// (-Wl,--wrap in platformio.ini), see heapAllocations().
+static std::atomic<uint32_t> heapAllocationCount{0};
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+  heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __real_calloc(n, size);
+}
+
+// Growing a String reallocates; a shrink or free (size 0) is not counted
+void *__wrap_realloc(void *ptr, size_t size) {
+  if (size) heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __real_realloc(ptr, size);
+}
+}
+
+// Same for programs and erases of the storage partition, whichever backend
+// (or the ESP-IDF SPIFFS/LittleFS code under it) issues them; see flashStats().
+static std::atomic<uint32_t> flashProgrammed{0};
+static std::atomic<uint32_t> flashErased{0};
+
+static bool isStoragePartition(const esp_partition_t *p) {
+  return p && p->type == ESP_PARTITION_TYPE_DATA && p->subtype == ESP_PARTITION_SUBTYPE_DATA_SPIFFS;
+}
+
+extern "C" {
+esp_err_t __real_esp_partition_write(const esp_partition_t *p, size_t offset, const void *src, size_t size);
+esp_err_t __real_esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t size);
+
+esp_err_t __wrap_esp_partition_write(const esp_partition_t *p, size_t offset, const void *src, size_t size) {
+  if (isStoragePartition(p)) flashProgrammed.fetch_add(size, std::memory_order_relaxed);
+  return __real_esp_partition_write(p, offset, src, size);
+}
+
+esp_err_t __wrap_esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t size) {
+  if (isStoragePartition(p)) flashErased.fetch_add(size, std::memory_order_relaxed);
+  return __real_esp_partition_erase_range(p, offset, size);
+}
+}
+
+namespace hal {
+
+uint32_t millis() { return ::millis(); }
+uint64_t micros() { return (uint64_t)esp_timer_get_time(); }
+time_t epochNow() { return time(nullptr); }
+uint64_t epochMs() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+void setEpochMs(uint64_t epochMs) {
+  struct timeval tv = {(time_t)(epochMs / 1000), (suseconds_t)(epochMs % 1000 * 1000)};
+  settimeofday(&tv, nullptr);
+}
+
+// Left alone by the startup code, so it keeps its content across resets
+static RTC_NOINIT_ATTR uint8_t retained[RETAINED_BYTES];
+
+size_t retainedGet(void *buf, size_t len) {
+  if (len > RETAINED_BYTES) len = RETAINED_BYTES;
+  memcpy(buf, retained, len);
+  return len;
+}
+
+void retainedPut(const void *buf, size_t len) {
+  if (len > RETAINED_BYTES) len = RETAINED_BYTES;
+  memcpy(retained, buf, len);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) { ::pinMode(pin, mode); }
+int digitalRead(uint8_t pin) { return ::digitalRead(pin); }
+void digitalWrite(uint8_t pin, int level) { ::digitalWrite(pin, level); }
+
+// One slot per captureEdges() pin; the slot index is the interrupt's arg
+struct EdgeSlot {
+  uint8_t pin;
+  uint8_t tag;
+  EdgeSink sink;
+  volatile bool wakeArmed;
+};
+static EdgeSlot edgeSlots[MAX_EDGE_PINS];
+static uint8_t edgeSlotCount = 0;
+
+// For light-sleep wake each edge pin is switched to a level interrupt on the
+// level it does not have (armPinWake); the first interrupt on it after that
+// switches it back to edges.
+static bool idleSleepEnabled = false;
+static portMUX_TYPE pinWakeMux = portMUX_INITIALIZER_UNLOCKED;
+
+// esp_timer_get_time(), digitalRead() and the gpio_ll inlines are all safe to
+// call from an IRAM ISR.
+static void HAL_ISR_ATTR edgeIsr(void *arg) {
+  uint32_t us = (uint32_t)esp_timer_get_time();
+  EdgeSlot &slot = edgeSlots[(uintptr_t)arg];
+  if (slot.wakeArmed) {
+    gpio_ll_wakeup_disable(&GPIO, (gpio_num_t)slot.pin);
+    gpio_ll_set_intr_type(&GPIO, (gpio_num_t)slot.pin, GPIO_INTR_ANYEDGE);
+    slot.wakeArmed = false;
+  }
+  slot.sink(slot.tag, us, ::digitalRead(slot.pin));
+}
+
+// Runs on the core the edge interrupts are attached to, so the critical
+// section keeps edgeIsr() out until the pins are fully armed. If a level
+// changed since it was read, the interrupt fires right after and disarms
+// that pin again.
+static void armPinWake() {
+  portENTER_CRITICAL(&pinWakeMux);
+  for (uint8_t i = 0; i < edgeSlotCount; ++i) {
+    EdgeSlot &slot = edgeSlots[i];
+    int level = ::digitalRead(slot.pin);
+    gpio_ll_wakeup_enable(&GPIO, (gpio_num_t)slot.pin, level ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    slot.wakeArmed = true;
+  }
+  portEXIT_CRITICAL(&pinWakeMux);
+}
+
+void captureEdges(uint8_t pin, EdgeSink sink, uint8_t tag) {
+  if (edgeSlotCount == MAX_EDGE_PINS) return;
+  uintptr_t i = edgeSlotCount++;
+  edgeSlots[i].pin = pin;
+  edgeSlots[i].tag = tag;
+  edgeSlots[i].sink = sink;
+  edgeSlots[i].wakeArmed = false;
+  attachInterruptArg(digitalPinToInterrupt(pin), edgeIsr, (void *)i, CHANGE);
+}
+
+void consoleWrite(const char *text) { Serial.print(text); }
+
+uint32_t nvsGetUInt(const char *ns, const char *key, uint32_t def) {
+  Preferences prefs;
+  prefs.begin(ns, true);
+  uint32_t v = prefs.getUInt(key, def);
+  prefs.end();
+  return v;
+}
+
+void nvsPutUInt(const char *ns, const char *key, uint32_t value) {
+  Preferences prefs;
+  prefs.begin(ns, false);
+  prefs.putUInt(key, value);
+  prefs.end();
+}
+
+size_t nvsGetBlob(const char *ns, const char *key, void *buf, size_t len) {
+  Preferences prefs;
+  if (!prefs.begin(ns, true)) return 0;
+  size_t stored = prefs.getBytesLength(key);
+  if (stored > 0 && stored <= len) prefs.getBytes(key, buf, stored);
+  prefs.end();
+  return stored;
+}
+
+bool nvsPutBlob(const char *ns, const char *key, const void *buf, size_t len) {
+  Preferences prefs;
+  if (!prefs.begin(ns, false)) return false;
+  bool ok = prefs.putBytes(key, buf, len) == len;
+  prefs.end();
+  return ok;
+}
+
+void nvsClear(const char *ns) {
+  Preferences prefs;
+  if (!prefs.begin(ns, false)) return;
+  prefs.clear();
+  prefs.end();
+}
+
+HeapStats heapStats() {
+  return {(uint32_t)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+          (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+          (uint32_t)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT)};
+}
+
+uint32_t heapAllocations() { return heapAllocationCount.load(std::memory_order_relaxed); }
+
+void SpinLock::lock() { portENTER_CRITICAL(&mux_); }
+void SpinLock::unlock() { portEXIT_CRITICAL(&mux_); }
+
+// Static Mutex objects are constructed before setup(); the heap is ready by then.
+Mutex::Mutex() : sem_(xSemaphoreCreateMutex()) {}
+void Mutex::lock() { xSemaphoreTake(sem_, portMAX_DELAY); }
+void Mutex::unlock() { xSemaphoreGive(sem_); }
+
+struct PeriodicTask {
+  PeriodicFn fn;
+  volatile uint32_t periodMs;
+  TaskHandle_t handle;
+};
+static PeriodicTask periodicTasks[MAX_PERIODIC];
+static int periodicCount = 0;
+
+static void periodicTaskMain(void *arg) {
+  PeriodicTask *t = (PeriodicTask *)arg;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(t->periodMs));
+    t->fn();
+  }
+}
+
+int startPeriodic(const char *name, PeriodicFn fn, uint32_t periodMs, uint32_t stackBytes) {
+  if (periodicCount >= MAX_PERIODIC) {
+    Serial.printf("startPeriodic(%s): all %d slots taken\n", name, MAX_PERIODIC);
+    return -1;
+  }
+  PeriodicTask &t = periodicTasks[periodicCount];
+  t.fn = fn;
+  t.periodMs = periodMs;
+  if (xTaskCreatePinnedToCore(periodicTaskMain, name, stackBytes, &t, 1, &t.handle, 0) != pdPASS) {
+    Serial.printf("startPeriodic(%s): task not created (%u bytes of stack)\n", name, (unsigned)stackBytes);
+    return -1;
+  }
+  return periodicCount++;
+}
+
+void wakePeriodic(int handle) {
+  if (handle >= 0 && handle < periodicCount) xTaskNotifyGive(periodicTasks[handle].handle);
+}
+
+void setPeriod(int handle, uint32_t periodMs) {
+  if (handle >= 0 && handle < periodicCount) periodicTasks[handle].periodMs = periodMs;
+}
+
+const BaseType_t CONTROL_CORE = 1;
+const UBaseType_t CONTROL_PRIORITY = 10; // above loopTask/async work, below the WiFi stack
+static TaskHandle_t controlTask = nullptr;
+static volatile bool wakeEdgePending = false;
+static volatile uint32_t wakeEdgeUs = 0;
+static ControlStats stats = {};
+static portMUX_TYPE statsMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void controlTaskMain(void *arg) {
+  ControlFn fn = (ControlFn)arg;
+  ControlWake wake = {WAKE_REQUEST, 0, 0, 0};
+  for (;;) {
+    uint64_t passStart = esp_timer_get_time();
+    uint32_t sleepMs = fn(wake);
+    uint32_t passUs = (uint32_t)(esp_timer_get_time() - passStart);
+    portENTER_CRITICAL(&statsMux);
+    stats.passes++;
+    stats.totalPassUs += passUs;
+    if (passUs > stats.maxPassUs) stats.maxPassUs = passUs;
+    if (wake.latencyUs > stats.maxLatencyUs) stats.maxLatencyUs = wake.latencyUs;
+    portEXIT_CRITICAL(&statsMux);
+    if (idleSleepEnabled) armPinWake();
+    uint64_t start = esp_timer_get_time();
+    uint32_t notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleepMs));
+    uint64_t now = esp_timer_get_time();
+    wake.sleptMs = (uint32_t)((now - start) / 1000);
+    wake.sleepCause = idleSleepEnabled ? (uint8_t)esp_sleep_get_wakeup_cause() : 0;
+    if (wakeEdgePending) {
+      wakeEdgePending = false;
+      wake.reason = WAKE_SWITCH;
+      wake.latencyUs = (uint32_t)now - wakeEdgeUs;
+    } else if (notified) {
+      wake.reason = WAKE_REQUEST;
+      wake.latencyUs = 0;
+    } else {
+      uint64_t due = start + (uint64_t)sleepMs * 1000;
+      wake.reason = WAKE_DEADLINE;
+      wake.latencyUs = now > due ? (uint32_t)(now - due) : 0;
+    }
+  }
+}
+
+void startControlTask(ControlFn fn) {
+  if (controlTask) return;
+  xTaskCreatePinnedToCore(controlTaskMain, "control", 4096, (void *)fn, CONTROL_PRIORITY, &controlTask, CONTROL_CORE);
+}
+
+ControlStats controlStats(bool reset) {
+  portENTER_CRITICAL(&statsMux);
+  ControlStats copy = stats;
+  if (reset) stats = {};
+  portEXIT_CRITICAL(&statsMux);
+  return copy;
+}
+
+void wakeControl() {
+  if (controlTask) xTaskNotifyGive(controlTask);
+}
+
+void HAL_ISR_ATTR wakeControlFromIsr() {
+  if (!controlTask) return;
+  if (!wakeEdgePending) {
+    wakeEdgeUs = (uint32_t)esp_timer_get_time();
+    wakeEdgePending = true;
+  }
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(controlTask, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+void enableIdleSleep() {
+  if (edgeSlotCount == 0) return;
+#if CONFIG_PM_ENABLE
+  // Scale down to 80 MHz when idle; sleep when the tickless idle hook may
+  esp_pm_config_esp32_t pm = {};
+  pm.max_freq_mhz = 240;
+  pm.min_freq_mhz = 80;
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+  pm.light_sleep_enable = true;
+#endif
+  if (esp_pm_configure(&pm) != ESP_OK) return;
+#endif
+  esp_sleep_enable_gpio_wakeup();
+  idleSleepEnabled = true;
+}
+
+// --- Filesystem ---
+
+// fs::FS backends (SPIFFS, LittleFS) behind hal::FileSystem.
+class ArduinoFile : public FileImpl {
+ public:
+  explicit ArduinoFile(fs::File f) : f_(f) {}
+  size_t read(uint8_t *buf, size_t len) override { return f_.read(buf, len); }
+  size_t write(const uint8_t *buf, size_t len) override { return f_.write(buf, len); }
+  size_t size() override { return f_.size(); }
+  bool seek(size_t pos) override { return f_.seek(pos); }
+
+ private:
+  fs::File f_;
+};
+
+class ArduinoFs : public FileSystem {
+ public:
+  explicit ArduinoFs(fs::FS &fs) : fs_(fs) {}
+
+  File open(const char *path, const char *mode) override {
+    fs::File f = fs_.open(path, mode);
+    if (!f) return File();
+    return File(std::make_shared<ArduinoFile>(f));
+  }
+
+  bool exists(const char *path) override { return fs_.exists(path); }
+  bool remove(const char *path) override { return fs_.remove(path); }
+  bool rename(const char *from, const char *to) override { return fs_.rename(from, to); }
+
+ private:
+  fs::FS &fs_;
+};
+
+// The "spiffs" data partition, raw, for the ring backend.
+class EspFlash : public FlashPartition {
+ public:
+  bool begin() {
+    if (!part_) part_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, nullptr);
+    return part_ != nullptr;
+  }
+
+  size_t size() const override { return part_ ? part_->size : 0; }
+
+  bool read(size_t offset, void *buf, size_t len) override {
+    return part_ && esp_partition_read(part_, offset, buf, len) == ESP_OK;
+  }
+
+  bool write(size_t offset, const void *buf, size_t len) override {
+    return part_ && esp_partition_write(part_, offset, buf, len) == ESP_OK;
+  }
+
+  bool erase(size_t offset, size_t len) override {
+    return part_ && esp_partition_erase_range(part_, offset, len) == ESP_OK;
+  }
+
+ private:
+  const esp_partition_t *part_ = nullptr;
+};
+
+static ArduinoFs spiffsFs(SPIFFS);
+static ArduinoFs littleFs(LittleFS);
+static EspFlash storageFlash;
+static RingFs ringFs(storageFlash);
+static FileSystem *mountedFs = &spiffsFs;
+
+bool mountFilesystem(StorageBackend backend, bool format) {
+  if (mountedFs == &spiffsFs) SPIFFS.end();
+  if (mountedFs == &littleFs) LittleFS.end();
+  switch (backend) {
+    case STORAGE_LITTLEFS:
+      mountedFs = &littleFs;
+      return LittleFS.begin(true) && (!format || LittleFS.format());
+    case STORAGE_RING:
+      mountedFs = &ringFs;
+      return storageFlash.begin() && (format ? ringFs.format() : ringFs.mount());
+    default:
+      mountedFs = &spiffsFs;
+      return SPIFFS.begin(true) && (!format || SPIFFS.format());
+  }
+}
+
+FileSystem &filesystem() { return *mountedFs; }
+
+FlashStats flashStats() {
+  return {flashProgrammed.load(std::memory_order_relaxed), flashErased.load(std::memory_order_relaxed)};
+}
+
+}  // namespace hal
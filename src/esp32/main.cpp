@@ -0,0 +1,1177 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <time.h>
+#include <ESPAsyncWebServer.h>
+#include <Preferences.h>
+#include <ESPmDNS.h>
+#include <esp_sntp.h>
+#include <esp_system.h>
+#include <stdarg.h>
+
+#include "event_stream.h"
+#include "feeder.h"
+#include "form.h"
+#include "json.h"
+#include "hal.h"
+#include "logger.h"
+#include "metrics.h"
+#include "trace.h"
+#include "wall_clock.h"
+#include "web_assets.h"
+
+#include <memory>
+
+// "?since=" value: epoch seconds or local time "YYYY-MM-DD[ HH:MM[:SS]]"
+// (a 'T' instead of the space works too). 0 if unparseable.
+static uint32_t parseSince(const String &value) {
+  const char *v = value.c_str();
+  if (*v && strspn(v, "0123456789") == strlen(v)) return strtoul(v, nullptr, 10);
+  struct tm tm = {};
+  int n = sscanf(v, "%d-%d-%d%*c%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+  if (n < 3) return 0;
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_isdst = -1;
+  time_t t = mktime(&tm);
+  return t > 0 ? (uint32_t)t : 0;
+}
+
+// Single "bytes=a-b", "bytes=a-" or "bytes=-n" range against a text of
+// `size` bytes. False if the header is not one satisfiable range.
+static bool parseRange(const String &header, uint32_t size, uint32_t &start, uint32_t &len) {
+  const char *v = header.c_str();
+  if (strncmp(v, "bytes=", 6) != 0 || strchr(v, ',')) return false;
+  v += 6;
+  char *end;
+  if (*v == '-') {
+    uint32_t suffix = strtoul(v + 1, &end, 10);
+    if (end == v + 1 || suffix == 0) return false;
+    start = suffix < size ? size - suffix : 0;
+    len = size - start;
+    return size > 0;
+  }
+  start = strtoul(v, &end, 10);
+  if (end == v || *end != '-' || start >= size) return false;
+  const char *last = end + 1;
+  uint32_t stop = *last ? strtoul(last, &end, 10) : size - 1;
+  if (*last && end == last) return false;
+  if (stop >= size) stop = size - 1;
+  if (stop < start) return false;
+  len = stop - start + 1;
+  return true;
+}
+
+// Serve log at /log: all rotated files (oldest first) plus the records still
+// buffered in RAM, rendered to text while streaming. The async server asks
+// for the next chunk only when the TCP send buffer has room, so a slow client
+// just slows the download; the log file lock is held for one chunk at a time.
+//
+// Filters, found through the log index without reading whole files:
+//   /log?tail=50             last 50 records
+//   /log?level=WARN          WARN and ERROR only
+//   /log?since=2026-03-29 07:00  (or epoch seconds)
+// They combine, e.g. ?level=WARN&tail=20. Without filters, a Range header
+// fetches part of the full text (206); a range of a filtered view is not
+// supported and is answered with the whole view.
+//
+// A rotation drops the oldest file and shifts the whole text, so the full
+// text carries an ETag of the boot and the rotation count (flushes only
+// append). A resume sends it in If-Range and gets the whole text again
+// (200) if the log rotated or the device restarted since. A rotation
+// between sizing the text and seeking to the range is answered with 412;
+// just retry.
+static void logEtag(uint32_t rotations, char *etag, size_t len) {
+  static const uint32_t bootId = esp_random();
+  snprintf(etag, len, "\"%08x-%u\"", (unsigned)bootId, (unsigned)rotations);
+}
+
+void handleLogDownload(AsyncWebServerRequest *request) {
+  if (!logAvailable()) {
+    request->send(404, "text/plain", "Log not found");
+    return;
+  }
+  LogQuery query;
+  if (request->hasParam("tail")) {
+    long tail = request->getParam("tail")->value().toInt();
+    query.tail = tail > 0 ? tail : 0;
+  }
+  if (request->hasParam("since")) {
+    query.since = parseSince(request->getParam("since")->value());
+    if (query.since == 0) {
+      request->send(400, "text/plain", "since: expected epoch seconds or YYYY-MM-DD HH:MM[:SS]");
+      return;
+    }
+  }
+  if (request->hasParam("level") && !logLevelFromName(request->getParam("level")->value().c_str(), query.minLevel)) {
+    request->send(400, "text/plain", "level: expected DEBUG, INFO, WARN or ERROR");
+    return;
+  }
+  bool filtered = request->hasParam("tail") || request->hasParam("since") || request->hasParam("level");
+
+  char etag[24];
+  if (!filtered && request->hasHeader("Range")) {
+    uint32_t rotations;
+    uint32_t size = logTextSize(rotations);
+    logEtag(rotations, etag, sizeof(etag));
+    bool current = !request->hasHeader("If-Range") || request->getHeader("If-Range")->value() == etag;
+    if (current) {
+      if (!parseRange(request->getHeader("Range")->value(), size, query.rangeStart, query.rangeLen)) {
+        AsyncWebServerResponse *response = request->beginResponse(416);
+        response->addHeader("Content-Range", "bytes */" + String(size));
+        request->send(response);
+        return;
+      }
+      query.rotations = rotations;
+      auto reader = std::make_shared<LogReader>(query);
+      if (!reader->start()) {
+        request->send(412, "text/plain", "Log rotated, retry");
+        return;
+      }
+      AsyncWebServerResponse *response = request->beginResponse(
+          "text/plain", query.rangeLen, [reader](uint8_t *buf, size_t maxLen, size_t) -> size_t {
+            return reader->read((char *)buf, maxLen);
+          });
+      response->setCode(206);
+      char contentRange[48];
+      snprintf(contentRange, sizeof(contentRange), "bytes %u-%u/%u", (unsigned)query.rangeStart,
+               (unsigned)(query.rangeStart + query.rangeLen - 1), (unsigned)size);
+      response->addHeader("Content-Range", contentRange);
+      response->addHeader("ETag", etag);
+      request->send(response);
+      return;
+    }
+    // If-Range from before a rotation or restart: the whole text below
+  }
+
+  auto reader = std::make_shared<LogReader>(query);
+  // The ETag has to match the text this response starts from
+  if (!filtered) reader->start();
+  AsyncWebServerResponse *response = request->beginChunkedResponse(
+      "text/plain", [reader](uint8_t *buf, size_t maxLen, size_t) -> size_t {
+        return reader->read((char *)buf, maxLen);
+      });
+  if (!filtered) {
+    logEtag(reader->startRotations(), etag, sizeof(etag));
+    response->addHeader("Accept-Ranges", "bytes");
+    response->addHeader("ETag", etag);
+  }
+  request->send(response);
+}
+
+// Field trace for replay in the simulator (trace.h): /trace.1.bin followed by
+// /trace.bin as one binary download. Records reach flash within
+// TRACE_FLUSH_MAX_AGE_MS.
+//   curl -o trace.bin http://katzefroh.local/trace
+//   .pio/build/native/program --replay trace.bin
+void handleTrace(AsyncWebServerRequest *request) {
+  if (!ENABLE_TRACE) {
+    request->send(404, "text/plain", "Tracing disabled (ENABLE_TRACE)");
+    return;
+  }
+  struct Cursor { bool old = true; uint32_t offset = 0; };
+  auto cursor = std::make_shared<Cursor>();
+  AsyncWebServerResponse *response = request->beginChunkedResponse(
+      "application/octet-stream", [cursor](uint8_t *buf, size_t maxLen, size_t) -> size_t {
+        size_t n = traceRead(cursor->old, cursor->offset, buf, maxLen);
+        if (n == 0 && cursor->old) {
+          cursor->old = false;
+          cursor->offset = 0;
+          n = traceRead(false, 0, buf, maxLen);
+        }
+        cursor->offset += n;
+        return n;
+      });
+  response->addHeader("Content-Disposition", "attachment; filename=\"trace.bin\"");
+  response->addHeader("Cache-Control", "no-store");
+  request->send(response);
+}
+
+// Live events as Server-Sent Events (event_stream.h):
+//   event: relay     data: {"t":1774850400,"on":true}
+//   event: step      data: {"t":...,"count":2,"run":true}
+//   event: schedule  data: {"t":...,"hour":7,"minute":30}
+//   event: run       data: {"t":...,"state":"started|complete|timeout|jammed"}
+//   event: wifi      data: {"t":...,"state":"connected","ip":"192.168.1.20"}
+// The filler runs whenever the connection can take data; with nothing new it
+// tells the server to ask again later. A client that fell behind the shared
+// ring gets the end of the response, and its EventSource reconnects.
+//   curl -N http://katzefroh.local/events
+void handleEvents(AsyncWebServerRequest *request) {
+  uint32_t lastId = 0;
+  bool resume = request->hasHeader("Last-Event-ID");
+  if (resume) lastId = strtoul(request->getHeader("Last-Event-ID")->value().c_str(), nullptr, 10);
+  int sub = eventStreamSubscribe(resume ? &lastId : nullptr, millis());
+  if (sub < 0) {
+    request->send(503, "text/plain", "Too many /events subscribers");
+    return;
+  }
+  AsyncWebServerResponse *response = request->beginChunkedResponse(
+      "text/event-stream", [sub](uint8_t *buf, size_t maxLen, size_t) -> size_t {
+        int n = eventStreamRead(sub, (char *)buf, maxLen, millis());
+        if (n == EVENT_STREAM_DROPPED) return 0; // ends the response
+        return n > 0 ? (size_t)n : RESPONSE_TRY_AGAIN;
+      });
+  response->addHeader("Cache-Control", "no-store");
+  request->onDisconnect([sub]() { eventStreamUnsubscribe(sub); });
+  request->send(response);
+}
+
+// Runtime log level: GET /loglevel shows it, POST /loglevel?level=DEBUG
+// sets it (kept in NVS). Levels below LOG_COMPILE_LEVEL are not built in.
+// {"level":"INFO","compiled":"DEBUG"}
+void handleLogLevel(AsyncWebServerRequest *request) {
+  if (request->method() == HTTP_POST) {
+    LogLevel level;
+    AsyncWebParameter *p = request->getParam("level");
+    if (!p || !logLevelFromName(p->value().c_str(), level)) {
+      request->send(400, "text/plain", "level must be DEBUG, INFO, WARN or ERROR");
+      return;
+    }
+    logSetLevel(level);
+  }
+  char json[48];
+  snprintf(json, sizeof(json), "{\"level\":\"%s\",\"compiled\":\"%s\"}", logLevelName(logLevel()),
+           logLevelName((LogLevel)LOG_COMPILE_LEVEL));
+  AsyncWebServerResponse *response = request->beginResponse(200, "application/json", json);
+  response->addHeader("Cache-Control", "no-store");
+  request->send(response);
+}
+
+// Prometheus scrape target: stage timing histograms, flash writes, WiFi
+// reconnects and heap, see metrics.h.
+void handleMetrics(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+  metricsRender([response](const char *data, size_t len) { response->write((const uint8_t *)data, len); });
+  request->send(response);
+}
+
+// Times a request handler into HIST_HTTP and counts its heap allocations
+// into HIST_HTTP_ALLOCS
+static ArRequestHandlerFunction timed(ArRequestHandlerFunction handler) {
+  return [handler](AsyncWebServerRequest *request) {
+    uint32_t allocs = hal::heapAllocations();
+    {
+      MetricTimer t(HIST_HTTP);
+      handler(request);
+    }
+    metricsRecord(HIST_HTTP_ALLOCS, hal::heapAllocations() - allocs);
+  };
+}
+
+// ?ch=N of the per-channel pages (from 0; channel 0 without it). False if
+// it names no channel of this board.
+static bool channelParam(AsyncWebServerRequest *request, uint8_t &channel) {
+  uint32_t ch = 0;
+  AsyncWebParameter *p = request->getParam("ch");
+  if (p && !formUInt({p->value().c_str(), p->value().length()}, 0, FEEDER_CHANNELS - 1, ch)) return false;
+  channel = (uint8_t)ch;
+  return true;
+}
+
+// Log records about a channel name it where there is more than one
+static int8_t logChannel(uint8_t channel) {
+  return FEEDER_CHANNELS > 1 ? (int8_t)channel : LOG_NO_CHANNEL;
+}
+
+// Control task timing at /stats, to check that web traffic (e.g. a large
+// /log download) doesn't hold up feeding. ?reset starts a new measurement.
+// {"passes":1234,"maxPassUs":310,"avgPassUs":42,"maxLatencyUs":95,
+//  "switch":{"pulses":126,"glitches":1,"maxGlitchUs":3000,"minPulseMs":300,"maxPulseMs":5812}}
+// The switch part is the debouncer's of channel ?ch since boot; ?reset
+// leaves it alone.
+void handleStats(AsyncWebServerRequest *request) {
+  uint8_t ch;
+  if (!channelParam(request, ch)) {
+    request->send(400, "text/plain", "Unknown channel");
+    return;
+  }
+  hal::ControlStats st = hal::controlStats(request->hasParam("reset"));
+  DebounceStats sw = feederSwitchStats(ch);
+  char json[320];
+  snprintf(json, sizeof(json),
+           "{\"passes\":%u,\"maxPassUs\":%u,\"avgPassUs\":%u,\"maxLatencyUs\":%u,"
+           "\"switch\":{\"pulses\":%u,\"glitches\":%u,\"maxGlitchUs\":%u,\"minPulseMs\":%u,\"maxPulseMs\":%u}}",
+           (unsigned)st.passes, (unsigned)st.maxPassUs,
+           (unsigned)(st.passes ? st.totalPassUs / st.passes : 0), (unsigned)st.maxLatencyUs,
+           (unsigned)sw.pulses, (unsigned)sw.glitches, (unsigned)sw.maxGlitchUs, (unsigned)sw.minPulseMs,
+           (unsigned)sw.maxPulseMs);
+  AsyncWebServerResponse *response = request->beginResponse(200, "application/json", json);
+  response->addHeader("Cache-Control", "no-store");
+  request->send(response);
+}
+
+// Per-run step times and the jam model of each schedule entry of channel
+// ?ch, newest run first. A step creeping towards limitMs is a feeder that
+// needs cleaning.
+void handleRuns(AsyncWebServerRequest *request) {
+  static RunRecord runs[RUN_HISTORY]; // only the AsyncTCP task serves requests
+  static StepModel models[MAX_SCHEDULE_ENTRIES];
+  uint8_t ch;
+  if (!channelParam(request, ch)) {
+    request->send(400, "text/plain", "Unknown channel");
+    return;
+  }
+  uint8_t n = feederRunHistory(ch, runs, RUN_HISTORY);
+  uint8_t count = scheduleCount[ch];
+  feederStepModels(ch, models, count);
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  response->addHeader("Cache-Control", "no-store");
+  response->printf("{\"channel\":%u,\"runs\":[", ch);
+  for (uint8_t i = 0; i < n; ++i) {
+    const RunRecord &r = runs[i];
+    response->printf("%s{\"start\":%u,\"entry\":%d,\"outcome\":\"%s\",\"steps\":%u,\"wanted\":%u,\"ms\":%u,\"limitMs\":%u,\"stepMs\":[",
+                     i ? "," : "", (unsigned)r.startEpoch, r.entry, runOutcomeName(r.outcome), r.steps, r.stepsWanted,
+                     (unsigned)r.durationMs, (unsigned)r.limitMs);
+    for (uint8_t s = 0; s < r.steps && s < RUN_MAX_STEPS; ++s) response->printf("%s%u", s ? "," : "", r.stepMs[s]);
+    response->print("]}");
+  }
+  response->print("],\"models\":[");
+  for (uint8_t i = 0; i < count; ++i) {
+    const StepModel &m = models[i];
+    response->printf("%s{\"entry\":%u,\"samples\":%u,\"p50\":%u,\"p95\":%u,\"limitMs\":%u}", i ? "," : "", i,
+                     m.samples(), (unsigned)m.p50(), (unsigned)m.p95(), (unsigned)m.limitMs());
+  }
+  response->print("]}");
+  request->send(response);
+}
+
+// WiFi / NTP (fill these)
+const char* WIFI_SSID = "FRITZ6.3";
+const char* WIFI_PASS = "Cool2:home::";
+
+// Function prototypes (extended)
+void setupWifiEventHandler();
+void startConfigPortal();
+void serveAsset(AsyncWebServerRequest *request, const WebAsset &asset);
+void handleWifiSave(AsyncWebServerRequest *request);
+void handleConfigJson(AsyncWebServerRequest *request);
+void handleConfigSave(AsyncWebServerRequest *request);
+void handleApiStatus(AsyncWebServerRequest *request);
+void handleApiSchedule(AsyncWebServerRequest *request);
+void handleApiFeed(AsyncWebServerRequest *request);
+static void receiveFormBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+static void netStart();
+
+// Global web server instance for config portal. Requests are handled in the
+// AsyncTCP task (core 0, see platformio.ini), several clients at a time.
+AsyncWebServer server(80);
+static volatile bool configPortalRunning = false;
+static bool mdnsStarted = false;
+
+// Boot timing: every phase logs the time since reset and its own duration
+static uint32_t bootPhaseStartMs = 0;
+
+static void bootPhase(const char *name) {
+  uint32_t now = millis();
+  logEvent(LOG_INFO, EV_BOOT_PHASE, {(int32_t)now, (int32_t)(now - bootPhaseStartMs)}, name);
+  bootPhaseStartMs = now;
+}
+
+void setup() {
+  // Initialize relay pins as early as possible to avoid accidental activation during boot
+  for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+    pinMode(Board::relayPin(ch), OUTPUT);
+    // Ensure relay is inactive at boot (level from the board profile)
+    setRelayInactive(ch);
+  }
+  delay(20);
+  Serial.begin(115200);
+  // Local time for log timestamps; SNTP sets the same rule again once online
+  clockInit(TZ_RULE);
+  // Without WiFi the schedule runs from the last checkpoint until SNTP syncs
+  clockResume();
+  // Log reset reason early so we can spot brownouts/restarts
+  {
+    esp_reset_reason_t rr = esp_reset_reason();
+    // convert to human readable
+    const char* rrs = "";
+    switch (rr) {
+      case ESP_RST_UNKNOWN: rrs = "UNKNOWN"; break;
+      case ESP_RST_POWERON: rrs = "POWERON"; break;
+      case ESP_RST_EXT: rrs = "EXTERNAL_RESET"; break;
+      case ESP_RST_SW: rrs = "SOFTWARE_RESET"; break;
+      case ESP_RST_PANIC: rrs = "PANIC"; break;
+      case ESP_RST_INT_WDT: rrs = "INT_WDT"; break;
+      case ESP_RST_TASK_WDT: rrs = "TASK_WDT"; break;
+      case ESP_RST_WDT: rrs = "WDT"; break;
+      case ESP_RST_DEEPSLEEP: rrs = "DEEPSLEEP_RESET"; break;
+      case ESP_RST_BROWNOUT: rrs = "BROWNOUT"; break;
+      case ESP_RST_SDIO: rrs = "SDIO_RESET"; break;
+      default: rrs = "OTHER"; break;
+    }
+    logEvent(LOG_INFO, EV_RESET_REASON, {}, rrs);
+  }
+
+  if (RUN_SELF_TEST) {
+    // One channel after the other, so each motor can be told apart
+    for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+      logEvent(LOG_INFO, EV_SELF_TEST, {}, nullptr, logChannel(ch));
+      setRelayActive(ch);
+      delay(2000);
+      setRelayInactive(ch);
+      delay(2000);
+      setRelayActive(ch);
+      delay(2000);
+      setRelayInactive(ch);
+    }
+  }
+  setupPins();
+  // Load any saved schedule from Preferences before the control task copies it
+  loadScheduleFromPrefs();
+  // Motor/relay/switch state machine on core 1; everything below stays on core 0.
+  // From here on feeding works, whatever the filesystem or WiFi are doing.
+  hal::startControlTask(feederLoop);
+  bootPhase("control");
+
+  // Mount the log storage (STORAGE_BACKEND) so we can log to file
+  if (!hal::mountFilesystem()) {
+    logEvent(LOG_ERROR, EV_FS_MOUNT_FAILED, {}, hal::storageBackendName(hal::STORAGE_DEFAULT));
+  } else {
+    // Storage ready; start the batched flusher (earlier lines are still in the RAM ring)
+    logInit();
+    if (ENABLE_TRACE) traceStart();
+  }
+  bootPhase("filesystem");
+
+  if (ENABLE_IDLE_SLEEP) {
+    hal::enableIdleSleep();
+    // Modem sleep between DTIM beacons; incoming HTTP traffic wakes the chip
+    WiFi.setSleep(true);
+  }
+  // Writes control task events to the log as they arrive
+  feederStartService();
+  // Register WiFi event handler to log connect/disconnect
+  setupWifiEventHandler();
+  // Connect in the background (see netPoll)
+  netStart();
+  // Start the configuration portal (non-blocking) so it's always reachable
+  startConfigPortal();
+  bootPhase("setup");
+  logEvent(LOG_INFO, EV_STARTED);
+}
+
+void loop() {
+  // All work runs in the control, event, network and AsyncTCP tasks started from setup()
+  vTaskDelete(nullptr);
+}
+
+// --- Network bring-up ---
+// A state machine in its own task, so setup() never waits for WiFi or SNTP:
+// stored credentials, then compile-time credentials, then the setup AP.
+// Every poll only starts an attempt or checks on it.
+const uint32_t NET_POLL_MS = 100;               // while connecting / waiting for time
+const uint32_t NET_IDLE_POLL_MS = 60UL * 1000UL; // once there is nothing left to do
+const uint32_t WIFI_CONNECT_TIMEOUT_MS = 10000; // per set of credentials
+const uint32_t WIFI_SAVE_GRACE_MS = 2000;       // for the /wifi/save reply to reach the client
+
+enum NetState : uint8_t { NET_TRY_STORED, NET_TRY_COMPILED, NET_AP, NET_ONLINE };
+static NetState netState = NET_TRY_STORED;
+static uint32_t netStateSinceMs = 0;
+static bool timeSynced = false;
+static int netWorker = -1;
+static char storedSsid[33]; // NVS "wifi", see handleWifiSave()
+static char storedPass[65];
+static volatile bool wifiSaved = false; // new credentials from handleWifiSave()
+static volatile uint32_t wifiSavedAtMs = 0;
+
+// Dotted quad into buf (16 bytes), without IPAddress::toString()'s String
+static const char *ipText(const IPAddress &ip, char *buf) {
+  snprintf(buf, 16, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  return buf;
+}
+
+static bool haveCompiledCredentials() {
+  return strlen(WIFI_SSID) > 0 && strcmp(WIFI_SSID, "YOUR_SSID") != 0;
+}
+
+static void startMdns(LogEvent ok, LogEvent failed) {
+  if (mdnsStarted) return;
+  if (MDNS.begin("katzefroh")) {
+    logEvent(LOG_INFO, ok);
+    mdnsStarted = true;
+  } else {
+    logEvent(LOG_WARN, failed);
+  }
+}
+
+// Every SNTP sync (hourly), from the lwIP task
+static void onTimeSync(struct timeval *) {
+  clockNoteSync();
+}
+
+static void loadStoredCredentials() {
+  Preferences prefs;
+  prefs.begin("wifi", true);
+  if (!prefs.getString("ssid", storedSsid, sizeof(storedSsid))) storedSsid[0] = '\0';
+  if (!prefs.getString("pass", storedPass, sizeof(storedPass))) storedPass[0] = '\0';
+  prefs.end();
+}
+
+static void netEnter(NetState state) {
+  netState = state;
+  netStateSinceMs = millis();
+  switch (state) {
+    case NET_TRY_STORED:
+      logEvent(LOG_DEBUG, EV_WIFI_STORED, {}, storedSsid);
+      WiFi.begin(storedSsid, storedPass);
+      break;
+    case NET_TRY_COMPILED:
+      if (!haveCompiledCredentials()) {
+        netEnter(NET_AP);
+        return;
+      }
+      logEvent(LOG_DEBUG, EV_WIFI_COMPILED, {}, WIFI_SSID);
+      WiFi.disconnect();
+      WiFi.begin(WIFI_SSID, WIFI_PASS);
+      break;
+    case NET_AP: {
+      char ip[16];
+      // No usable credentials or connection failed: the portal stays
+      // reachable through the setup AP
+      logEvent(LOG_WARN, EV_WIFI_NONE);
+      const char* apName = "KatzeFroh-Setup";
+      logEvent(LOG_INFO, EV_AP_START, {}, apName);
+      WiFi.mode(WIFI_AP);
+      WiFi.softAP(apName);
+      logEvent(LOG_INFO, EV_AP_IP, {}, ipText(WiFi.softAPIP(), ip));
+      logEvent(LOG_INFO, EV_PORTAL_AP);
+      // start mDNS responder on AP IP as well if possible
+      startMdns(EV_MDNS_STARTED_AP, EV_MDNS_FAILED_AP);
+      bootPhase("ap");
+      hal::setPeriod(netWorker, NET_IDLE_POLL_MS);
+      break;
+    }
+    case NET_ONLINE: {
+      char ip[16];
+      logEvent(LOG_INFO, EV_WIFI_IP, {}, ipText(WiFi.localIP(), ip));
+      startMdns(EV_MDNS_STARTED, EV_MDNS_FAILED);
+      logEvent(LOG_INFO, EV_PORTAL_STA, {}, ip);
+      // Reached from the setup AP with new credentials: the open AP goes
+      if (WiFi.getMode() == WIFI_AP_STA) WiFi.softAPdisconnect(true);
+      bootPhase("wifi");
+      // SNTP runs in the background; netPoll() notices when the time is set.
+      // configTzTime applies TZ_RULE (POSIX format) to the system time.
+      sntp_set_time_sync_notification_cb(onTimeSync);
+      configTzTime(TZ_RULE, "pool.ntp.org", "time.nist.gov");
+      logEvent(LOG_INFO, EV_TZ_SET, {}, TZ_RULE);
+      logEvent(LOG_INFO, EV_TIME_WAIT);
+      break;
+    }
+  }
+}
+
+static void netPoll() {
+  bool connected = WiFi.status() == WL_CONNECTED;
+  bool timedOut = millis() - netStateSinceMs >= WIFI_CONNECT_TIMEOUT_MS;
+  switch (netState) {
+    case NET_TRY_STORED:
+      if (connected) {
+        logEvent(LOG_INFO, EV_WIFI_OK_STORED);
+        netEnter(NET_ONLINE);
+      } else if (timedOut) {
+        logEvent(LOG_WARN, EV_WIFI_FAIL_STORED);
+        netEnter(NET_TRY_COMPILED);
+      }
+      break;
+    case NET_TRY_COMPILED:
+      if (connected) {
+        logEvent(LOG_INFO, EV_WIFI_OK_COMPILED);
+        netEnter(NET_ONLINE);
+      } else if (timedOut) {
+        logEvent(LOG_WARN, EV_WIFI_FAIL_COMPILED);
+        netEnter(NET_AP);
+      }
+      break;
+    case NET_AP:
+      // New credentials from /wifi: try them once the reply has gone out,
+      // keeping the AP up in case they don't work either
+      if (!wifiSaved) break;
+      if (millis() - wifiSavedAtMs < WIFI_SAVE_GRACE_MS) {
+        hal::setPeriod(netWorker, NET_POLL_MS);
+        break;
+      }
+      wifiSaved = false;
+      loadStoredCredentials();
+      WiFi.mode(WIFI_AP_STA);
+      netEnter(NET_TRY_STORED);
+      break;
+    case NET_ONLINE:
+      // Lost links are retried by the WiFi driver (auto reconnect)
+      if (!timeSynced && clockStatus().source == CLOCK_SNTP) {
+        timeSynced = true;
+        logEvent(LOG_INFO, EV_CLOCK_SYNCED, {(int32_t)(millis() / 1000)});
+        bootPhase("time");
+        hal::setPeriod(netWorker, NET_IDLE_POLL_MS);
+      }
+      break;
+  }
+}
+
+static void netStart() {
+  loadStoredCredentials();
+  WiFi.mode(WIFI_STA);
+  // First step here, before the task that polls it exists
+  netEnter(storedSsid[0] ? NET_TRY_STORED : NET_TRY_COMPILED);
+  netWorker = hal::startPeriodic("net", netPoll, netState == NET_AP ? NET_IDLE_POLL_MS : NET_POLL_MS);
+  if (netWorker < 0) logEvent(LOG_ERROR, EV_TASK_START_FAILED, {}, "net");
+}
+
+// Start the config portal in a non-blocking way. The server listens on
+// whichever interface netPoll() brings up (station or setup AP). Handlers are
+// registered here and served by the AsyncTCP task.
+void startConfigPortal() {
+  if (configPortalRunning) return;
+
+  // Static pages, CSS and JS come pre-compressed from flash (web/, see
+  // tools/embed_web.py); every file under its own name plus short aliases
+  for (const WebAsset *asset : WEB_ASSETS) {
+    server.on(asset->path, HTTP_GET, timed([asset](AsyncWebServerRequest *request) { serveAsset(request, *asset); }));
+  }
+  server.on("/", HTTP_GET, timed([](AsyncWebServerRequest *request) { serveAsset(request, WEB_INDEX_HTML); }));
+  server.on("/config", HTTP_GET, timed([](AsyncWebServerRequest *request) { serveAsset(request, WEB_CONFIG_HTML); }));
+  server.on("/config.json", HTTP_GET, timed(handleConfigJson));
+  server.on("/config/save", HTTP_POST, timed(handleConfigSave), nullptr, receiveFormBody);
+  server.on("/wifi", HTTP_GET, timed([](AsyncWebServerRequest *request) { serveAsset(request, WEB_WIFI_HTML); }));
+  server.on("/wifi/save", HTTP_POST, timed(handleWifiSave), nullptr, receiveFormBody);
+  server.on("/log", HTTP_GET, timed(handleLogDownload));
+  server.on("/loglevel", HTTP_GET | HTTP_POST, timed(handleLogLevel));
+  server.on("/api/status", HTTP_GET, timed(handleApiStatus));
+  server.on("/api/schedule", HTTP_GET | HTTP_PUT, timed(handleApiSchedule), nullptr, receiveFormBody);
+  server.on("/api/feed", HTTP_POST, timed(handleApiFeed));
+  server.on("/stats", HTTP_GET, timed(handleStats));
+  server.on("/metrics", HTTP_GET, timed(handleMetrics));
+  server.on("/runs", HTTP_GET, timed(handleRuns));
+  server.on("/trace", HTTP_GET, timed(handleTrace));
+  server.on("/events", HTTP_GET, timed(handleEvents));
+  server.onNotFound([](AsyncWebServerRequest *request) { request->send(404, "text/plain", "Not found"); });
+
+  server.begin();
+  configPortalRunning = true;
+}
+
+// Serve a gzip asset from flash, or 304 if the browser's copy is current.
+// no-cache makes browsers revalidate each time, which costs one tiny request
+// but means a firmware update never leaves stale pages behind.
+void serveAsset(AsyncWebServerRequest *request, const WebAsset &asset) {
+  AsyncWebServerResponse *response;
+  if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == asset.etag) {
+    response = request->beginResponse(304);
+  } else {
+    response = request->beginResponse_P(200, asset.mime, asset.gz, asset.gzLen);
+    response->addHeader("Content-Encoding", "gzip");
+  }
+  response->addHeader("ETag", asset.etag);
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+}
+
+// Form posts (/config/save, /wifi/save) arrive as the raw urlencoded body.
+// web/form.js sends it as application/octet-stream, which the web server
+// library passes through untouched instead of splitting it into String
+// parameters; the handlers then walk it in place with FormReader (form.h).
+// Only the AsyncTCP task touches the buffer. A body arriving while another
+// is still incomplete takes the buffer over, and the first gets a 503.
+const size_t FORM_BODY_MAX = 2048; // a full schedule with all weekdays is ~1.3 KB
+static char formBody[FORM_BODY_MAX + 1];
+static size_t formBodyLen = 0;
+static bool formBodyTooLarge = false;
+static AsyncWebServerRequest *formBodyOwner = nullptr;
+
+static void receiveFormBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+  if (index == 0) {
+    formBodyOwner = request;
+    formBodyLen = 0;
+    formBodyTooLarge = total > FORM_BODY_MAX;
+    request->onDisconnect([request]() {
+      if (formBodyOwner == request) formBodyOwner = nullptr;
+    });
+  }
+  if (formBodyOwner != request || formBodyTooLarge || index != formBodyLen || index + len > FORM_BODY_MAX) return;
+  memcpy(formBody + index, data, len);
+  formBodyLen = index + len;
+}
+
+// The server parsed a urlencoded body into parameters instead of handing it
+// to receiveFormBody(). Query parameters (?ch=1) don't count.
+static bool hasBodyParams(AsyncWebServerRequest *request) {
+  for (size_t i = 0; i < request->params(); ++i) {
+    if (request->getParam(i)->isPost()) return true;
+  }
+  return false;
+}
+
+// The body receiveFormBody() collected for this request, then the buffer is
+// free again. False once an error response has been sent.
+static bool takeFormBody(AsyncWebServerRequest *request, size_t &len) {
+  bool mine = formBodyOwner == request;
+  formBodyOwner = nullptr;
+  len = 0;
+  if (request->contentLength() == 0) return true;
+  if (!mine && hasBodyParams(request)) {
+    // Posted as application/x-www-form-urlencoded (no JavaScript?)
+    request->send(415, "text/plain", "Form must be sent by form.js");
+    return false;
+  }
+  if (!mine) {
+    request->send(503, "text/plain", "Busy, please try again");
+    return false;
+  }
+  if (formBodyTooLarge) {
+    request->send(413, "text/plain", "Form too large");
+    return false;
+  }
+  if (formBodyLen != request->contentLength()) {
+    request->send(400, "text/plain", "Form incomplete");
+    return false;
+  }
+  len = formBodyLen;
+  return true;
+}
+
+// Handlers use Preferences to save credentials.
+void handleWifiSave(AsyncWebServerRequest *request) {
+  size_t len;
+  if (!takeFormBody(request, len)) return;
+  FormReader form(formBody, len);
+  FormView key, value;
+  FormView ssid = {"", 0};
+  FormView pass = {"", 0};
+  while (form.next(key, value)) {
+    if (key.is("ssid")) ssid = value;
+    else if (key.is("pass")) pass = value;
+  }
+  // Lengths as WiFi.begin() takes them; a %00 would cut the stored string
+  if (ssid.len == 0 || ssid.len > 32 || strlen(ssid.data) != ssid.len) {
+    request->send(400, "text/plain", "SSID must be 1 to 32 bytes");
+    return;
+  }
+  if ((pass.len > 0 && pass.len < 8) || pass.len > 64 || strlen(pass.data) != pass.len) {
+    request->send(400, "text/plain", "Password must be empty or 8 to 64 bytes");
+    return;
+  }
+  Preferences prefs;
+  prefs.begin("wifi", false);
+  prefs.putString("ssid", ssid.data);
+  prefs.putString("pass", pass.data);
+  prefs.end();
+  // Only the setup AP switches over right away (netPoll()); an existing
+  // connection is not dropped from under the client that sent this
+  if (netState == NET_ONLINE) {
+    request->send(200, "text/html", "Saved. The new network is used after a restart. You can close this page.");
+    return;
+  }
+  wifiSavedAtMs = millis();
+  wifiSaved = true;
+  hal::wakePeriodic(netWorker);
+  request->send(200, "text/html", "Saved. The device will try to connect. You can close this page.");
+}
+
+// German weekday abbreviations, indexed like tm_wday; shown Monday first
+static const char *const WEEKDAY_NAMES[7] = {"So", "Mo", "Di", "Mi", "Do", "Fr", "Sa"};
+
+// One schedule row of the config form, as views into formBody
+struct ScheduleFormRow {
+  FormView time;    // t<i>: HH:MM, empty drops the row
+  FormView steps;   // s<i>: portions, empty means STEPS_PER_RUN
+  uint8_t weekdays; // d<i>_<wd>: present when checked
+};
+
+// Split a field name t<i>, s<i> or d<i>_<wd>. False for anything else.
+static bool parseScheduleKey(const FormView &key, char &field, uint32_t &row, uint32_t &weekday) {
+  if (key.len < 2) return false;
+  field = key.data[0];
+  const char *sep = (const char *)memchr(key.data, '_', key.len);
+  size_t rowLen = (sep ? (size_t)(sep - key.data) : key.len) - 1;
+  if (!formUInt({key.data + 1, rowLen}, 0, MAX_SCHEDULE_ENTRIES - 1, row)) return false;
+  if (field == 'd') return sep && formUInt({sep + 1, key.len - rowLen - 2}, 0, 6, weekday);
+  return (field == 't' || field == 's') && !sep;
+}
+
+// Store a validated schedule in schedule[ch] and NVS and hand it to the
+// control task. False once an error response has been sent.
+static bool applySchedule(AsyncWebServerRequest *request, uint8_t ch, const ScheduleEntry *entries, uint8_t count) {
+  memcpy(schedule[ch], entries, count * sizeof(ScheduleEntry));
+  scheduleCount[ch] = count;
+  SettingsSaveResult saved = saveScheduleToPrefs();
+  if (saved == SETTINGS_WRITE_FAILED) {
+    request->send(500, "text/plain", "Saving failed");
+    return false;
+  }
+  // Posted even when unchanged: an earlier save may have found the queue full
+  if (!postScheduleToControl(ch)) {
+    request->send(503, "text/plain", "Busy, please try again");
+    return false;
+  }
+  if (saved == SETTINGS_UNCHANGED) logEvent(LOG_INFO, EV_SETTINGS_UNCHANGED);
+  // Log the saved schedule (times and portion counts), one record per entry
+  for (int i = 0; i < count && saved == SETTINGS_SAVED; ++i) {
+    const ScheduleEntry &e = schedule[ch][i];
+    char days[32] = "";
+    if (e.weekdays != ALL_WEEKDAYS) {
+      int n = snprintf(days, sizeof(days), " (");
+      for (int d = 1; d <= 7; ++d) {
+        if (!(e.weekdays & (1 << (d % 7)))) continue;
+        n += snprintf(days + n, sizeof(days) - n, "%s%s", n > 2 ? "," : "", WEEKDAY_NAMES[d % 7]);
+      }
+      snprintf(days + n, sizeof(days) - n, ")");
+    }
+    logEvent(LOG_INFO, EV_SCHEDULE_SAVED, {i + 1, e.hour, e.minute, e.steps}, days, logChannel(ch));
+  }
+  return true;
+}
+
+void handleConfigSave(AsyncWebServerRequest *request) {
+  size_t len;
+  if (!takeFormBody(request, len)) return;
+  ScheduleFormRow rows[MAX_SCHEDULE_ENTRIES] = {};
+  FormReader form(formBody, len);
+  FormView key, value;
+  char error[80] = "";
+  uint32_t ch = 0;
+  while (form.next(key, value)) {
+    char field;
+    uint32_t row, weekday;
+    if (key.len == 2 && memcmp(key.data, "ch", 2) == 0) {
+      // Hidden field: the channel whose schedule the form shows
+      if (!formUInt(value, 0, FEEDER_CHANNELS - 1, ch)) {
+        snprintf(error, sizeof(error), "Unknown channel %s", value.data);
+        break;
+      }
+      continue;
+    }
+    if (!parseScheduleKey(key, field, row, weekday)) {
+      snprintf(error, sizeof(error), "Unknown field %s", key.data);
+      break;
+    }
+    if (field == 't') rows[row].time = value;
+    else if (field == 's') rows[row].steps = value;
+    else rows[row].weekdays |= 1 << weekday;
+  }
+
+  // Validate every row before anything reaches schedule[] or NVS. Rows with
+  // an empty time field are dropped; the rest are kept in order.
+  ScheduleEntry entries[MAX_SCHEDULE_ENTRIES];
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < MAX_SCHEDULE_ENTRIES && !error[0]; ++i) {
+    const ScheduleFormRow &r = rows[i];
+    if (r.time.len == 0) continue;
+    uint8_t h, m;
+    uint32_t steps = STEPS_PER_RUN;
+    if (!formHourMinute(r.time, h, m)) {
+      snprintf(error, sizeof(error), "Entry %u: time %s is not HH:MM", i + 1, r.time.data);
+    } else if (r.steps.len && !formUInt(r.steps, 1, MAX_STEPS_PER_RUN, steps)) {
+      snprintf(error, sizeof(error), "Entry %u: portions must be 1 to %u", i + 1, MAX_STEPS_PER_RUN);
+    } else {
+      entries[count++] = {h, m, (uint8_t)steps, r.weekdays};
+    }
+  }
+  if (!error[0] && len == 0) snprintf(error, sizeof(error), "Empty form");
+  if (error[0]) {
+    request->send(400, "text/plain", error);
+    return;
+  }
+  if (!applySchedule(request, (uint8_t)ch, entries, count)) return;
+
+  // Respond with a small page that shows a toast notification and then redirects
+  serveAsset(request, WEB_SAVED_HTML);
+}
+
+// --- REST API (/api/...) for home automation pollers ---
+// Bodies are rendered from a snapshot taken when the request arrives, one
+// TCP-buffer-sized window at a time (JsonOut, json.h), so there is no body
+// buffer or String. Every GET carries an ETag; a poller that sends it back
+// in If-None-Match gets a bodyless 304 while nothing has changed.
+
+// 304 if the client already has this ETag, else the document that
+// render(JsonOut &) produces; render is copied into the response and called
+// again for every chunk, so it must only use what it captured.
+template <typename Render>
+static void sendJson(AsyncWebServerRequest *request, int code, const char *etag, Render render) {
+  if (etag && code == 200 && request->hasHeader("If-None-Match") &&
+      request->getHeader("If-None-Match")->value() == etag) {
+    AsyncWebServerResponse *response = request->beginResponse(304);
+    response->addHeader("ETag", etag);
+    request->send(response);
+    return;
+  }
+  JsonOut measure;
+  render(measure);
+  AsyncWebServerResponse *response = request->beginResponse(
+      "application/json", measure.size(), [render](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+        JsonOut out((char *)buf, index, maxLen);
+        render(out);
+        return out.copied();
+      });
+  response->setCode(code);
+  if (etag) response->addHeader("ETag", etag);
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+}
+
+static void sendJsonError(AsyncWebServerRequest *request, int code, const char *message) {
+  char json[96];
+  snprintf(json, sizeof(json), "{\"error\":\"%s\"}", message);
+  AsyncWebServerResponse *response = request->beginResponse(code, "application/json", json);
+  response->addHeader("Cache-Control", "no-store");
+  request->send(response);
+}
+
+// A channel's schedule as config.js and /api/schedule see it:
+// {"channel":0,"channels":2,"max":16,"entries":[{"h":8,"m":0,"s":3,"d":127},...]}
+struct ScheduleSnapshot {
+  uint8_t channel;
+  uint8_t count;
+  ScheduleEntry entries[MAX_SCHEDULE_ENTRIES];
+};
+
+static ScheduleSnapshot scheduleSnapshot(uint8_t ch) {
+  ScheduleSnapshot snap = {ch, scheduleCount[ch], {}};
+  memcpy(snap.entries, schedule[ch], snap.count * sizeof(ScheduleEntry));
+  return snap;
+}
+
+static void scheduleEtag(const ScheduleSnapshot &snap, char *etag, size_t len) {
+  snprintf(etag, len, "\"%08x\"", (unsigned)jsonHash(&snap, sizeof(snap)));
+}
+
+static void sendSchedule(AsyncWebServerRequest *request, uint8_t ch) {
+  ScheduleSnapshot snap = scheduleSnapshot(ch);
+  char etag[16];
+  scheduleEtag(snap, etag, sizeof(etag));
+  sendJson(request, 200, etag, [snap](JsonOut &out) {
+    out.printf("{\"channel\":%u,\"channels\":%u,\"max\":%u,\"entries\":[", snap.channel, FEEDER_CHANNELS,
+               MAX_SCHEDULE_ENTRIES);
+    for (uint8_t i = 0; i < snap.count; ++i) {
+      const ScheduleEntry &e = snap.entries[i];
+      out.printf("%s{\"h\":%u,\"m\":%u,\"s\":%u,\"d\":%u}", i ? "," : "", e.hour, e.minute, e.steps, e.weekdays);
+    }
+    out.print("]}");
+  });
+}
+
+void handleConfigJson(AsyncWebServerRequest *request) {
+  uint8_t ch;
+  if (!channelParam(request, ch)) {
+    request->send(400, "text/plain", "Unknown channel");
+    return;
+  }
+  sendSchedule(request, ch);
+}
+
+// GET /api/status: what the feeder is doing, plus clock, uptime and heap.
+// The top-level feeder fields are channel 0's; "channels" has every
+// channel's. clockErrorMs bounds the clock error, except after a power cut
+// ("clock":"nvs"): then clockErrorLowerBound is true and the clock is
+// behind by that much plus the unknown time without power, until SNTP sets
+// it. clockDriftPpb is null until two SNTP syncs measured it.
+// {"time":1774500000,"clock":"sntp","clockErrorMs":50,"clockErrorLowerBound":false,
+//  "clockDriftPpb":-1200,"relay":false,"motorRun":false,"entry":-1,"steps":0,"stepsWanted":0,
+//  "nextEntry":1,"nextFire":1774522800,"uptimeS":86400,"heapFree":182000,
+//  "heapLargest":110000,"channels":[{"relay":false,...},...]}
+// The ETag is weak and covers the feeder state only: a 304 means relay, run
+// and next fire are unchanged, while clock, uptime and heap move on anyway.
+void handleApiStatus(AsyncWebServerRequest *request) {
+  struct Snapshot {
+    FeederStatus st[FEEDER_CHANNELS];
+    uint32_t now;
+    ClockStatus clock;
+    uint32_t uptimeS;
+    hal::HeapStats heap;
+  } snap;
+  for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) snap.st[ch] = feederStatus(ch);
+  snap.now = (uint32_t)time(nullptr);
+  snap.clock = clockStatus();
+  snap.uptimeS = (uint32_t)(hal::micros() / 1000000);
+  snap.heap = hal::heapStats();
+  char etag[16];
+  snprintf(etag, sizeof(etag), "W/\"%08x\"", (unsigned)jsonHash(snap.st, sizeof(snap.st)));
+  sendJson(request, 200, etag, [snap](JsonOut &out) {
+    const FeederStatus &st = snap.st[0];
+    char drift[12] = "null";
+    if (snap.clock.driftPpb != CLOCK_DRIFT_UNKNOWN) snprintf(drift, sizeof(drift), "%d", (int)snap.clock.driftPpb);
+    out.printf("{\"time\":%u,\"clock\":\"%s\",\"clockErrorMs\":%u,\"clockErrorLowerBound\":%s,\"clockDriftPpb\":%s,",
+               (unsigned)snap.now, clockSourceName(snap.clock.source), (unsigned)snap.clock.errorMs,
+               snap.clock.errorLowerBound ? "true" : "false", drift);
+    out.printf("\"relay\":%s,\"motorRun\":%s,\"entry\":%d,\"steps\":%u,\"stepsWanted\":%u,",
+               st.relayActive ? "true" : "false", st.motorRunActive ? "true" : "false",
+               st.runEntry, st.steps, st.stepsWanted);
+    out.printf("\"nextEntry\":%d,\"nextFire\":%u,\"uptimeS\":%u,\"heapFree\":%u,\"heapLargest\":%u,\"channels\":[",
+               st.nextEntry, (unsigned)st.nextFireEpoch, (unsigned)snap.uptimeS, (unsigned)snap.heap.freeBytes,
+               (unsigned)snap.heap.largestFreeBlock);
+    for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+      const FeederStatus &c = snap.st[ch];
+      out.printf("%s{\"relay\":%s,\"motorRun\":%s,\"entry\":%d,\"steps\":%u,\"stepsWanted\":%u,"
+                 "\"nextEntry\":%d,\"nextFire\":%u}",
+                 ch ? "," : "", c.relayActive ? "true" : "false", c.motorRunActive ? "true" : "false", c.runEntry,
+                 c.steps, c.stepsWanted, c.nextEntry, (unsigned)c.nextFireEpoch);
+    }
+    out.print("]}");
+  });
+}
+
+// Format a parse error; returns false for the caller to return.
+static bool jsonFail(char *error, size_t len, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static bool jsonFail(char *error, size_t len, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(error, len, fmt, ap);
+  va_end(ap);
+  return false;
+}
+
+// {"entries":[{"h":8,"m":0,"s":3,"d":127},...]} as GET returns it; "s" and
+// "d" default to STEPS_PER_RUN and every day, other keys are ignored.
+static bool parseScheduleJson(JsonIn &in, ScheduleEntry *entries, uint8_t &count, char *error, size_t len) {
+  char key[12];
+  count = 0;
+  bool sawEntries = false;
+  if (!in.consume('{')) return jsonFail(error, len, "expected an object");
+  if (!in.consume('}')) {
+    do {
+      if (!in.key(key, sizeof(key))) return jsonFail(error, len, "bad key");
+      if (strcmp(key, "entries") != 0) {
+        if (!in.skipValue()) return jsonFail(error, len, "bad value for %s", key);
+        continue;
+      }
+      sawEntries = true;
+      if (!in.consume('[')) return jsonFail(error, len, "entries must be an array");
+      if (in.consume(']')) continue;
+      do {
+        if (count == MAX_SCHEDULE_ENTRIES) return jsonFail(error, len, "more than %u entries", MAX_SCHEDULE_ENTRIES);
+        uint32_t h = UINT32_MAX, m = UINT32_MAX, steps = STEPS_PER_RUN, days = ALL_WEEKDAYS;
+        if (!in.consume('{')) return jsonFail(error, len, "entry %u: expected an object", count + 1);
+        if (!in.consume('}')) {
+          do {
+            uint32_t *field = nullptr;
+            if (!in.key(key, sizeof(key))) return jsonFail(error, len, "entry %u: bad key", count + 1);
+            if (!strcmp(key, "h")) field = &h;
+            else if (!strcmp(key, "m")) field = &m;
+            else if (!strcmp(key, "s")) field = &steps;
+            else if (!strcmp(key, "d")) field = &days;
+            if (field ? !in.uint(*field) : !in.skipValue()) {
+              return jsonFail(error, len, "entry %u: bad value for %s", count + 1, key);
+            }
+          } while (in.consume(','));
+          if (!in.consume('}')) return jsonFail(error, len, "entry %u: expected }", count + 1);
+        }
+        if (h > 23 || m > 59) return jsonFail(error, len, "entry %u: h must be 0-23, m 0-59", count + 1);
+        if (steps < 1 || steps > MAX_STEPS_PER_RUN) {
+          return jsonFail(error, len, "entry %u: s must be 1-%u", count + 1, MAX_STEPS_PER_RUN);
+        }
+        if (days > ALL_WEEKDAYS) return jsonFail(error, len, "entry %u: d must be 0-127", count + 1);
+        entries[count++] = {(uint8_t)h, (uint8_t)m, (uint8_t)steps, (uint8_t)days};
+      } while (in.consume(','));
+      if (!in.consume(']')) return jsonFail(error, len, "expected ]");
+    } while (in.consume(','));
+    if (!in.consume('}')) return jsonFail(error, len, "expected }");
+  }
+  if (!in.atEnd()) return jsonFail(error, len, "trailing data");
+  if (!sawEntries) return jsonFail(error, len, "entries missing");
+  return true;
+}
+
+// GET /api/schedule?ch=N: channel N's schedule (0 without ?ch) with an
+// ETag. PUT replaces it with a document of the same shape (answered with
+// the new schedule); all of it is validated before anything is stored.
+// With If-Match, the PUT only applies if nobody changed the schedule since
+// that ETag (412 otherwise).
+void handleApiSchedule(AsyncWebServerRequest *request) {
+  uint8_t ch;
+  if (!channelParam(request, ch)) {
+    sendJsonError(request, 400, "unknown channel");
+    return;
+  }
+  if (request->method() != HTTP_PUT) {
+    sendSchedule(request, ch);
+    return;
+  }
+  size_t len;
+  if (!takeFormBody(request, len)) return;
+  if (request->hasHeader("If-Match")) {
+    char etag[16];
+    scheduleEtag(scheduleSnapshot(ch), etag, sizeof(etag));
+    if (request->getHeader("If-Match")->value() != etag) {
+      sendJsonError(request, 412, "schedule changed");
+      return;
+    }
+  }
+  JsonIn in(formBody, len);
+  ScheduleEntry entries[MAX_SCHEDULE_ENTRIES];
+  uint8_t count;
+  char error[64];
+  if (!parseScheduleJson(in, entries, count, error, sizeof(error))) {
+    sendJsonError(request, 400, error);
+    return;
+  }
+  if (!applySchedule(request, ch, entries, count)) return;
+  sendSchedule(request, ch);
+}
+
+// POST /api/feed?portions=N (1..MAX_STEPS_PER_RUN, default STEPS_PER_RUN)
+// &ch=N (default 0): one run of that channel now, stopped by the step
+// switch and jam detection like a scheduled one. 202 once the control task
+// has the request, 409 while the channel's motor is already running.
+void handleApiFeed(AsyncWebServerRequest *request) {
+  uint8_t ch;
+  if (!channelParam(request, ch)) {
+    sendJsonError(request, 400, "unknown channel");
+    return;
+  }
+  uint32_t portions = STEPS_PER_RUN;
+  AsyncWebParameter *p = request->getParam("portions");
+  if (p && !formUInt({p->value().c_str(), p->value().length()}, 1, MAX_STEPS_PER_RUN, portions)) {
+    char error[32];
+    snprintf(error, sizeof(error), "portions must be 1-%u", MAX_STEPS_PER_RUN);
+    sendJsonError(request, 400, error);
+    return;
+  }
+  FeederStatus st = feederStatus(ch);
+  if (st.motorRunActive || st.relayActive) {
+    sendJsonError(request, 409, "motor is running");
+    return;
+  }
+  if (!feederPostCommand({CMD_FEED, ch, (uint8_t)portions, {}})) {
+    sendJsonError(request, 503, "busy, please try again");
+    return;
+  }
+  char json[40];
+  snprintf(json, sizeof(json), "{\"channel\":%u,\"portions\":%u}", ch, (unsigned)portions);
+  AsyncWebServerResponse *response = request->beginResponse(202, "application/json", json);
+  response->addHeader("Cache-Control", "no-store");
+  request->send(response);
+}
+
+// Register WiFi event handler to log events. It runs in the WiFi event task
+// and must not block.
+void setupWifiEventHandler() {
+  WiFi.onEvent([](WiFiEvent_t event) {
+    // Failed connect attempts raise DISCONNECTED too; only count lost links
+    static bool staUp = false;
+    static bool staLost = false;
+    switch (event) {
+      case SYSTEM_EVENT_STA_GOT_IP: {
+        if (staLost) metricsCount(CTR_WIFI_RECONNECTS);
+        staUp = true;
+        staLost = false;
+        // SNTP and mDNS keep running across reconnects; netPoll() set them up
+        char ip[16];
+        logEvent(LOG_INFO, EV_WIFI_GOT_IP, {}, ipText(WiFi.localIP(), ip));
+        eventStreamPublish("wifi", "{\"t\":%u,\"state\":\"connected\",\"ip\":\"%s\"}",
+                           (unsigned)hal::epochNow(), ip);
+        break;
+      }
+      case SYSTEM_EVENT_STA_DISCONNECTED:
+        if (staUp) {
+          metricsCount(CTR_WIFI_DISCONNECTS);
+          staLost = true;
+        }
+        staUp = false;
+        logEvent(LOG_WARN, EV_WIFI_DISCONNECTED);
+        eventStreamPublish("wifi", "{\"t\":%u,\"state\":\"disconnected\"}", (unsigned)hal::epochNow());
+        break;
+      default:
+        // ignore other events
+        break;
+    }
+  });
+}
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "event_stream.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "hal.h"
+
+struct EventSlot {
+  uint32_t id;
+  uint8_t len;
+  char text[EVENT_STREAM_MAX_MESSAGE];
+};
+
+struct Subscriber {
+  bool used;
+  bool greeted;        // retry line sent
+  uint32_t next;       // id of the next event to send
+  uint32_t lastSendMs;
+};
+
+// Event ids count from 1; the ring holds ids nextEventId - SLOTS .. nextEventId - 1
+static EventSlot eventRing[EVENT_STREAM_SLOTS];
+static uint32_t nextEventId = 1;
+static Subscriber subscribers[EVENT_STREAM_MAX_SUBSCRIBERS];
+static std::atomic<uint8_t> subscriberCount{0};
+static hal::SpinLock streamLock;
+
+void eventStreamPublish(const char *name, const char *fmt, ...) {
+  char data[EVENT_STREAM_MAX_MESSAGE];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(data, sizeof(data), fmt, ap);
+  va_end(ap);
+  char text[EVENT_STREAM_MAX_MESSAGE];
+  int n = snprintf(text, sizeof(text), "event: %s\ndata: %s\n\n", name, data);
+  if (n <= 0 || (size_t)n >= sizeof(text)) return; // half a JSON object helps nobody
+
+  streamLock.lock();
+  EventSlot &slot = eventRing[nextEventId % EVENT_STREAM_SLOTS];
+  slot.id = nextEventId++;
+  slot.len = (uint8_t)n;
+  memcpy(slot.text, text, n);
+  streamLock.unlock();
+}
+
+bool eventStreamActive() {
+  return subscriberCount.load(std::memory_order_relaxed) > 0;
+}
+
+int eventStreamSubscribe(const uint32_t *lastId, uint32_t nowMs) {
+  streamLock.lock();
+  int sub = -1;
+  for (int i = 0; i < EVENT_STREAM_MAX_SUBSCRIBERS && sub < 0; ++i) {
+    if (!subscribers[i].used) sub = i;
+  }
+  if (sub >= 0) {
+    Subscriber &s = subscribers[sub];
+    s.used = true;
+    s.greeted = false;
+    s.next = nextEventId;
+    // Resume only within the ring; an id from before a reboot may be ahead
+    if (lastId && *lastId < nextEventId && nextEventId - (*lastId + 1) <= EVENT_STREAM_SLOTS) s.next = *lastId + 1;
+    s.lastSendMs = nowMs;
+    subscriberCount.fetch_add(1, std::memory_order_relaxed);
+  }
+  streamLock.unlock();
+  return sub;
+}
+
+int eventStreamRead(int sub, char *buf, size_t len, uint32_t nowMs) {
+  if (sub < 0 || sub >= EVENT_STREAM_MAX_SUBSCRIBERS) return EVENT_STREAM_DROPPED;
+  // Only this subscriber's reader moves s.next; the lock covers the ring
+  Subscriber &s = subscribers[sub];
+  size_t out = 0;
+  if (!s.greeted) {
+    int n = snprintf(buf, len, "retry: %u\n\n", (unsigned)EVENT_STREAM_RETRY_MS);
+    if (n <= 0 || (size_t)n >= len) return 0;
+    out = n;
+    s.greeted = true;
+  }
+  for (;;) {
+    char text[EVENT_STREAM_MAX_MESSAGE];
+    streamLock.lock();
+    if (nextEventId - s.next > EVENT_STREAM_SLOTS) {
+      streamLock.unlock();
+      // Overwritten before it was sent; what is already in buf still goes
+      return out ? (int)out : EVENT_STREAM_DROPPED;
+    }
+    if (s.next == nextEventId) {
+      streamLock.unlock();
+      break;
+    }
+    const EventSlot &slot = eventRing[s.next % EVENT_STREAM_SLOTS];
+    uint8_t n = slot.len;
+    memcpy(text, slot.text, n);
+    streamLock.unlock();
+
+    char idLine[16];
+    int idLen = snprintf(idLine, sizeof(idLine), "id: %u\n", (unsigned)s.next);
+    if (out + idLen + n > len) break;
+    memcpy(buf + out, idLine, idLen);
+    memcpy(buf + out + idLen, text, n);
+    out += idLen + n;
+    s.next++;
+  }
+  // A comment now and then, so a vanished client shows up as a failed send
+  if (out == 0 && nowMs - s.lastSendMs >= EVENT_STREAM_HEARTBEAT_MS && len >= 3) {
+    memcpy(buf, ":\n\n", 3);
+    out = 3;
+  }
+  if (out) s.lastSendMs = nowMs;
+  return (int)out;
+}
+
+void eventStreamUnsubscribe(int sub) {
+  if (sub < 0 || sub >= EVENT_STREAM_MAX_SUBSCRIBERS) return;
+  streamLock.lock();
+  if (subscribers[sub].used) {
+    subscribers[sub].used = false;
+    subscriberCount.fetch_sub(1, std::memory_order_relaxed);
+  }
+  streamLock.unlock();
+}
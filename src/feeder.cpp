@@ -0,0 +1,763 @@
+#include "feeder.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+
+#include "debounce.h"
+#include "event_stream.h"
+#include "hal.h"
+#include "logger.h"
+#include "metrics.h"
+#include "run_telemetry.h"
+#include "schedule.h"
+#include "settings.h"
+#include "spsc_queue.h"
+#include "trace.h"
+#include "wall_clock.h"
+
+// Filled from settings (or their defaults) by loadScheduleFromPrefs()
+ScheduleEntry schedule[FEEDER_CHANNELS][MAX_SCHEDULE_ENTRIES];
+uint8_t scheduleCount[FEEDER_CHANNELS] = {0};
+
+// --- Channel state machine ---
+//
+// A channel is idle, running its motor for a counted number of steps (a
+// schedule entry or a feed request), running a timed manual pulse, or in
+// the cooldown after its motor stopped. Everything that happens to it is an
+// input; TRANSITIONS gives the next state and the action for every state
+// and input, and an action may raise a follow-up input (the last step of a
+// run raises IN_DONE). Scheduled runs start from the cooldown too; only
+// manual pulses wait for it to end.
+enum ChannelState : uint8_t { CH_IDLE, CH_RUN, CH_PULSE, CH_COOLDOWN, CH_STATE_COUNT };
+enum ChannelInput : uint8_t {
+  IN_NONE,
+  IN_RUN,          // entry due or feed request (pendingEntry, pendingSteps)
+  IN_STEP,         // debounced rising edge of the step switch
+  IN_PRESSES,      // REQUIRED_PRESSES steps outside a run (manual trigger)
+  IN_DONE,         // the run counted all its steps
+  IN_JAM,          // the step in progress is over its learned limit
+  IN_TIMEOUT,      // SCHEDULED_RUN_MAX_MS failsafe
+  IN_PULSE_END,    // RELAY_PULSE_MS over
+  IN_COOLDOWN_END, // MOTOR_STOP_COOLDOWN_MS over
+  IN_COUNT
+};
+
+// Switch edges captured by the GPIO interrupt, oldest first. Debouncing runs
+// on these timestamps in readSwitchRisingEdge(), so a slow pass delays but
+// never loses or merges steps.
+struct SwitchEdge { uint32_t us; bool closed; };
+
+struct Channel {
+  ChannelState state = CH_IDLE;
+  uint32_t sinceMs = 0; // millis() when state was entered
+  // The control task's own copy of the schedule. schedule[] above belongs
+  // to the web side; changes are staged with CMD_SET_SCHEDULE_ENTRY and take
+  // effect together on CMD_COMMIT_SCHEDULE.
+  ScheduleEngine engine;
+  ScheduleEntry staged[MAX_SCHEDULE_ENTRIES];
+  RunTelemetry telemetry; // step times and jam limits, see run_telemetry.h
+  SpscQueue<SwitchEdge, 64> edges;
+  volatile bool edgesOverflow = false;
+  SwitchDebouncer debouncer{SWITCH_DEBOUNCE}; // debounced switch state, see debounce.h
+  uint32_t lastRiseUs = 0;                    // sample tick of the last debounced rising edge
+  int8_t entry = -1;                          // run in progress: schedule entry, -1 for a feed request
+  uint8_t steps = 0;                          // ... steps counted so far
+  uint8_t stepsWanted = 0;
+  int8_t pendingEntry = -1;                   // what the next IN_RUN starts; 0 steps = the entry's count
+  uint8_t pendingSteps = 0;
+  uint8_t presses = 0;                        // manual trigger count outside runs
+  bool relayOn = false;                       // as last set, for feederStatus()
+};
+
+static Channel channels[FEEDER_CHANNELS];
+
+static uint8_t channelOf(const Channel &c) { return (uint8_t)(&c - channels); }
+
+// Log records name the channel only where there is more than one
+static int8_t logChannel(const Channel &c) {
+  return FEEDER_CHANNELS > 1 ? (int8_t)channelOf(c) : LOG_NO_CHANNEL;
+}
+
+// feederStatus() snapshots, published at the end of every pass
+static FeederStatus publishedStatus[FEEDER_CHANNELS];
+static hal::SpinLock statusLock;
+
+static void HAL_ISR_ATTR onSwitchEdge(uint8_t ch, uint32_t us, int level) {
+  Channel &c = channels[ch];
+  if (!c.edges.push({us, boardSwitchClosed(level)})) c.edgesOverflow = true;
+  hal::wakeControlFromIsr();
+}
+
+// Control task -> feederService(): log events, timestamped when they happen.
+// The control path never touches the logger, Serial or the filesystem.
+struct ControlEvent {
+  uint32_t epoch;
+  uint8_t level;
+  uint8_t event;
+  uint8_t argc;
+  int8_t channel; // LOG_NO_CHANNEL on single-channel boards
+  int32_t args[LOG_MAX_ARGS];
+};
+static SpscQueue<ControlEvent, 32> controlEvents;
+static std::atomic<uint32_t> controlEventsDropped{0};
+static int serviceWorker = -1; // feederStartService() task
+
+// feederPostCommand() -> control task
+static SpscQueue<FeederCommand, 32> feederCommands;
+
+// Control events that /events streams too (event_stream.h), by SSE name
+static const char *streamName(uint8_t event) {
+  switch (event) {
+    case EV_RELAY_ACTIVE:
+    case EV_RELAY_INACTIVE: return "relay";
+    case EV_RUN_STEP:
+    case EV_SWITCH_EDGE: return "step";
+    case EV_SCHEDULE_DUE: return "schedule";
+    case EV_RUN_START:
+    case EV_RUN_COMPLETE:
+    case EV_RUN_TIMEOUT:
+    case EV_RUN_JAMMED: return "run";
+    default: return nullptr;
+  }
+}
+
+static void streamEvent(const ControlEvent &e) {
+  const char *name = streamName(e.event);
+  if (!name) return;
+  // "ch" (from 0) only where the log names channels too
+  char ch[12] = "";
+  if (e.channel >= 0) snprintf(ch, sizeof(ch), ",\"ch\":%d", e.channel);
+  switch (e.event) {
+    case EV_RELAY_ACTIVE:
+    case EV_RELAY_INACTIVE:
+      eventStreamPublish(name, "{\"t\":%u%s,\"on\":%s}", (unsigned)e.epoch, ch,
+                         e.event == EV_RELAY_ACTIVE ? "true" : "false");
+      break;
+    case EV_RUN_STEP:
+    case EV_SWITCH_EDGE:
+      eventStreamPublish(name, "{\"t\":%u%s,\"count\":%d,\"run\":%s}", (unsigned)e.epoch, ch, (int)e.args[0],
+                         e.event == EV_RUN_STEP ? "true" : "false");
+      break;
+    case EV_SCHEDULE_DUE:
+      eventStreamPublish(name, "{\"t\":%u%s,\"hour\":%d,\"minute\":%d}", (unsigned)e.epoch, ch, (int)e.args[0],
+                         (int)e.args[1]);
+      break;
+    default: {
+      const char *state = e.event == EV_RUN_START ? "started"
+                        : e.event == EV_RUN_COMPLETE ? "complete"
+                        : e.event == EV_RUN_TIMEOUT ? "timeout" : "jammed";
+      eventStreamPublish(name, "{\"t\":%u%s,\"state\":\"%s\"}", (unsigned)e.epoch, ch, state);
+      break;
+    }
+  }
+}
+
+static void emit(LogLevel level, LogEvent event, std::initializer_list<int32_t> args = {},
+                 int8_t channel = LOG_NO_CHANNEL) {
+  // Filtered before it takes a queue slot, unless /events wants it
+  if (!logEnabled(level) && !(streamName(event) && eventStreamActive())) return;
+  ControlEvent e;
+  e.epoch = clockStamp(); // logEventAt() fixes it up if the clock syncs meanwhile
+  e.level = level;
+  e.event = event;
+  e.argc = 0;
+  e.channel = channel;
+  for (int32_t a : args) {
+    if (e.argc == LOG_MAX_ARGS) break;
+    e.args[e.argc++] = a;
+  }
+  if (!controlEvents.push(e)) controlEventsDropped.fetch_add(1, std::memory_order_relaxed);
+  if (serviceWorker >= 0) hal::wakePeriodic(serviceWorker);
+}
+
+// An event about channel c
+static void emit(const Channel &c, LogLevel level, LogEvent event, std::initializer_list<int32_t> args = {}) {
+  emit(level, event, args, logChannel(c));
+}
+
+// Control task wakes while nothing was moving, reported at the next run
+static uint32_t idleWakeCount[3] = {0};
+static uint32_t idleWakeMaxLatencyUs = 0;
+static uint32_t lastSwitchWakeMs = 0;
+
+// Something on any channel is moving or about to
+static bool channelsBusy() {
+  for (const Channel &c : channels) {
+    if (c.state == CH_RUN || c.state == CH_PULSE || c.debouncer.settling()) return true;
+  }
+  return false;
+}
+
+static void reportWake(const hal::ControlWake &wake) {
+  if (wake.reason == hal::WAKE_SWITCH) {
+    // Only the first edge of a bounce burst says anything about wake latency
+    uint32_t nowMs = hal::millis();
+    bool burst = nowMs - lastSwitchWakeMs < SWITCH_DEBOUNCE_MS;
+    lastSwitchWakeMs = nowMs;
+    if (burst) return;
+  }
+  if (channelsBusy() || wake.reason == hal::WAKE_SWITCH) {
+    emit(LOG_DEBUG, (LogEvent)(EV_WAKE_DEADLINE + wake.reason),
+         {(int32_t)wake.sleptMs, (int32_t)wake.latencyUs, wake.sleepCause});
+    return;
+  }
+  idleWakeCount[wake.reason]++;
+  if (wake.latencyUs > idleWakeMaxLatencyUs) idleWakeMaxLatencyUs = wake.latencyUs;
+}
+
+static void reportIdleWakes() {
+  emit(LOG_DEBUG, EV_IDLE_WAKES, {(int32_t)idleWakeCount[hal::WAKE_DEADLINE], (int32_t)idleWakeCount[hal::WAKE_SWITCH],
+                                  (int32_t)idleWakeCount[hal::WAKE_REQUEST], (int32_t)idleWakeMaxLatencyUs});
+  idleWakeCount[0] = idleWakeCount[1] = idleWakeCount[2] = 0;
+  idleWakeMaxLatencyUs = 0;
+}
+
+// Setup pins
+void setupPins() {
+  hal::pinMode(LED_PIN, OUTPUT);
+  for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+    Channel &c = channels[ch];
+    // Pull and closed level come from the board profile (board.h)
+    hal::pinMode(Board::switchPin(ch), Board::SWITCH_PULL);
+    c.debouncer.reset((uint32_t)hal::micros(), boardReadSwitch(ch));
+    hal::captureEdges(Board::switchPin(ch), onSwitchEdge, ch);
+    hal::pinMode(Board::relayPin(ch), OUTPUT);
+    setRelayInactive(ch); // ensure relay inactive after setup
+  }
+  emit(LOG_INFO, EV_PINS_INIT);
+}
+
+static void setRelay(Channel &c, bool on) {
+  boardRelay(channelOf(c), on);
+  c.relayOn = on;
+  traceRecord(TR_RELAY, hal::micros(), on, 0, channelOf(c));
+  emit(c, LOG_INFO, on ? EV_RELAY_ACTIVE : EV_RELAY_INACTIVE);
+}
+
+void setRelayActive(uint8_t channel) {
+  if (channel < FEEDER_CHANNELS) setRelay(channels[channel], true);
+}
+
+void setRelayInactive(uint8_t channel) {
+  if (channel < FEEDER_CHANNELS) setRelay(channels[channel], false);
+}
+
+// A debounced change at changedAtUs: true if it was a rising edge.
+static bool risingAt(Channel &c, uint32_t changedAtUs) {
+  if (!c.debouncer.closed()) return false;
+  c.lastRiseUs = changedAtUs;
+  return true;
+}
+
+// Debounce the captured switch edges and report rising edges. Returns true
+// for at most one rising edge per call; further edges stay queued, so call
+// until it returns false to catch up after a long stall.
+static bool readSwitchRisingEdge(Channel &c) {
+  uint8_t ch = channelOf(c);
+  if (c.edgesOverflow) {
+    // Lost edges: resynchronise from the current pin level
+    SwitchEdge e;
+    while (c.edges.pop(e)) {}
+    c.edgesOverflow = false;
+    bool closed = boardReadSwitch(ch);
+    c.debouncer.resync((uint32_t)hal::micros(), closed);
+    traceRecord(TR_SWITCH, hal::micros(), closed | 2, 0, ch);
+    emit(c, LOG_WARN, EV_SWITCH_QUEUE_OVERFLOW);
+  }
+
+  SwitchEdge e;
+  uint32_t changedAtUs;
+  while (c.edges.pop(e)) {
+    if (traceActive()) {
+      uint64_t nowUs = hal::micros();
+      traceRecord(TR_SWITCH, nowUs - (uint32_t)((uint32_t)nowUs - e.us), e.closed, 0, ch);
+    }
+    // The previous level held until this edge; the debouncer decides on it first
+    if (c.debouncer.edge(e.us, e.closed, changedAtUs) && risingAt(c, changedAtUs)) return true;
+  }
+  return c.debouncer.poll((uint32_t)hal::micros(), changedAtUs) && risingAt(c, changedAtUs);
+}
+
+// --- Actions (TRANSITIONS below) ---
+
+static ChannelInput startRun(Channel &c) {
+  reportIdleWakes();
+  emit(c, LOG_INFO, EV_RUN_START);
+  setRelay(c, true);
+  c.entry = c.pendingEntry;
+  c.steps = 0;
+  if (c.pendingSteps > 0) {
+    c.stepsWanted = c.pendingSteps;
+  } else if (c.entry >= 0 && c.entry < c.engine.count()) {
+    c.stepsWanted = c.engine.entry(c.entry).steps;
+  } else {
+    c.stepsWanted = STEPS_PER_RUN;
+  }
+  c.telemetry.begin((uint32_t)hal::micros(), (uint32_t)hal::epochNow(), c.entry, c.stepsWanted);
+  return IN_NONE;
+}
+
+static ChannelInput runBusy(Channel &c) {
+  emit(c, LOG_WARN, EV_RUN_BUSY);
+  return IN_NONE;
+}
+
+static ChannelInput countStep(Channel &c) {
+  c.steps++;
+  c.telemetry.step(c.lastRiseUs);
+  emit(c, LOG_DEBUG, EV_RUN_STEP, {c.steps});
+  return c.steps >= c.stepsWanted ? IN_DONE : IN_NONE;
+}
+
+// Stop the motor, file the run with its outcome and start the cooldown
+static void endRun(Channel &c, RunOutcome outcome) {
+  c.telemetry.end((uint32_t)hal::micros(), outcome);
+  const RunRecord &r = c.telemetry.last();
+  emit(c, LOG_INFO, EV_RUN_SUMMARY, {r.steps, r.stepsWanted, (int32_t)r.durationMs, (int32_t)c.telemetry.slowestStepMs()});
+  emit(c, LOG_INFO, EV_MOTOR_STOP);
+  setRelay(c, false);
+  c.entry = -1;
+  c.steps = 0;
+  c.stepsWanted = 0;
+}
+
+static ChannelInput completeRun(Channel &c) {
+  emit(c, LOG_INFO, EV_RUN_COMPLETE);
+  endRun(c, RUN_COMPLETE);
+  return IN_NONE;
+}
+
+static ChannelInput jamRun(Channel &c) {
+  uint32_t nowUs = (uint32_t)hal::micros();
+  const RunTelemetry &t = c.telemetry;
+  emit(c, LOG_ERROR, EV_RUN_JAMMED, {t.steps() + 1, (int32_t)t.stepElapsedMs(nowUs), (int32_t)t.limitMs(), (int32_t)t.p95Ms()});
+  metricsCount(CTR_RUN_JAMS);
+  endRun(c, RUN_JAMMED);
+  return IN_NONE;
+}
+
+static ChannelInput timeoutRun(Channel &c) {
+  emit(c, LOG_WARN, EV_RUN_TIMEOUT);
+  metricsCount(CTR_RUN_TIMEOUTS);
+  endRun(c, RUN_TIMEOUT);
+  return IN_NONE;
+}
+
+// A step outside a run counts towards the manual trigger
+static ChannelInput countPress(Channel &c) {
+  if (!ENABLE_MANUAL_TRIGGER) {
+    emit(c, LOG_DEBUG, EV_SWITCH_IGNORED);
+    return IN_NONE;
+  }
+  c.presses++;
+  emit(c, LOG_DEBUG, EV_SWITCH_EDGE, {c.presses});
+  if (c.presses < REQUIRED_PRESSES) return IN_NONE;
+  c.presses = 0;
+  return IN_PRESSES;
+}
+
+static ChannelInput startPulse(Channel &c) {
+  reportIdleWakes();
+  emit(c, LOG_INFO, EV_MANUAL_PULSE_START);
+  setRelay(c, true);
+  return IN_NONE;
+}
+
+static ChannelInput endPulse(Channel &c) {
+  setRelay(c, false);
+  emit(c, LOG_INFO, EV_MANUAL_PULSE_END);
+  return IN_NONE;
+}
+
+static ChannelInput pulseBusy(Channel &c) {
+  emit(c, LOG_INFO, EV_MANUAL_PULSE_ACTIVE);
+  return IN_NONE;
+}
+
+static ChannelInput manualBusy(Channel &c) {
+  emit(c, LOG_INFO, EV_MANUAL_BUSY);
+  return IN_NONE;
+}
+
+static ChannelInput manualCooldown(Channel &c) {
+  emit(c, LOG_DEBUG, EV_MANUAL_COOLDOWN);
+  return IN_NONE;
+}
+
+// Next state and action (may be null) per state and input
+struct Transition {
+  ChannelState next;
+  ChannelInput (*action)(Channel &c);
+};
+
+static const Transition TRANSITIONS[CH_STATE_COUNT][IN_COUNT] = {
+  // IN_NONE, IN_RUN, IN_STEP, IN_PRESSES, IN_DONE, IN_JAM, IN_TIMEOUT, IN_PULSE_END, IN_COOLDOWN_END
+  /* CH_IDLE */ {{CH_IDLE, nullptr}, {CH_RUN, startRun}, {CH_IDLE, countPress}, {CH_PULSE, startPulse},
+                 {CH_IDLE, nullptr}, {CH_IDLE, nullptr}, {CH_IDLE, nullptr}, {CH_IDLE, nullptr}, {CH_IDLE, nullptr}},
+  /* CH_RUN */ {{CH_RUN, nullptr}, {CH_RUN, runBusy}, {CH_RUN, countStep}, {CH_RUN, manualBusy},
+                {CH_COOLDOWN, completeRun}, {CH_COOLDOWN, jamRun}, {CH_COOLDOWN, timeoutRun}, {CH_RUN, nullptr},
+                {CH_RUN, nullptr}},
+  /* CH_PULSE */ {{CH_PULSE, nullptr}, {CH_RUN, startRun}, {CH_PULSE, countPress}, {CH_PULSE, pulseBusy},
+                  {CH_PULSE, nullptr}, {CH_PULSE, nullptr}, {CH_PULSE, nullptr}, {CH_COOLDOWN, endPulse},
+                  {CH_PULSE, nullptr}},
+  /* CH_COOLDOWN */ {{CH_COOLDOWN, nullptr}, {CH_RUN, startRun}, {CH_COOLDOWN, countPress},
+                     {CH_COOLDOWN, manualCooldown}, {CH_COOLDOWN, nullptr}, {CH_COOLDOWN, nullptr},
+                     {CH_COOLDOWN, nullptr}, {CH_COOLDOWN, nullptr}, {CH_IDLE, nullptr}},
+};
+
+// Feed input to c, and whatever its actions raise in turn
+static void dispatch(Channel &c, ChannelInput in) {
+  while (in != IN_NONE) {
+    const Transition &t = TRANSITIONS[c.state][in];
+    if (t.next != c.state) {
+      c.state = t.next;
+      c.sinceMs = hal::millis();
+    }
+    in = t.action ? t.action(c) : IN_NONE;
+  }
+}
+
+// The timer input that is due in c's state, IN_NONE if none
+static ChannelInput channelTimer(const Channel &c) {
+  uint32_t elapsed = hal::millis() - c.sinceMs;
+  switch (c.state) {
+    case CH_RUN:
+      // Jam: the step in progress takes longer than the entry's learned
+      // limit; the fixed timeout is the failsafe while none is learned yet
+      if (c.telemetry.jammed((uint32_t)hal::micros())) return IN_JAM;
+      return elapsed >= SCHEDULED_RUN_MAX_MS ? IN_TIMEOUT : IN_NONE;
+    case CH_PULSE:
+      return elapsed >= RELAY_PULSE_MS ? IN_PULSE_END : IN_NONE;
+    case CH_COOLDOWN:
+      return elapsed >= MOTOR_STOP_COOLDOWN_MS ? IN_COOLDOWN_END : IN_NONE;
+    default:
+      return IN_NONE;
+  }
+}
+
+// IN_RUN when the schedule engine's deadline says an entry is due.
+// Between deadlines this is a single compare against the monotonic clock.
+static ChannelInput checkSchedule(Channel &c) {
+  uint32_t nowMs = hal::millis();
+  if ((int32_t)(nowMs - c.engine.deadlineMs()) < 0) return IN_NONE;
+
+  uint32_t lateS;
+  int skipped;
+  int i = c.engine.poll(hal::epochNow(), nowMs, lateS, skipped);
+  if (skipped != ScheduleEngine::NONE) {
+    const ScheduleEntry &e = c.engine.entry(skipped);
+    emit(c, LOG_WARN, EV_SCHEDULE_MISSED, {e.hour, e.minute, (int32_t)lateS});
+  }
+  if (i == ScheduleEngine::NONE) return IN_NONE;
+  const ScheduleEntry &e = c.engine.entry(i);
+  if (lateS > 1) emit(c, LOG_WARN, EV_SCHEDULE_LATE, {e.hour, e.minute, (int32_t)lateS});
+  emit(c, LOG_INFO, EV_SCHEDULE_DUE, {e.hour, e.minute});
+  traceRecord(TR_FIRE, hal::micros(), i, (uint32_t)hal::epochNow(), channelOf(c));
+  c.pendingEntry = i;
+  c.pendingSteps = 0;
+  return IN_RUN;
+}
+
+// One channel's part of a pass
+static void updateChannel(Channel &c) {
+  // A cooldown that ran out ends first, so the inputs below see the channel idle
+  if (c.state == CH_COOLDOWN) dispatch(c, channelTimer(c));
+  {
+    MetricTimer t(HIST_SCHEDULE);
+    dispatch(c, checkSchedule(c));
+  }
+  // All edges captured since the last pass
+  {
+    MetricTimer t(HIST_SWITCH);
+    while (readSwitchRisingEdge(c)) dispatch(c, IN_STEP);
+  }
+  // Pulse end, jam and failsafe timeout
+  dispatch(c, channelTimer(c));
+}
+
+// Milliseconds left of a duration that started at `start` (millis()), 0 once over.
+static uint32_t msUntil(unsigned long start, unsigned long duration) {
+  unsigned long elapsed = hal::millis() - start;
+  return elapsed >= duration ? 0 : duration - elapsed;
+}
+
+// How long c has nothing to do without a switch edge or command (both wake
+// the task early). The end of a cooldown changes nothing outside, so it
+// needs no wake of its own; the next pass notices it.
+static uint32_t channelSleepMs(Channel &c) {
+  if (!c.edges.empty() || c.edgesOverflow) return 0;
+  int32_t scheduleLeft = (int32_t)(c.engine.deadlineMs() - hal::millis());
+  uint32_t sleepMs = scheduleLeft > 0 ? scheduleLeft : 0; // next schedule deadline
+  if (c.debouncer.settling()) {
+    uint32_t left = (c.debouncer.usUntilSettled((uint32_t)hal::micros()) + 999) / 1000;
+    if (left + 1 < sleepMs) sleepMs = left + 1;
+  }
+  if (c.state == CH_PULSE) {
+    uint32_t left = msUntil(c.sinceMs, RELAY_PULSE_MS);
+    if (left < sleepMs) sleepMs = left;
+  }
+  if (c.state == CH_RUN) {
+    uint32_t left = msUntil(c.sinceMs, SCHEDULED_RUN_MAX_MS);
+    if (left < sleepMs) sleepMs = left;
+    left = c.telemetry.msUntilJam((uint32_t)hal::micros());
+    if (left < sleepMs) sleepMs = left;
+  }
+  return sleepMs;
+}
+
+// --- Field trace (trace.h) ---
+static bool traceSnapshotPending = false;
+static bool traceFirst = true;                  // next snapshot is the first since reset
+static bool traceClockNoted = false;           // a TR_CLOCK was written since reset
+static int64_t traceClockOffsetMs = 0;          // epochMs() - micros() at the last TR_CLOCK
+
+static void traceClock(uint64_t nowUs) {
+  uint64_t epochMs = hal::epochMs();
+  traceRecord(TR_CLOCK, nowUs, 0, (uint32_t)(epochMs / 1000), epochMs % 1000);
+  traceClockOffsetMs = (int64_t)epochMs - (int64_t)(nowUs / 1000);
+  traceClockNoted = true;
+}
+
+static void traceSchedule(const Channel &c, uint64_t nowUs) {
+  if (!traceActive()) return;
+  uint8_t ch = channelOf(c);
+  for (uint8_t i = 0; i < c.engine.count(); ++i) {
+    uint32_t packed;
+    memcpy(&packed, &c.engine.entry(i), sizeof(packed));
+    traceRecord(TR_SCHEDULE_ENTRY, nowUs, i, packed, ch);
+  }
+  traceRecord(TR_SCHEDULE_COMMIT, nowUs, c.engine.count(), 0, ch);
+}
+
+// Once per pass: write a snapshot when one is due and nothing is moving,
+// and note wall clock adjustments (SNTP sync, slew, manual set).
+static void tracePoll() {
+  if (!traceActive()) return;
+  uint64_t nowUs = hal::micros();
+  if (traceSnapshotDue()) traceSnapshotPending = true;
+  bool quiet = !channelsBusy();
+  for (const Channel &c : channels) quiet = quiet && c.edges.empty();
+  if (traceSnapshotPending && quiet) {
+    traceSnapshotPending = false;
+    traceRecord(TR_START, nowUs, traceFirst, FEEDER_CHANNELS);
+    traceFirst = false;
+    traceClock(nowUs);
+    for (const Channel &c : channels) traceRecord(TR_SWITCH, nowUs, c.debouncer.closed(), 0, channelOf(c));
+    for (const Channel &c : channels) traceSchedule(c, nowUs);
+    return;
+  }
+  if (!traceClockNoted) {
+    traceClock(nowUs);
+    return;
+  }
+  int64_t driftMs = (int64_t)hal::epochMs() - (int64_t)(nowUs / 1000) - traceClockOffsetMs;
+  if (driftMs > (int64_t)TRACE_CLOCK_TOLERANCE_MS || driftMs < -(int64_t)TRACE_CLOCK_TOLERANCE_MS) traceClock(nowUs);
+}
+
+static void applyCommand(const FeederCommand &cmd) {
+  if (cmd.channel >= FEEDER_CHANNELS) return;
+  Channel &c = channels[cmd.channel];
+  switch (cmd.type) {
+    case CMD_SET_SCHEDULE_ENTRY:
+      if (cmd.index >= MAX_SCHEDULE_ENTRIES) break;
+      c.staged[cmd.index] = cmd.entry;
+      break;
+    case CMD_COMMIT_SCHEDULE:
+      // Step times are learned per entry; start over where the slot changed
+      for (uint8_t i = 0; i < cmd.index && i < MAX_SCHEDULE_ENTRIES; ++i) {
+        if (i >= c.engine.count() || memcmp(&c.engine.entry(i), &c.staged[i], sizeof(ScheduleEntry))) {
+          c.telemetry.resetModel(i);
+        }
+      }
+      c.engine.setEntries(c.staged, cmd.index, hal::millis());
+      traceSchedule(c, hal::micros());
+      break;
+    case CMD_FEED:
+      if (cmd.index == 0) break;
+      emit(c, LOG_INFO, EV_FEED_REQUESTED, {cmd.index});
+      traceRecord(TR_FEED, hal::micros(), cmd.index, 0, cmd.channel);
+      c.pendingEntry = -1;
+      c.pendingSteps = cmd.index;
+      dispatch(c, IN_RUN); // EV_RUN_BUSY if the motor is already running
+      break;
+  }
+}
+
+static void publishStatus() {
+  FeederStatus status[FEEDER_CHANNELS];
+  memset(status, 0, sizeof(status));
+  for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+    const Channel &c = channels[ch];
+    FeederStatus &s = status[ch];
+    bool run = c.state == CH_RUN;
+    s.relayActive = c.relayOn;
+    s.motorRunActive = run;
+    s.runEntry = run ? c.entry : -1;
+    s.steps = run ? c.steps : 0;
+    s.stepsWanted = run ? c.stepsWanted : 0;
+    s.nextEntry = -1;
+    for (uint8_t i = 0; i < c.engine.count(); ++i) {
+      time_t t = c.engine.nextFire(i);
+      if (t > 0 && (s.nextFireEpoch == 0 || (uint32_t)t < s.nextFireEpoch)) {
+        s.nextFireEpoch = (uint32_t)t;
+        s.nextEntry = i;
+      }
+    }
+  }
+  statusLock.lock();
+  memcpy(publishedStatus, status, sizeof(status));
+  statusLock.unlock();
+}
+
+// Events wake the service task; this is only the fallback period.
+const uint32_t FEEDER_SERVICE_POLL_MS = 1000;
+
+uint32_t feederLoop(const hal::ControlWake &wake) {
+  MetricTimer passTimer(HIST_CONTROL_PASS);
+  if (wake.reason != hal::WAKE_REQUEST) metricsRecord(HIST_CONTROL_WAKE, wake.latencyUs);
+  reportWake(wake);
+  tracePoll();
+
+  FeederCommand cmd;
+  while (feederCommands.pop(cmd)) applyCommand(cmd);
+
+  bool switchClosed = false;
+  for (Channel &c : channels) {
+    updateChannel(c);
+    switchClosed = switchClosed || c.debouncer.closed();
+  }
+  // LED reflects the stable switch states
+  boardLed(switchClosed);
+  publishStatus();
+
+  uint32_t sleepMs = UINT32_MAX;
+  for (Channel &c : channels) {
+    uint32_t left = channelSleepMs(c);
+    if (left < sleepMs) sleepMs = left;
+  }
+  return sleepMs;
+}
+
+uint8_t feederRunHistory(uint8_t channel, RunRecord *out, uint8_t max) {
+  return channel < FEEDER_CHANNELS ? channels[channel].telemetry.history(out, max) : 0;
+}
+
+void feederStepModels(uint8_t channel, StepModel *out, uint8_t count) {
+  if (channel < FEEDER_CHANNELS) channels[channel].telemetry.models(out, count);
+}
+
+DebounceStats feederSwitchStats(uint8_t channel) {
+  return channel < FEEDER_CHANNELS ? channels[channel].debouncer.stats() : DebounceStats();
+}
+
+FeederStatus feederStatus(uint8_t channel) {
+  FeederStatus s;
+  memset(&s, 0, sizeof(s));
+  s.runEntry = s.nextEntry = -1;
+  if (channel >= FEEDER_CHANNELS) return s;
+  statusLock.lock();
+  s = publishedStatus[channel];
+  statusLock.unlock();
+  return s;
+}
+
+bool feederPostCommand(const FeederCommand &cmd) {
+  if (!feederCommands.push(cmd)) return false;
+  hal::wakeControl();
+  return true;
+}
+
+void feederStartService() {
+  if (serviceWorker >= 0) return;
+  serviceWorker = hal::startPeriodic("feederEvents", feederService, FEEDER_SERVICE_POLL_MS);
+  if (serviceWorker < 0) logEvent(LOG_ERROR, EV_TASK_START_FAILED, {}, "feederEvents");
+}
+
+void feederService() {
+  MetricTimer t(HIST_EVENT_SERVICE);
+  ControlEvent e;
+  while (controlEvents.pop(e)) {
+    // Checks the level itself
+    logEventAt(e.epoch, (LogLevel)e.level, (LogEvent)e.event, e.args, e.argc, nullptr, e.channel);
+    streamEvent(e);
+  }
+  uint32_t dropped = controlEventsDropped.exchange(0, std::memory_order_relaxed);
+  if (dropped) logEvent(LOG_WARN, EV_CONTROL_EVENTS_DROPPED, {(int32_t)dropped});
+  traceFlushPoll();
+}
+
+// Older firmware kept the schedule as separate keys in the "schedule"
+// namespace (n, h<i>, m<i>, s<i>, w<i>). Read them into c; false if absent.
+static bool loadLegacySchedule(ChannelSettings &c) {
+  const uint32_t MISSING = UINT32_MAX;
+  uint32_t n = hal::nvsGetUInt("schedule", "n", MISSING);
+  if (n == MISSING) return false;
+  c.scheduleCount = n > MAX_SCHEDULE_ENTRIES ? MAX_SCHEDULE_ENTRIES : n;
+  char key[5];
+  for (int i = 0; i < c.scheduleCount; ++i) {
+    // Entries beyond the built-in defaults start out as 08:00 every day
+    ScheduleEntry def = i < 3 ? c.schedule[i] : ScheduleEntry{8, 0, STEPS_PER_RUN, ALL_WEEKDAYS};
+    snprintf(key, sizeof(key), "h%d", i);
+    c.schedule[i].hour = hal::nvsGetUInt("schedule", key, def.hour);
+    snprintf(key, sizeof(key), "m%d", i);
+    c.schedule[i].minute = hal::nvsGetUInt("schedule", key, def.minute);
+    snprintf(key, sizeof(key), "s%d", i);
+    c.schedule[i].steps = hal::nvsGetUInt("schedule", key, def.steps);
+    snprintf(key, sizeof(key), "w%d", i);
+    c.schedule[i].weekdays = hal::nvsGetUInt("schedule", key, def.weekdays);
+  }
+  return true;
+}
+
+// As loaded; saves change only this board's channels and keep the rest for
+// a profile with more of them
+static Settings storedSettings;
+
+void loadScheduleFromPrefs() {
+  Settings &s = storedSettings;
+  settingsDefaults(s);
+  SettingsLoadResult result = settingsLoad(s);
+  if (result == SETTINGS_INVALID) {
+    logEvent(LOG_ERROR, EV_SETTINGS_INVALID);
+  } else if (result == SETTINGS_MISSING && loadLegacySchedule(s.channels[0])) {
+    // Drop the old keys only once the blob is safely written
+    if (settingsSave(s) == SETTINGS_SAVED) {
+      hal::nvsClear("schedule");
+      logEvent(LOG_INFO, EV_SETTINGS_MIGRATED, {s.channels[0].scheduleCount});
+    } else {
+      logEvent(LOG_ERROR, EV_SETTINGS_WRITE_FAILED);
+    }
+  }
+  for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+    scheduleCount[ch] = s.channels[ch].scheduleCount;
+    memcpy(schedule[ch], s.channels[ch].schedule, sizeof(schedule[ch]));
+    // Runs before the control task starts, so no command needed yet
+    channels[ch].engine.setEntries(schedule[ch], scheduleCount[ch], hal::millis());
+  }
+  publishStatus(); // until the first pass
+}
+
+SettingsSaveResult saveScheduleToPrefs() {
+  Settings s = storedSettings;
+  for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+    ChannelSettings &c = s.channels[ch];
+    c.scheduleCount = scheduleCount[ch];
+    memset(c.schedule, 0, sizeof(c.schedule));
+    memcpy(c.schedule, schedule[ch], scheduleCount[ch] * sizeof(ScheduleEntry));
+  }
+  SettingsSaveResult result = settingsSave(s);
+  if (result == SETTINGS_WRITE_FAILED) logEvent(LOG_ERROR, EV_SETTINGS_WRITE_FAILED);
+  else storedSettings = s;
+  return result;
+}
+
+bool postScheduleToControl(uint8_t channel) {
+  if (channel >= FEEDER_CHANNELS) return false;
+  for (uint8_t i = 0; i < scheduleCount[channel]; ++i) {
+    FeederCommand cmd = {CMD_SET_SCHEDULE_ENTRY, channel, i, schedule[channel][i]};
+    if (!feederPostCommand(cmd)) return false;
+  }
+  return feederPostCommand({CMD_COMMIT_SCHEDULE, channel, scheduleCount[channel], {}});
+}
@@ -0,0 +1,78 @@
+#include "form.h"
+
+#include <string.h>
+
+bool FormView::is(const char *s) const {
+  return strlen(s) == len && memcmp(data, s, len) == 0;
+}
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Decode [from, to) onto itself and terminate it; returns the decoded length.
+static size_t decodeInPlace(char *from, char *to, bool &malformed) {
+  char *out = from;
+  for (char *in = from; in < to; ++in) {
+    if (*in == '+') {
+      *out++ = ' ';
+    } else if (*in == '%' && to - in > 2 && hexDigit(in[1]) >= 0 && hexDigit(in[2]) >= 0) {
+      *out++ = (char)(hexDigit(in[1]) << 4 | hexDigit(in[2]));
+      in += 2;
+    } else {
+      if (*in == '%') malformed = true;
+      *out++ = *in;
+    }
+  }
+  *out = '\0';
+  return out - from;
+}
+
+bool FormReader::next(FormView &key, FormView &value) {
+  while (p_ < end_) {
+    char *field = p_;
+    char *amp = (char *)memchr(field, '&', end_ - field);
+    char *stop = amp ? amp : end_;
+    p_ = amp ? amp + 1 : end_;
+    if (stop == field) continue;
+    char *eq = (char *)memchr(field, '=', stop - field);
+    char *keyEnd = eq ? eq : stop;
+    // Value first: decoding the key writes its terminator over the '='
+    char *val = eq ? eq + 1 : stop;
+    value.len = decodeInPlace(val, stop, malformed_);
+    value.data = val;
+    key.len = decodeInPlace(field, keyEnd, malformed_);
+    key.data = field;
+    return true;
+  }
+  return false;
+}
+
+bool formUInt(const FormView &v, uint32_t min, uint32_t max, uint32_t &out) {
+  if (v.len == 0 || v.len > 9) return false; // 9 digits can't overflow
+  uint32_t n = 0;
+  for (size_t i = 0; i < v.len; ++i) {
+    if (v.data[i] < '0' || v.data[i] > '9') return false;
+    n = n * 10 + (v.data[i] - '0');
+  }
+  if (n < min || n > max) return false;
+  out = n;
+  return true;
+}
+
+bool formHourMinute(const FormView &v, uint8_t &hour, uint8_t &minute) {
+  const char *colon = (const char *)memchr(v.data, ':', v.len);
+  if (!colon) return false;
+  size_t hourLen = colon - v.data;
+  size_t rest = v.len - hourLen - 1;
+  if (hourLen < 1 || hourLen > 2 || (rest != 2 && !(rest == 5 && colon[3] == ':'))) return false;
+  uint32_t h, m, s;
+  if (!formUInt({v.data, hourLen}, 0, 23, h) || !formUInt({colon + 1, 2}, 0, 59, m)) return false;
+  if (rest == 5 && !formUInt({colon + 4, 2}, 0, 59, s)) return false;
+  hour = (uint8_t)h;
+  minute = (uint8_t)m;
+  return true;
+}
@@ -0,0 +1,122 @@
+#include "json.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+void JsonOut::write(const char *s, size_t n) {
+  // Part of [pos_, pos_ + n) inside the window [from_, from_ + len_)
+  size_t start = pos_ > from_ ? pos_ : from_;
+  size_t stop = pos_ + n < from_ + len_ ? pos_ + n : from_ + len_;
+  if (buf_ && start < stop) {
+    memcpy(buf_ + (start - from_), s + (start - pos_), stop - start);
+    copied_ += stop - start;
+  }
+  pos_ += n;
+}
+
+void JsonOut::print(const char *s) {
+  write(s, strlen(s));
+}
+
+void JsonOut::printf(const char *fmt, ...) {
+  char piece[JSON_MAX_PIECE];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(piece, sizeof(piece), fmt, ap);
+  va_end(ap);
+  if (n > 0) write(piece, (size_t)n < sizeof(piece) ? n : sizeof(piece) - 1);
+}
+
+void JsonIn::skipSpace() {
+  while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\r' || *p_ == '\n')) p_++;
+}
+
+bool JsonIn::consume(char c) {
+  skipSpace();
+  if (p_ == end_ || *p_ != c) return false;
+  p_++;
+  return true;
+}
+
+bool JsonIn::key(char *buf, size_t len) {
+  if (!consume('"')) return false;
+  size_t n = 0;
+  while (p_ < end_ && *p_ != '"') {
+    if (*p_ == '\\' || n + 1 >= len) return false;
+    buf[n++] = *p_++;
+  }
+  if (p_ == end_) return false;
+  p_++;
+  buf[n] = '\0';
+  return consume(':');
+}
+
+bool JsonIn::uint(uint32_t &out) {
+  skipSpace();
+  uint32_t n = 0;
+  int digits = 0;
+  while (p_ < end_ && *p_ >= '0' && *p_ <= '9') {
+    if (++digits > 9) return false; // 9 digits can't overflow
+    n = n * 10 + (*p_++ - '0');
+  }
+  // 1.5 or 1e3 is not an integer
+  if (digits == 0 || (p_ < end_ && (*p_ == '.' || *p_ == 'e' || *p_ == 'E'))) return false;
+  out = n;
+  return true;
+}
+
+bool JsonIn::skipString() {
+  // Opening quote already taken
+  while (p_ < end_) {
+    char c = *p_++;
+    if (c == '"') return true;
+    if (c == '\\') {
+      if (p_ == end_) return false;
+      p_++;
+    }
+  }
+  return false;
+}
+
+bool JsonIn::skipValue() {
+  return skipValue(0);
+}
+
+bool JsonIn::skipValue(int depth) {
+  if (depth > JSON_MAX_DEPTH) return false;
+  skipSpace();
+  if (p_ == end_) return false;
+  if (consume('"')) return skipString();
+  char open = *p_;
+  if (open == '{' || open == '[') {
+    char close = open == '{' ? '}' : ']';
+    p_++;
+    if (consume(close)) return true;
+    do {
+      if (open == '{') {
+        if (!consume('"') || !skipString() || !consume(':')) return false;
+      }
+      if (!skipValue(depth + 1)) return false;
+    } while (consume(','));
+    return consume(close);
+  }
+  // Number, true, false or null
+  const char *start = p_;
+  while (p_ < end_ && ((*p_ && strchr("+-.eE", *p_)) || (*p_ >= '0' && *p_ <= '9') || (*p_ >= 'a' && *p_ <= 'z'))) p_++;
+  return p_ > start;
+}
+
+bool JsonIn::atEnd() {
+  skipSpace();
+  return p_ == end_;
+}
+
+uint32_t jsonHash(const void *data, size_t len, uint32_t hash) {
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= p[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
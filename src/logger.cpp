@@ -0,0 +1,662 @@
+#include "logger.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+#include "metrics.h"
+#include "wall_clock.h"
+
+// On-flash / in-RAM record layout (little endian, byte aligned):
+//   uint32 time      clockStamp(): epoch seconds, uptime seconds before the sync
+//   uint8  magic     LOG_RECORD_MAGIC, lets the reader stop at a torn write
+//   uint8  flags     bits 0-1 level, 2-3 channel, 4-6 argument count,
+//                    7 set if bits 2-3 hold a channel (older records: clear)
+//   uint8  event     LogEvent
+//   uint8  textLen   bytes of text after the arguments
+//   int32  args[argc]
+//   char   text[textLen]
+const uint8_t LOG_RECORD_MAGIC = 0xA5;
+const size_t LOG_HEADER_SIZE = 8;
+const size_t LOG_MAX_RECORD = LOG_HEADER_SIZE + LOG_MAX_ARGS * 4 + LOG_MAX_TEXT;
+const uint8_t LOG_LEVEL_MASK = 0x03;
+const uint8_t LOG_CHANNEL_SHIFT = 2;
+const uint8_t LOG_ARGC_SHIFT = 4;
+const uint8_t LOG_HAS_CHANNEL = 0x80;
+static_assert(LOG_ERROR <= LOG_LEVEL_MASK && LOG_MAX_ARGS <= 7 && LOG_MAX_CHANNELS <= 4, "record flags byte");
+
+static uint8_t recordFlags(LogLevel level, uint8_t argc, int8_t channel) {
+  uint8_t flags = (uint8_t)((argc << LOG_ARGC_SHIFT) | (level & LOG_LEVEL_MASK));
+  if (channel >= 0 && channel < LOG_MAX_CHANNELS) flags |= LOG_HAS_CHANNEL | (channel << LOG_CHANNEL_SHIFT);
+  return flags;
+}
+static uint8_t recordLevel(const uint8_t *hdr) { return hdr[5] & LOG_LEVEL_MASK; }
+static uint8_t recordArgc(const uint8_t *hdr) { return (hdr[5] >> LOG_ARGC_SHIFT) & 0x07; }
+static int recordChannel(const uint8_t *hdr) {
+  return hdr[5] & LOG_HAS_CHANNEL ? (hdr[5] >> LOG_CHANNEL_SHIFT) & 0x03 : -1;
+}
+
+#define LOG_EVENT_FMT(id, fmt) fmt,
+static const char *const LOG_EVENT_FORMATS[LOG_EVENT_COUNT] = { LOG_EVENTS(LOG_EVENT_FMT) };
+#undef LOG_EVENT_FMT
+
+static const char *const LOG_LEVEL_NAMES[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+std::atomic<uint8_t> logRuntimeLevel{LOG_DEFAULT_LEVEL};
+
+// Ring state. head/tail are free-running byte counters; the ring index is
+// counter % LOG_RING_SIZE. Producers (loop, WiFi event task, ...) only append
+// whole records at head under logMux; the flusher is the only consumer and
+// advances tail.
+static uint8_t logRing[LOG_RING_SIZE];
+static uint32_t logHead = 0;
+static uint32_t logTail = 0;
+static unsigned long logOldestPendingMs = 0;
+static uint32_t logDropped = 0;           // total since boot
+static uint32_t logDroppedUnreported = 0; // not yet noted in the file
+static bool logUptimePending = false;     // records stamped before the clock synced
+static hal::SpinLock logLock;
+
+// Serialises flushing/rotation against readers of the log files.
+static hal::Mutex logFileMutex;
+static int logFlushWorker = -1;
+static uint32_t logRotations = 0; // lets LogReader follow renamed files
+
+// Index of one log file. Mark m describes the segment from its offset up to
+// the next mark (or the end of the file).
+struct LogMark {
+  uint32_t offset;        // first record of the segment in the file
+  uint32_t textOffset;    // where that record starts in the file's rendered text
+  uint32_t maxTime;       // newest timestamp in the segment
+  uint16_t levelCount[4]; // records per level in the segment
+};
+struct LogFileIndex {
+  LogMark marks[LOG_INDEX_MAX_MARKS];
+  uint8_t markCount;
+  uint32_t bytes;     // end of the last indexed record
+  uint32_t textBytes; // rendered length of all indexed records
+  uint32_t records;
+  uint32_t minTime;
+  uint32_t maxTime;
+};
+// By rotation number like the files (0 = /log.bin); under logFileMutex.
+static LogFileIndex logIndex[LOG_ROTATE_COUNT + 1];
+static ClockFormatter indexClock; // under logFileMutex too
+
+// Only has to catch LOG_FLUSH_MAX_AGE_MS; the threshold path wakes the task
+// directly. Kept long so the idle CPU can sleep.
+const unsigned long LOG_FLUSH_POLL_MS = 1000;
+
+// Counters wrap at 2^32, so the ring size must divide it evenly.
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+
+// Copy len bytes into the ring at counter pos, handling wrap-around.
+static void ringCopyIn(uint32_t pos, const uint8_t *src, size_t len) {
+  size_t idx = pos % LOG_RING_SIZE;
+  size_t first = LOG_RING_SIZE - idx;
+  if (first > len) first = len;
+  memcpy(logRing + idx, src, first);
+  if (len > first) memcpy(logRing, src + first, len - first);
+}
+
+// Copy len bytes out of the ring starting at counter pos, handling wrap-around.
+static void ringCopyOut(uint32_t pos, uint8_t *dst, size_t len) {
+  size_t idx = pos % LOG_RING_SIZE;
+  size_t first = LOG_RING_SIZE - idx;
+  if (first > len) first = len;
+  memcpy(dst, logRing + idx, first);
+  if (len > first) memcpy(dst + first, logRing, len - first);
+}
+
+// Validate a record header and return the body size (args + text), or -1.
+static int recordBodySize(const uint8_t *hdr) {
+  if (hdr[4] != LOG_RECORD_MAGIC) return -1;
+  uint8_t argc = recordArgc(hdr);
+  // Channel bits without the flag were a level above LOG_ERROR before
+  bool strayChannel = !(hdr[5] & LOG_HAS_CHANNEL) && (hdr[5] & (0x03 << LOG_CHANNEL_SHIFT));
+  if (strayChannel || argc > LOG_MAX_ARGS || hdr[6] >= LOG_EVENT_COUNT || hdr[7] > LOG_MAX_TEXT) return -1;
+  return argc * 4 + hdr[7];
+}
+
+// Render one complete record as "[timestamp] [LEVEL] message\n", with
+// "[chN] " before the message for a channel's record.
+// outLen must be at least LOG_MAX_LINE.
+static size_t renderRecord(const uint8_t *rec, ClockFormatter &clock, char *out, size_t outLen) {
+  uint32_t epoch;
+  memcpy(&epoch, rec, 4);
+  uint8_t level = recordLevel(rec);
+  uint8_t argc = recordArgc(rec);
+  int channel = recordChannel(rec);
+  const char *fmt = LOG_EVENT_FORMATS[rec[6]];
+  uint8_t textLen = rec[7];
+  int32_t a[LOG_MAX_ARGS] = {0};
+  memcpy(a, rec + LOG_HEADER_SIZE, argc * 4);
+  char text[LOG_MAX_TEXT + 1];
+  memcpy(text, rec + LOG_HEADER_SIZE + argc * 4, textLen);
+  text[textLen] = '\0';
+
+  char ts[CLOCK_TEXT_LEN];
+  clock.format(epoch, ts);
+  int n = channel < 0 ? snprintf(out, outLen, "[%s] [%s] ", ts, LOG_LEVEL_NAMES[level])
+                      : snprintf(out, outLen, "[%s] [%s] [ch%d] ", ts, LOG_LEVEL_NAMES[level], channel + 1);
+  // Formats consume exactly argc integers, then optionally the text.
+  int m;
+  switch (argc) {
+    case 0: m = snprintf(out + n, outLen - n, fmt, text); break;
+    case 1: m = snprintf(out + n, outLen - n, fmt, a[0], text); break;
+    case 2: m = snprintf(out + n, outLen - n, fmt, a[0], a[1], text); break;
+    case 3: m = snprintf(out + n, outLen - n, fmt, a[0], a[1], a[2], text); break;
+    default: m = snprintf(out + n, outLen - n, fmt, a[0], a[1], a[2], a[3], text); break;
+  }
+  if (m > 0) n += m;
+  if ((size_t)n > outLen - 2) n = outLen - 2;
+  out[n++] = '\n';
+  out[n] = '\0';
+  return n;
+}
+
+// Add a record at file offset `offset` to the index. A record that does not
+// follow the last indexed one (after a torn write) starts a new mark, so
+// readers can resync there.
+static void indexRecord(LogFileIndex &ix, uint32_t offset, const uint8_t *rec) {
+  uint32_t size = LOG_HEADER_SIZE + recordBodySize(rec);
+  uint32_t epoch;
+  memcpy(&epoch, rec, 4);
+  bool newMark = ix.markCount == 0 || offset != ix.bytes ||
+                 offset - ix.marks[ix.markCount - 1].offset >= LOG_INDEX_STRIDE;
+  if (newMark && ix.markCount < LOG_INDEX_MAX_MARKS) {
+    ix.marks[ix.markCount++] = {offset, ix.textBytes, epoch, {0, 0, 0, 0}};
+  }
+  LogMark &m = ix.marks[ix.markCount - 1];
+  if (epoch > m.maxTime) m.maxTime = epoch;
+  m.levelCount[recordLevel(rec)]++;
+  char line[LOG_MAX_LINE];
+  ix.textBytes += renderRecord(rec, indexClock, line, sizeof(line));
+  ix.bytes = offset + size;
+  if (ix.records == 0 || epoch < ix.minTime) ix.minTime = epoch;
+  if (epoch > ix.maxTime) ix.maxTime = epoch;
+  ix.records++;
+}
+
+// Build the index of rotation file i by reading it once (at boot).
+static void indexFile(int i, const char *name) {
+  LogFileIndex &ix = logIndex[i];
+  ix = LogFileIndex();
+  hal::File f = hal::filesystem().open(name, FILE_READ);
+  if (!f) return;
+  uint8_t rec[LOG_MAX_RECORD];
+  uint32_t offset = 0;
+  while (f.read(rec, LOG_HEADER_SIZE) == LOG_HEADER_SIZE) {
+    int body = recordBodySize(rec);
+    if (body < 0 || (body > 0 && f.read(rec + LOG_HEADER_SIZE, body) != (size_t)body)) break;
+    indexRecord(ix, offset, rec);
+    offset += LOG_HEADER_SIZE + body;
+  }
+  f.close();
+}
+
+// First mark of rotation file i after offset, UINT32_MAX if none.
+static uint32_t nextMarkOffset(int i, uint32_t offset) {
+  const LogFileIndex &ix = logIndex[i];
+  for (uint8_t m = 0; m < ix.markCount; ++m) {
+    if (ix.marks[m].offset > offset) return ix.marks[m].offset;
+  }
+  return UINT32_MAX;
+}
+
+void logEventNow(LogLevel level, LogEvent event, const int32_t *args, uint8_t argc, const char *text, int8_t channel) {
+  logEventAt(clockStamp(), level, event, args, argc, text, channel);
+}
+
+void logText(LogLevel level, const char *fmt, ...) {
+  if (!logEnabled(level)) return;
+  char text[LOG_MAX_TEXT + 1];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(text, sizeof(text), fmt, ap);
+  va_end(ap);
+  logEventNow(level, EV_TEXT, nullptr, 0, text);
+}
+
+void logEventAt(uint32_t epoch, LogLevel level, LogEvent event, const int32_t *args, uint8_t argc, const char *text,
+                int8_t channel) {
+  if (!logEnabled(level)) return;
+  epoch = clockFixStamp(epoch); // queued before the sync, logged after it
+  uint8_t rec[LOG_MAX_RECORD];
+  if (argc > LOG_MAX_ARGS) argc = LOG_MAX_ARGS;
+  size_t textLen = text ? strlen(text) : 0;
+  if (textLen > LOG_MAX_TEXT) textLen = LOG_MAX_TEXT;
+  memcpy(rec, &epoch, 4);
+  rec[4] = LOG_RECORD_MAGIC;
+  rec[5] = recordFlags(level, argc, channel);
+  rec[6] = event;
+  rec[7] = (uint8_t)textLen;
+  size_t len = LOG_HEADER_SIZE;
+  if (argc) {
+    memcpy(rec + len, args, argc * 4);
+    len += argc * 4;
+  }
+  if (textLen) {
+    memcpy(rec + len, text, textLen);
+    len += textLen;
+  }
+
+  // Write to serial
+  char line[LOG_MAX_LINE];
+  ClockFormatter clock;
+  renderRecord(rec, clock, line, sizeof(line));
+  hal::consoleWrite(line);
+
+  bool wake = false;
+  logLock.lock();
+  uint32_t pending = logHead - logTail;
+  if (len > LOG_RING_SIZE - pending) {
+    logDropped++;
+    logDroppedUnreported++;
+  } else {
+    ringCopyIn(logHead, rec, len);
+    if (pending == 0) logOldestPendingMs = hal::millis();
+    logHead += len;
+    if (clockIsUptime(epoch)) logUptimePending = true;
+    wake = pending < LOG_FLUSH_THRESHOLD && (pending + len) >= LOG_FLUSH_THRESHOLD;
+  }
+  logLock.unlock();
+
+  if (wake && logFlushWorker >= 0) hal::wakePeriodic(logFlushWorker);
+}
+
+bool logLevelFromName(const char *name, LogLevel &level) {
+  for (uint8_t i = 0; i <= LOG_ERROR; ++i) {
+    if (strcmp(name, LOG_LEVEL_NAMES[i]) == 0) {
+      level = (LogLevel)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *logLevelName(LogLevel level) {
+  return level <= LOG_ERROR ? LOG_LEVEL_NAMES[level] : "?";
+}
+
+void logSetLevel(LogLevel level) {
+  if (level < LOG_COMPILE_LEVEL) level = (LogLevel)LOG_COMPILE_LEVEL;
+  if (level > LOG_ERROR) level = LOG_ERROR;
+  if (level == logRuntimeLevel.load(std::memory_order_relaxed)) return;
+  logRuntimeLevel.store(level, std::memory_order_relaxed);
+  hal::nvsPutUInt("log", "level", level);
+}
+
+LogLevel logLevel() {
+  return (LogLevel)logRuntimeLevel.load(std::memory_order_relaxed);
+}
+
+// Name of rotation file i (0 = current), e.g. "/log.2.bin".
+static const char *logFileName(int i, char *buf, size_t len) {
+  if (i == 0) snprintf(buf, len, "/log.bin");
+  else snprintf(buf, len, "/log.%d.bin", i);
+  return buf;
+}
+
+// rotate: /log.3.bin <- /log.2.bin <- /log.1.bin <- /log.bin
+static void rotateLogs() {
+  hal::FileSystem &fs = hal::filesystem();
+  char src[16], dst[16];
+  for (int i = LOG_ROTATE_COUNT; i >= 1; --i) {
+    logFileName(i - 1, src, sizeof(src));
+    logFileName(i, dst, sizeof(dst));
+    if (fs.exists(dst)) fs.remove(dst);
+    if (fs.exists(src) && fs.rename(src, dst)) metricsCount(CTR_FS_RENAMES);
+    logIndex[i] = logIndex[i - 1];
+  }
+  logIndex[0] = LogFileIndex();
+  logRotations++;
+}
+
+// Give the records between tail and head that were stamped with uptime
+// their epoch time. The region is stable: producers only write beyond head.
+static void fixUptimeStamps(uint32_t tail, uint32_t head) {
+  uint8_t hdr[LOG_HEADER_SIZE];
+  for (uint32_t pos = tail; pos != head;) {
+    ringCopyOut(pos, hdr, LOG_HEADER_SIZE);
+    uint32_t stamp;
+    memcpy(&stamp, hdr, 4);
+    uint32_t fixed = clockFixStamp(stamp);
+    if (fixed != stamp) ringCopyIn(pos, (const uint8_t *)&fixed, 4);
+    pos += LOG_HEADER_SIZE + recordBodySize(hdr);
+  }
+}
+
+// Append everything between tail and head to /log.bin with a single
+// open/write/close, then rotate if the file has grown past MAX_LOG_SIZE.
+// Caller holds logFileMutex.
+static void flushPendingLocked() {
+  bool synced = clockSynced();
+  logLock.lock();
+  uint32_t tail = logTail;
+  uint32_t head = logHead;
+  uint32_t dropped = logDroppedUnreported;
+  logDroppedUnreported = 0;
+  bool fixStamps = logUptimePending && synced;
+  if (fixStamps) logUptimePending = false;
+  logLock.unlock();
+
+  if (head == tail && dropped == 0) return;
+  if (fixStamps) fixUptimeStamps(tail, head);
+
+  hal::File f = hal::filesystem().open("/log.bin", FILE_APPEND);
+  if (!f) {
+    hal::consoleWrite("ERROR: failed to open log file for appending\n");
+    // Keep the records in RAM and retry on the next flush.
+    logLock.lock();
+    logDroppedUnreported += dropped;
+    logLock.unlock();
+    return;
+  }
+  uint32_t base = f.size();
+  if (dropped > 0) {
+    uint8_t note[LOG_HEADER_SIZE + 4];
+    uint32_t now = clockStamp();
+    int32_t count = (int32_t)dropped;
+    memcpy(note, &now, 4);
+    note[4] = LOG_RECORD_MAGIC;
+    note[5] = recordFlags(LOG_WARN, 1, LOG_NO_CHANNEL);
+    note[6] = EV_LOG_DROPPED;
+    note[7] = 0;
+    memcpy(note + LOG_HEADER_SIZE, &count, 4);
+    if (f.write(note, sizeof(note)) == sizeof(note)) {
+      indexRecord(logIndex[0], base, note);
+      base += sizeof(note);
+      metricsCount(CTR_FS_WRITE_BYTES, sizeof(note));
+    }
+  }
+  // The pending region is stable: producers only write beyond head.
+  size_t idx = tail % LOG_RING_SIZE;
+  size_t len = head - tail;
+  size_t first = LOG_RING_SIZE - idx;
+  if (first > len) first = len;
+  size_t written = f.write(logRing + idx, first);
+  if (len > first) written += f.write(logRing, len - first);
+  metricsCount(CTR_FS_WRITES);
+  metricsCount(CTR_FS_WRITE_BYTES, written);
+  if (written != len) {
+    hal::consoleWrite("ERROR: failed to write to log file\n");
+  } else {
+    uint8_t rec[LOG_MAX_RECORD];
+    for (uint32_t pos = tail; pos != head;) {
+      ringCopyOut(pos, rec, LOG_HEADER_SIZE);
+      size_t body = recordBodySize(rec);
+      ringCopyOut(pos + LOG_HEADER_SIZE, rec + LOG_HEADER_SIZE, body);
+      indexRecord(logIndex[0], base + (pos - tail), rec);
+      pos += LOG_HEADER_SIZE + body;
+    }
+  }
+  size_t size = f.size();
+  f.close();
+
+  logLock.lock();
+  logTail = head;
+  logOldestPendingMs = hal::millis();
+  logLock.unlock();
+
+  if (size >= MAX_LOG_SIZE) rotateLogs();
+}
+
+// Periodic flusher body: flush if the threshold or the age limit is reached.
+// Right after boot the age limit waits for the clock, so the boot records
+// get their epoch time before they go to flash.
+static void logFlushPoll() {
+  bool holdForClock = hal::millis() < LOG_UNSYNCED_HOLD_MS && !clockSynced();
+  logLock.lock();
+  uint32_t pending = logHead - logTail;
+  bool due = pending >= LOG_FLUSH_THRESHOLD ||
+             logDroppedUnreported > 0 ||
+             (pending > 0 && !holdForClock && (hal::millis() - logOldestPendingMs) >= LOG_FLUSH_MAX_AGE_MS);
+  logLock.unlock();
+  if (!due) return;
+  MetricTimer t(HIST_LOG_FLUSH);
+  logFileMutex.lock();
+  flushPendingLocked();
+  logFileMutex.unlock();
+}
+
+void logInit() {
+  if (logFlushWorker >= 0) return;
+  uint32_t level = hal::nvsGetUInt("log", "level", LOG_DEFAULT_LEVEL);
+  if (level < LOG_COMPILE_LEVEL) level = LOG_COMPILE_LEVEL;
+  if (level <= LOG_ERROR) logRuntimeLevel.store(level, std::memory_order_relaxed);
+  // Text logs from older firmware would only eat into the flash budget
+  hal::FileSystem &fs = hal::filesystem();
+  char legacy[16];
+  for (int i = 0; i <= LOG_ROTATE_COUNT; ++i) {
+    if (i == 0) snprintf(legacy, sizeof(legacy), "/log.txt");
+    else snprintf(legacy, sizeof(legacy), "/log.%d.txt", i);
+    if (fs.exists(legacy)) fs.remove(legacy);
+  }
+  char name[16];
+  logFileMutex.lock();
+  for (int i = 0; i <= LOG_ROTATE_COUNT; ++i) indexFile(i, logFileName(i, name, sizeof(name)));
+  logFileMutex.unlock();
+  logFlushWorker = hal::startPeriodic("logFlush", logFlushPoll, LOG_FLUSH_POLL_MS);
+  // Records still reach flash through logFlush() and logTextSize()
+  if (logFlushWorker < 0) logEvent(LOG_ERROR, EV_TASK_START_FAILED, {}, "logFlush");
+}
+
+void logFlush() {
+  logFileMutex.lock();
+  flushPendingLocked();
+  logFileMutex.unlock();
+}
+
+uint32_t logDroppedCount() {
+  return logDropped;
+}
+
+static size_t logPendingBytes() {
+  logLock.lock();
+  size_t pending = logHead - logTail;
+  logLock.unlock();
+  return pending;
+}
+
+bool logAvailable() {
+  if (logPendingBytes() > 0) return true;
+  char name[16];
+  logFileMutex.lock();
+  bool any = false;
+  for (int i = LOG_ROTATE_COUNT; i >= 0 && !any; --i) {
+    any = hal::filesystem().exists(logFileName(i, name, sizeof(name)));
+  }
+  logFileMutex.unlock();
+  return any;
+}
+
+uint32_t logTextSize(uint32_t &rotations) {
+  logFileMutex.lock();
+  flushPendingLocked();
+  uint32_t size = 0;
+  for (int i = 0; i <= LOG_ROTATE_COUNT; ++i) size += logIndex[i].textBytes;
+  rotations = logRotations;
+  logFileMutex.unlock();
+  return size;
+}
+
+// Hand out what is left of the current line; returns bytes copied.
+size_t LogReader::drainLine(char *buf, size_t len) {
+  size_t n = lineLen_ - lineOff_;
+  if (n > len) n = len;
+  memcpy(buf, line_ + lineOff_, n);
+  lineOff_ += n;
+  return n;
+}
+
+// Files keep their content but move up one index per rotation; data pushed
+// past LOG_ROTATE_COUNT is gone, so continue with the oldest file left.
+void LogReader::followRotations() {
+  if (rotations_ == logRotations) return;
+  file_ += logRotations - rotations_;
+  rotations_ = logRotations;
+  if (file_ > LOG_ROTATE_COUNT) {
+    file_ = LOG_ROTATE_COUNT;
+    offset_ = 0;
+  }
+}
+
+// Records at or above minLevel in a segment
+static uint32_t levelMatches(const LogMark &m, LogLevel minLevel) {
+  uint32_t n = 0;
+  for (int l = minLevel; l <= LOG_ERROR; ++l) n += m.levelCount[l];
+  return n;
+}
+
+// Pick the first file and offset to read from the index alone. Caller holds
+// logFileMutex.
+void LogReader::seekToQuery() {
+  file_ = LOG_ROTATE_COUNT;
+  offset_ = 0;
+  if (query_.rangeStart > 0) {
+    uint32_t target = query_.rangeStart;
+    while (file_ > 0 && target >= logIndex[file_].textBytes) target -= logIndex[file_--].textBytes;
+    const LogFileIndex &ix = logIndex[file_];
+    int m = ix.markCount - 1;
+    while (m > 0 && ix.marks[m].textOffset > target) --m;
+    if (m >= 0) {
+      offset_ = ix.marks[m].offset;
+      target -= ix.marks[m].textOffset;
+    }
+    skipText_ = target;
+    return;
+  }
+  if (query_.tail > 0) {
+    // Walk segments from the newest until they hold enough records
+    uint32_t found = 0;
+    for (int i = 0; i <= LOG_ROTATE_COUNT; ++i) {
+      const LogFileIndex &ix = logIndex[i];
+      for (int m = ix.markCount - 1; m >= 0; --m) {
+        found += levelMatches(ix.marks[m], query_.minLevel);
+        if (found >= query_.tail) {
+          file_ = i;
+          offset_ = ix.marks[m].offset;
+          skipMatches_ = found - query_.tail;
+          return;
+        }
+      }
+    }
+  }
+  if (query_.since > 0) {
+    // First segment holding anything that new, oldest file first
+    for (int i = LOG_ROTATE_COUNT; i >= 0; --i) {
+      const LogFileIndex &ix = logIndex[i];
+      if (ix.records == 0 || ix.maxTime < query_.since) continue;
+      for (uint8_t m = 0; m < ix.markCount; ++m) {
+        if (ix.marks[m].maxTime >= query_.since) {
+          file_ = i;
+          offset_ = ix.marks[m].offset;
+          return;
+        }
+      }
+    }
+    // Nothing on flash is that new; only records written from now on qualify
+    file_ = 0;
+    offset_ = logIndex[0].bytes;
+  }
+}
+
+// Level/time filter for one record; also consumes the records in front of
+// the tail.
+bool LogReader::wanted(const uint8_t *rec) {
+  if (recordLevel(rec) < query_.minLevel) return false;
+  if (skipMatches_ > 0) {
+    skipMatches_--;
+    return false;
+  }
+  uint32_t epoch;
+  memcpy(&epoch, rec, 4);
+  return epoch >= query_.since;
+}
+
+// Caller holds logFileMutex.
+void LogReader::startLocked() {
+  started_ = true;
+  flushPendingLocked();
+  rotations_ = startRotations_ = logRotations;
+  if (query_.rotations != LOG_ANY_ROTATIONS && query_.rotations != logRotations) {
+    done_ = true;
+    return;
+  }
+  seekToQuery();
+}
+
+bool LogReader::start() {
+  logFileMutex.lock();
+  if (!started_) startLocked();
+  bool ok = !done_;
+  logFileMutex.unlock();
+  return ok;
+}
+
+size_t LogReader::read(char *buf, size_t len) {
+  if (len > query_.rangeLen) len = query_.rangeLen;
+  size_t n = drainLine(buf, len);
+  if (done_ || n == len) {
+    query_.rangeLen -= n;
+    return n;
+  }
+
+  logFileMutex.lock();
+  if (!started_) startLocked();
+  followRotations();
+  hal::FileSystem &fs = hal::filesystem();
+  char name[16];
+  uint8_t rec[LOG_MAX_RECORD];
+  while (n < len && !done_) {
+    hal::File f = fs.open(logFileName(file_, name, sizeof(name)), FILE_READ);
+    bool more = f && f.seek(offset_);
+    while (more && n < len) {
+      if (f.read(rec, LOG_HEADER_SIZE) != LOG_HEADER_SIZE) break;
+      int body = recordBodySize(rec);
+      if (body < 0 || (body > 0 && f.read(rec + LOG_HEADER_SIZE, body) != (size_t)body)) {
+        // Invalid or torn record: resync at the next mark, if any
+        offset_ = nextMarkOffset(file_, offset_);
+        more = offset_ != UINT32_MAX && f.seek(offset_);
+        continue;
+      }
+      offset_ += LOG_HEADER_SIZE + body;
+      if (!wanted(rec)) continue;
+      lineLen_ = renderRecord(rec, clock_, line_, sizeof(line_));
+      lineOff_ = 0;
+      if (skipText_ > 0) {
+        lineOff_ = skipText_ < lineLen_ ? skipText_ : lineLen_;
+        skipText_ -= lineOff_;
+      }
+      n += drainLine(buf + n, len - n);
+    }
+    if (f) f.close();
+    if (n == len) break;
+    // End of this file
+    if (file_ > 0) {
+      file_--;
+      offset_ = 0;
+    } else if (!flushed_) {
+      // Move the records still in RAM into /log.bin and read on from there
+      flushed_ = true;
+      flushPendingLocked();
+      followRotations();
+    } else {
+      done_ = true;
+    }
+  }
+  logFileMutex.unlock();
+  query_.rangeLen -= n;
+  return n;
+}
+
+bool logRenderText(const std::function<void(const char *, size_t)> &sink) {
+  if (!logAvailable()) return false;
+  LogReader reader;
+  char buf[1024];
+  size_t n;
+  while ((n = reader.read(buf, sizeof(buf))) > 0) sink(buf, n);
+  return true;
+}
@@ -0,0 +1,99 @@
+#include "metrics.h"
+
+#include <stdio.h>
+
+#include "logger.h"
+
+#define METRIC_NAME(id, name, help) name,
+#define METRIC_HELP(id, name, help) help,
+static const char *const HISTOGRAM_NAMES[METRIC_HISTOGRAM_COUNT] = { METRIC_HISTOGRAMS(METRIC_NAME) };
+static const char *const HISTOGRAM_HELP[METRIC_HISTOGRAM_COUNT] = { METRIC_HISTOGRAMS(METRIC_HELP) };
+static const char *const COUNTER_NAMES[METRIC_COUNTER_COUNT] = { METRIC_COUNTERS(METRIC_NAME) };
+static const char *const COUNTER_HELP[METRIC_COUNTER_COUNT] = { METRIC_COUNTERS(METRIC_HELP) };
+#undef METRIC_NAME
+#undef METRIC_HELP
+
+static Histogram histograms[METRIC_HISTOGRAM_COUNT];
+static uint32_t counters[METRIC_COUNTER_COUNT] = {0};
+
+// Smallest i with us <= 2^i, the last bucket takes everything above.
+static uint8_t bucketFor(uint32_t us) {
+  uint8_t i = us <= 1 ? 0 : 32 - __builtin_clz(us - 1);
+  return i < METRIC_BUCKETS - 1 ? i : METRIC_BUCKETS - 1;
+}
+
+void Histogram::record(uint32_t us) {
+  buckets_[bucketFor(us)]++;
+  count_++;
+  sum_ += us;
+  if (us > max_) max_ = us;
+}
+
+uint32_t Histogram::quantile(float q) const {
+  if (count_ == 0) return 0;
+  uint32_t rank = (uint32_t)(q * count_ + 0.999f);
+  if (rank == 0) rank = 1;
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < METRIC_BUCKETS - 1; ++i) {
+    seen += buckets_[i];
+    if (seen >= rank) return (1UL << i) < max_ ? (1UL << i) : max_;
+  }
+  return max_;
+}
+
+void metricsRecord(MetricHistogram h, uint32_t us) {
+  histograms[h].record(us);
+}
+
+void metricsCount(MetricCounter c, uint32_t n) {
+  counters[c] += n;
+}
+
+void metricsRender(const std::function<void(const char *, size_t)> &sink) {
+  char line[256];
+  auto emit = [&](int n) { sink(line, n < (int)sizeof(line) ? n : sizeof(line) - 1); };
+
+  for (uint8_t h = 0; h < METRIC_HISTOGRAM_COUNT; ++h) {
+    const Histogram &hist = histograms[h];
+    const char *name = HISTOGRAM_NAMES[h];
+    emit(snprintf(line, sizeof(line), "# HELP katzefroh_%s %s\n# TYPE katzefroh_%s histogram\n",
+                  name, HISTOGRAM_HELP[h], name));
+    uint32_t cumulative = 0;
+    for (uint8_t i = 0; i < METRIC_BUCKETS - 1; ++i) {
+      cumulative += hist.bucket(i);
+      emit(snprintf(line, sizeof(line), "katzefroh_%s_bucket{le=\"%lu\"} %u\n",
+                    name, 1UL << i, (unsigned)cumulative));
+    }
+    emit(snprintf(line, sizeof(line), "katzefroh_%s_bucket{le=\"+Inf\"} %u\nkatzefroh_%s_sum %llu\nkatzefroh_%s_count %u\n",
+                  name, (unsigned)hist.count(), name, (unsigned long long)hist.sum(), name, (unsigned)hist.count()));
+    emit(snprintf(line, sizeof(line), "# TYPE katzefroh_%s_p50 gauge\nkatzefroh_%s_p50 %u\n",
+                  name, name, (unsigned)hist.quantile(0.5f)));
+    emit(snprintf(line, sizeof(line), "# TYPE katzefroh_%s_p99 gauge\nkatzefroh_%s_p99 %u\n",
+                  name, name, (unsigned)hist.quantile(0.99f)));
+    emit(snprintf(line, sizeof(line), "# TYPE katzefroh_%s_max gauge\nkatzefroh_%s_max %u\n",
+                  name, name, (unsigned)hist.max()));
+  }
+
+  for (uint8_t c = 0; c < METRIC_COUNTER_COUNT; ++c) {
+    emit(snprintf(line, sizeof(line), "# HELP katzefroh_%s %s\n# TYPE katzefroh_%s counter\nkatzefroh_%s %u\n",
+                  COUNTER_NAMES[c], COUNTER_HELP[c], COUNTER_NAMES[c], COUNTER_NAMES[c], (unsigned)counters[c]));
+  }
+
+  hal::HeapStats heap = hal::heapStats();
+  hal::FlashStats flash = hal::flashStats();
+  struct Value { const char *name; const char *type; const char *help; uint32_t value; };
+  const Value values[] = {
+    {"heap_free_bytes", "gauge", "Free heap", heap.freeBytes},
+    {"heap_largest_free_block_bytes", "gauge", "Largest allocatable heap block", heap.largestFreeBlock},
+    {"heap_min_free_bytes", "gauge", "Lowest free heap since boot", heap.minFreeBytes},
+    {"heap_allocations_total", "counter", "Heap allocations (malloc/calloc/realloc) since boot", hal::heapAllocations()},
+    {"flash_programmed_bytes_total", "counter", "Bytes programmed on the storage partition, backend metadata included", flash.programmedBytes},
+    {"flash_erased_bytes_total", "counter", "Bytes erased on the storage partition", flash.erasedBytes},
+    {"uptime_seconds", "gauge", "Time since boot", (uint32_t)(hal::micros() / 1000000)},
+    {"log_dropped_records_total", "counter", "Log records dropped because the RAM ring was full", logDroppedCount()},
+  };
+  for (const Value &v : values) {
+    emit(snprintf(line, sizeof(line), "# HELP katzefroh_%s %s\n# TYPE katzefroh_%s %s\nkatzefroh_%s %u\n",
+                  v.name, v.help, v.name, v.type, v.name, (unsigned)v.value));
+  }
+}
@@ -0,0 +1,338 @@
+// hal.h for the native build: in-memory GPIO, NVS and filesystem on a
+// virtual clock. Single-threaded, so the locks are no-ops and background
+// work runs from advance().
+
+#include "hal.h"
+#include "hal_native.h"
+#include "ring_fs.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace hal {
+
+static uint64_t virtualUs = 0;
+static uint64_t epochBaseMs = 0;
+static int pins[40] = {0};
+static bool driven[40] = {false}; // level set from outside, pulls don't change it
+static bool consoleEcho = false;
+static EdgeSink edgeSinks[40] = {nullptr};
+static uint8_t edgeTags[40] = {0};
+static uint8_t retained[RETAINED_BYTES] = {0}; // a simulation starts as after a power cut
+static std::map<std::string, uint32_t> nvsUInts;
+static std::map<std::string, std::vector<uint8_t>> nvsBlobs;
+static FlashStats flashCounters = {};
+
+struct Periodic {
+  PeriodicFn fn;
+  uint32_t periodMs;
+  uint64_t nextUs;
+};
+static std::vector<Periodic> periodics;
+
+uint32_t millis() { return (uint32_t)(virtualUs / 1000); }
+uint64_t micros() { return virtualUs; }
+time_t epochNow() { return (time_t)(epochMs() / 1000); }
+uint64_t epochMs() { return epochBaseMs + virtualUs / 1000; }
+void setEpochMs(uint64_t epochMs) { epochBaseMs = epochMs - virtualUs / 1000; }
+
+size_t retainedGet(void *buf, size_t len) {
+  if (len > RETAINED_BYTES) len = RETAINED_BYTES;
+  memcpy(buf, retained, len);
+  return len;
+}
+
+void retainedPut(const void *buf, size_t len) {
+  if (len > RETAINED_BYTES) len = RETAINED_BYTES;
+  memcpy(retained, buf, len);
+}
+
+// Like the chip: an input with a pull resistor idles at its level until
+// something drives it (setPin()); other modes keep the level as it is.
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin >= 40 || driven[pin]) return;
+  if (mode == INPUT_PULLUP) pins[pin] = HIGH;
+  else if (mode == INPUT_PULLDOWN) pins[pin] = LOW;
+}
+int digitalRead(uint8_t pin) { return pin < 40 ? pins[pin] : LOW; }
+void digitalWrite(uint8_t pin, int level) {
+  if (pin < 40) pins[pin] = level;
+}
+
+void captureEdges(uint8_t pin, EdgeSink sink, uint8_t tag) {
+  if (pin >= 40) return;
+  edgeSinks[pin] = sink;
+  edgeTags[pin] = tag;
+}
+
+void consoleWrite(const char *text) {
+  if (consoleEcho) fputs(text, stdout);
+}
+
+static std::string nvsKey(const char *ns, const char *key) {
+  return std::string(ns) + "/" + key;
+}
+
+uint32_t nvsGetUInt(const char *ns, const char *key, uint32_t def) {
+  auto it = nvsUInts.find(nvsKey(ns, key));
+  return it == nvsUInts.end() ? def : it->second;
+}
+
+void nvsPutUInt(const char *ns, const char *key, uint32_t value) {
+  nvsUInts[nvsKey(ns, key)] = value;
+}
+
+size_t nvsGetBlob(const char *ns, const char *key, void *buf, size_t len) {
+  auto it = nvsBlobs.find(nvsKey(ns, key));
+  if (it == nvsBlobs.end()) return 0;
+  if (it->second.size() <= len) memcpy(buf, it->second.data(), it->second.size());
+  return it->second.size();
+}
+
+bool nvsPutBlob(const char *ns, const char *key, const void *buf, size_t len) {
+  const uint8_t *p = (const uint8_t *)buf;
+  nvsBlobs[nvsKey(ns, key)] = std::vector<uint8_t>(p, p + len);
+  return true;
+}
+
+template <typename Map>
+static void eraseNamespace(Map &map, const std::string &prefix) {
+  for (auto it = map.begin(); it != map.end();) {
+    if (it->first.compare(0, prefix.size(), prefix) == 0) it = map.erase(it);
+    else ++it;
+  }
+}
+
+void nvsClear(const char *ns) {
+  std::string prefix = std::string(ns) + "/";
+  eraseNamespace(nvsUInts, prefix);
+  eraseNamespace(nvsBlobs, prefix);
+}
+
+HeapStats heapStats() { return {}; }
+uint32_t heapAllocations() { return 0; }
+
+void SpinLock::lock() {}
+void SpinLock::unlock() {}
+Mutex::Mutex() {}
+void Mutex::lock() {}
+void Mutex::unlock() {}
+
+// Same limit as on target, so a task too many shows up in the simulation
+int startPeriodic(const char *name, PeriodicFn fn, uint32_t periodMs, uint32_t) {
+  if (periodics.size() >= (size_t)MAX_PERIODIC) {
+    fprintf(stderr, "startPeriodic(%s): all %d slots taken\n", name, MAX_PERIODIC);
+    return -1;
+  }
+  periodics.push_back({fn, periodMs, virtualUs + periodMs * 1000ULL});
+  return (int)periodics.size() - 1;
+}
+
+void wakePeriodic(int handle) {
+  if (handle >= 0 && handle < (int)periodics.size()) periodics[handle].nextUs = virtualUs;
+}
+
+void setPeriod(int handle, uint32_t periodMs) {
+  if (handle >= 0 && handle < (int)periodics.size()) periodics[handle].periodMs = periodMs;
+}
+
+void startControlTask(ControlFn) {}
+ControlStats controlStats(bool) { return {}; }
+void wakeControl() {}
+void wakeControlFromIsr() {}
+void enableIdleSleep() {}
+
+// --- In-memory filesystem (STORAGE_SPIFFS, STORAGE_LITTLEFS) ---
+
+class MemFile : public FileImpl {
+ public:
+  MemFile(std::shared_ptr<std::vector<uint8_t>> data, bool append)
+      : data_(std::move(data)), pos_(append ? data_->size() : 0), append_(append) {}
+
+  size_t read(uint8_t *buf, size_t len) override {
+    if (pos_ >= data_->size()) return 0;
+    size_t n = data_->size() - pos_;
+    if (n > len) n = len;
+    memcpy(buf, data_->data() + pos_, n);
+    pos_ += n;
+    return n;
+  }
+
+  size_t write(const uint8_t *buf, size_t len) override {
+    if (append_) pos_ = data_->size();
+    if (pos_ + len > data_->size()) data_->resize(pos_ + len);
+    memcpy(data_->data() + pos_, buf, len);
+    pos_ += len;
+    flashCounters.programmedBytes += len;
+    return len;
+  }
+
+  size_t size() override { return data_->size(); }
+
+  bool seek(size_t pos) override {
+    if (pos > data_->size()) return false;
+    pos_ = pos;
+    return true;
+  }
+
+ private:
+  std::shared_ptr<std::vector<uint8_t>> data_;
+  size_t pos_;
+  bool append_;
+};
+
+class MemFs : public FileSystem {
+ public:
+  File open(const char *path, const char *mode) override {
+    auto it = files_.find(path);
+    if (mode[0] == 'r') {
+      if (it == files_.end()) return File();
+      return File(std::make_shared<MemFile>(it->second, false));
+    }
+    if (it == files_.end() || mode[0] == 'w') {
+      files_[path] = std::make_shared<std::vector<uint8_t>>();
+      it = files_.find(path);
+    }
+    return File(std::make_shared<MemFile>(it->second, mode[0] == 'a'));
+  }
+
+  bool exists(const char *path) override { return files_.count(path) > 0; }
+
+  bool remove(const char *path) override { return files_.erase(path) > 0; }
+
+  bool rename(const char *from, const char *to) override {
+    auto it = files_.find(from);
+    if (it == files_.end()) return false;
+    files_[to] = it->second;
+    files_.erase(from);
+    return true;
+  }
+
+  void clear() { files_.clear(); }
+
+ private:
+  std::map<std::string, std::shared_ptr<std::vector<uint8_t>>> files_;
+};
+
+// --- Raw flash (STORAGE_RING) ---
+
+// NOR flash the size of the "spiffs" partition in the default 4 MB layout.
+// Program and erase charge typical datasheet times (W25Q32) to the virtual
+// clock, without running background work. Programming a 0 bit back to 1
+// fails instead of silently ANDing, so ring_fs mistakes show up.
+class SimFlash : public FlashPartition {
+ public:
+  static const size_t SIZE = 0x160000;
+  static const size_t PAGE_SIZE = 256;
+  static const uint32_t PROGRAM_US = 30;          // first byte of a page program ...
+  static const uint32_t PROGRAM_BYTE_NS = 2500;   // ... and each one after it
+  static const uint32_t SECTOR_ERASE_US = 45000;
+
+  size_t size() const override { return SIZE; }
+
+  bool read(size_t offset, void *buf, size_t len) override {
+    if (offset + len > SIZE) return false;
+    init();
+    memcpy(buf, mem_.data() + offset, len);
+    return true;
+  }
+
+  bool write(size_t offset, const void *buf, size_t len) override {
+    if (offset + len > SIZE) return false;
+    init();
+    const uint8_t *src = (const uint8_t *)buf;
+    for (size_t i = 0; i < len; ++i) {
+      if ((mem_[offset + i] & src[i]) != src[i]) return false;
+    }
+    for (size_t i = 0; i < len; ++i) mem_[offset + i] &= src[i];
+    // One page program per page touched
+    for (size_t at = offset; at < offset + len;) {
+      size_t n = PAGE_SIZE - at % PAGE_SIZE;
+      if (n > offset + len - at) n = offset + len - at;
+      virtualUs += PROGRAM_US + (n - 1) * PROGRAM_BYTE_NS / 1000;
+      at += n;
+    }
+    flashCounters.programmedBytes += len;
+    return true;
+  }
+
+  bool erase(size_t offset, size_t len) override {
+    if (offset % FLASH_SECTOR_SIZE || len % FLASH_SECTOR_SIZE || offset + len > SIZE) return false;
+    init();
+    memset(mem_.data() + offset, 0xFF, len);
+    virtualUs += len / FLASH_SECTOR_SIZE * SECTOR_ERASE_US;
+    flashCounters.erasedBytes += len;
+    return true;
+  }
+
+ private:
+  void init() {
+    if (mem_.empty()) mem_.assign(SIZE, 0xFF);
+  }
+
+  std::vector<uint8_t> mem_;
+};
+
+static MemFs memFs;
+static SimFlash simFlash;
+static RingFs ringFs(simFlash);
+static FileSystem *mountedFs = &memFs;
+
+bool mountFilesystem(StorageBackend backend, bool format) {
+  if (backend == STORAGE_RING) {
+    if (!(format ? ringFs.format() : ringFs.mount())) return false;
+    mountedFs = &ringFs;
+    return true;
+  }
+  if (format) memFs.clear();
+  mountedFs = &memFs;
+  return true;
+}
+
+FileSystem &filesystem() { return *mountedFs; }
+
+FlashStats flashStats() { return flashCounters; }
+
+namespace native {
+
+void setEpoch(time_t epoch) { epochBaseMs = (uint64_t)epoch * 1000; }
+void setEpochMs(uint64_t epochMs) { epochBaseMs = epochMs; }
+
+void advance(uint32_t ms) { advanceUs(ms * 1000ULL); }
+
+void advanceUs(uint64_t us) {
+  virtualUs += us;
+  for (Periodic &p : periodics) {
+    if (p.nextUs <= virtualUs) {
+      p.nextUs = virtualUs + p.periodMs * 1000ULL;
+      p.fn();
+    }
+  }
+}
+
+uint64_t nowUs() { return virtualUs; }
+
+void setPin(uint8_t pin, int level) {
+  if (pin >= 40) return;
+  driven[pin] = true;
+  if (pins[pin] == level) return;
+  pins[pin] = level;
+  // Deliver the edge like the GPIO interrupt would
+  if (edgeSinks[pin]) edgeSinks[pin](edgeTags[pin], (uint32_t)virtualUs, level);
+}
+
+int pinLevel(uint8_t pin) { return pin < 40 ? pins[pin] : LOW; }
+
+void setConsoleEcho(bool on) { consoleEcho = on; }
+
+size_t fileSize(const char *path) {
+  File f = filesystem().open(path, FILE_READ);
+  return f ? f.size() : 0;
+}
+
+}  // namespace native
+}  // namespace hal
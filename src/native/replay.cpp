@@ -0,0 +1,252 @@
+// Trace replay, see replay.h.
+
+#include "replay.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "feeder.h"
+#include "hal.h"
+#include "hal_native.h"
+#include "logger.h"
+#include "trace.h"
+
+// A relay change or schedule fire, recorded or replayed.
+struct ReplayEvent {
+  uint64_t us;      // virtual time (from the segment's TR_START)
+  uint64_t epochMs; // wall clock at that moment
+  uint8_t type;     // TR_RELAY or TR_FIRE
+  uint8_t arg;      // relay on/off, entry index
+  uint8_t channel;
+};
+
+static std::vector<ReplayEvent> replayed;
+
+static void captureRecord(const TraceRecord &r) {
+  if (r.type == TR_RELAY || r.type == TR_FIRE) replayed.push_back({r.us, hal::epochMs(), r.type, r.arg, (uint8_t)r.aux});
+}
+
+static bool loadTrace(const std::vector<const char *> &files, std::vector<TraceRecord> &out) {
+  for (const char *path : files) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+      fprintf(stderr, "replay: cannot open %s\n", path);
+      return false;
+    }
+    TraceRecord r;
+    while (fread(&r, sizeof(r), 1, f) == 1) out.push_back(r); // a torn last record is ignored
+    fclose(f);
+  }
+  return true;
+}
+
+static const char *formatEpochMs(uint64_t epochMs, char *buf, size_t len) {
+  time_t t = (time_t)(epochMs / 1000);
+  struct tm tm;
+  localtime_r(&t, &tm);
+  size_t n = strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+  snprintf(buf + n, len - n, ".%03u", (unsigned)(epochMs % 1000));
+  return buf;
+}
+
+static const char *describe(const ReplayEvent &e, char *buf, size_t len) {
+  if (e.type == TR_RELAY) snprintf(buf, len, "relay %s", e.arg ? "on" : "off");
+  else snprintf(buf, len, "fire entry %u", e.arg);
+  return buf;
+}
+
+// Pair recorded and replayed events of one type and channel in order;
+// returns mismatches.
+static int compareTimelines(uint8_t type, uint8_t channel, const std::vector<ReplayEvent> &rec,
+                            const std::vector<ReplayEvent> &rep, uint32_t toleranceMs, bool verbose,
+                            uint32_t &maxDeltaMs) {
+  std::vector<ReplayEvent> a, b;
+  for (const ReplayEvent &e : rec) if (e.type == type && e.channel == channel) a.push_back(e);
+  for (const ReplayEvent &e : rep) if (e.type == type && e.channel == channel) b.push_back(e);
+  int mismatches = 0;
+  char when[32], what[24];
+  for (size_t i = 0; i < a.size() || i < b.size(); ++i) {
+    if (i >= a.size() || i >= b.size()) {
+      const ReplayEvent &e = i < a.size() ? a[i] : b[i];
+      printf("  %s  %-13s  %s only  MISMATCH\n", formatEpochMs(e.epochMs, when, sizeof(when)),
+             describe(e, what, sizeof(what)), i < a.size() ? "recorded" : "replayed");
+      mismatches++;
+      continue;
+    }
+    int64_t deltaMs = ((int64_t)b[i].us - (int64_t)a[i].us) / 1000;
+    uint32_t absDelta = (uint32_t)(deltaMs < 0 ? -deltaMs : deltaMs);
+    bool match = a[i].arg == b[i].arg && absDelta <= toleranceMs;
+    if (absDelta > maxDeltaMs) maxDeltaMs = absDelta;
+    if (!match) mismatches++;
+    if (!match || verbose) {
+      char other[24];
+      printf("  %s  %-13s  replayed %-13s %+6lld ms%s\n", formatEpochMs(a[i].epochMs, when, sizeof(when)),
+             describe(a[i], what, sizeof(what)), describe(b[i], other, sizeof(other)), (long long)deltaMs,
+             match ? "" : "  MISMATCH");
+    }
+  }
+  char label[32];
+  snprintf(label, sizeof(label), "%s", type == TR_RELAY ? "relay changes" : "schedule fires");
+  if (FEEDER_CHANNELS > 1) snprintf(label + strlen(label), sizeof(label) - strlen(label), " ch%u", channel + 1);
+  printf("%s: %zu recorded, %zu replayed, %d mismatched (max |delta| %u ms)\n", label, a.size(), b.size(),
+         mismatches, maxDeltaMs);
+  return mismatches;
+}
+
+int replayTrace(const ReplayOptions &o) {
+  std::vector<TraceRecord> trace;
+  if (!loadTrace(o.files, trace)) return 2;
+
+  // Segment: from the chosen snapshot up to the next reset
+  std::vector<size_t> starts;
+  for (size_t i = 0; i < trace.size(); ++i) {
+    if (trace[i].type == TR_START) starts.push_back(i);
+  }
+  if (o.segment < 0 || (size_t)o.segment >= starts.size()) {
+    fprintf(stderr, "replay: %zu records, %zu snapshots - no snapshot %d\n", trace.size(), starts.size(), o.segment);
+    return 2;
+  }
+  size_t begin = starts[o.segment];
+  size_t end = begin + 1;
+  while (end < trace.size() && !(trace[end].type == TR_START && trace[end].arg)) end++;
+
+  // The snapshot: clock, switch levels and schedules as of TR_START, one
+  // commit per channel of the recording
+  const uint64_t t0 = trace[begin].us;
+  const uint32_t snapChannels = trace[begin].value ? trace[begin].value : 1;
+  if (snapChannels > FEEDER_CHANNELS) {
+    printf("warning: recorded with %u channels, replaying %u; the others are ignored\n", (unsigned)snapChannels,
+           (unsigned)FEEDER_CHANNELS);
+  }
+  uint64_t epochMs = 0;
+  bool closed[FEEDER_CHANNELS] = {};
+  static ScheduleEntry staged[FEEDER_CHANNELS][MAX_SCHEDULE_ENTRIES];
+  memset(staged, 0, sizeof(staged));
+  uint32_t commits = 0;
+  size_t i = begin + 1;
+  for (; i < end && commits < snapChannels; ++i) {
+    const TraceRecord &r = trace[i];
+    bool mine = r.aux < FEEDER_CHANNELS; // TR_CLOCK uses aux for ms
+    if (r.type == TR_CLOCK) epochMs = (uint64_t)r.value * 1000 + r.aux - (r.us - t0) / 1000;
+    else if (r.type == TR_SWITCH && mine) closed[r.aux] = r.arg & 1;
+    else if (r.type == TR_SCHEDULE_ENTRY && mine && r.arg < MAX_SCHEDULE_ENTRIES) {
+      memcpy(&staged[r.aux][r.arg], &r.value, sizeof(ScheduleEntry));
+    } else if (r.type == TR_SCHEDULE_COMMIT) {
+      commits++;
+      if (!mine) continue;
+      scheduleCount[r.aux] = r.arg > MAX_SCHEDULE_ENTRIES ? MAX_SCHEDULE_ENTRIES : r.arg;
+      memcpy(schedule[r.aux], staged[r.aux], sizeof(schedule[r.aux]));
+    }
+  }
+  if (commits < snapChannels) {
+    fprintf(stderr, "replay: snapshot %d is incomplete\n", o.segment);
+    return 2;
+  }
+
+  // Recorded inputs in time order (edges are stamped by the interrupt, so
+  // they can be older than records written before them in the same pass)
+  std::vector<TraceRecord> events(trace.begin() + i, trace.begin() + end);
+  std::stable_sort(events.begin(), events.end(),
+                   [](const TraceRecord &a, const TraceRecord &b) { return a.us < b.us; });
+
+  char when[32];
+  printf("replay: snapshot %d of %zu (%s) at %s, %zu records\n", o.segment, starts.size(),
+         trace[begin].arg ? "after reset" : "after rotation", formatEpochMs(epochMs, when, sizeof(when)),
+         events.size());
+
+  hal::native::setEpochMs(epochMs);
+  for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+    hal::native::setPin(Board::switchPin(ch), closed[ch] ? Board::SWITCH_CLOSED_LEVEL : !Board::SWITCH_CLOSED_LEVEL);
+  }
+  logInit();
+  setupPins();
+  traceCapture(captureRecord);
+  for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) postScheduleToControl(ch);
+
+  std::vector<ReplayEvent> recorded;
+  uint32_t gaps = 0, resyncs = 0;
+  uint32_t snapshotCommits = 0; // of a later snapshot (rotation) still to come
+  bool wakeNow = true, edge = false;
+  uint64_t dueUs = 0;
+  size_t k = 0;
+  // Keep going a little past the last record so a run in progress can end
+  const uint64_t endUs = (events.empty() ? 0 : events.back().us - t0) + SCHEDULED_RUN_MAX_MS * 1000ULL;
+  for (;;) {
+    uint64_t nowUs = hal::native::nowUs();
+    for (; k < events.size() && events[k].us - t0 <= nowUs; ++k) {
+      const TraceRecord &r = events[k];
+      switch (r.type) {
+        case TR_START:
+          snapshotCommits = r.value ? r.value : 1; // state the replay already has
+          break;
+        case TR_SWITCH:
+          if (r.aux >= FEEDER_CHANNELS) break;
+          if (r.arg & 2) resyncs++;
+          hal::native::setPin(Board::switchPin(r.aux),
+                              (r.arg & 1) ? Board::SWITCH_CLOSED_LEVEL : !Board::SWITCH_CLOSED_LEVEL);
+          wakeNow = edge = true;
+          break;
+        case TR_CLOCK:
+          hal::native::setEpochMs((uint64_t)r.value * 1000 + r.aux - nowUs / 1000);
+          break;
+        case TR_SCHEDULE_ENTRY:
+          if (!snapshotCommits && r.aux < FEEDER_CHANNELS && r.arg < MAX_SCHEDULE_ENTRIES) {
+            memcpy(&staged[r.aux][r.arg], &r.value, sizeof(ScheduleEntry));
+          }
+          break;
+        case TR_SCHEDULE_COMMIT:
+          if (snapshotCommits) {
+            snapshotCommits--;
+            break;
+          }
+          if (r.aux >= FEEDER_CHANNELS) break;
+          scheduleCount[r.aux] = r.arg > MAX_SCHEDULE_ENTRIES ? MAX_SCHEDULE_ENTRIES : r.arg;
+          memcpy(schedule[r.aux], staged[r.aux], sizeof(schedule[r.aux]));
+          postScheduleToControl(r.aux);
+          wakeNow = true;
+          break;
+        case TR_RELAY:
+        case TR_FIRE:
+          recorded.push_back({r.us - t0, hal::epochMs(), r.type, r.arg, (uint8_t)r.aux});
+          break;
+        case TR_DROPPED:
+          gaps++;
+          break;
+        case TR_FEED:
+          feederPostCommand({CMD_FEED, (uint8_t)r.aux, r.arg, {}});
+          wakeNow = true;
+          break;
+      }
+    }
+
+    if (wakeNow || nowUs >= dueUs) {
+      hal::ControlWake wake = {edge ? hal::WAKE_SWITCH : wakeNow ? hal::WAKE_REQUEST : hal::WAKE_DEADLINE, 0, 0, 0};
+      uint32_t sleepMs = feederLoop(wake);
+      feederService();
+      dueUs = nowUs + sleepMs * 1000ULL;
+      wakeNow = edge = false;
+    }
+    if (k == events.size() && nowUs >= endUs) break;
+
+    // Step to the next recorded input or control task deadline, 1 ms at a
+    // time while the control task wants to run again right away
+    uint64_t nextUs = dueUs > nowUs ? dueUs : nowUs + 1000;
+    if (k < events.size() && events[k].us - t0 < nextUs) nextUs = events[k].us - t0;
+    if (nextUs > endUs && k == events.size()) nextUs = endUs > nowUs ? endUs : nowUs + 1000;
+    hal::native::advanceUs(nextUs - nowUs);
+  }
+  logFlush();
+
+  if (gaps) printf("warning: the recording lost records in %u places (queue full); expect differences there\n", gaps);
+  if (resyncs) printf("warning: the unit lost switch edges %u times; the replay sees only the pin level there\n", resyncs);
+  int mismatches = 0;
+  for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+    uint32_t maxRelayMs = 0, maxFireMs = 0;
+    mismatches += compareTimelines(TR_RELAY, ch, recorded, replayed, o.toleranceMs, o.verbose, maxRelayMs);
+    mismatches += compareTimelines(TR_FIRE, ch, recorded, replayed, o.toleranceMs, o.verbose, maxFireMs);
+  }
+  return mismatches ? 1 : 0;
+}
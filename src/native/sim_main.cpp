@@ -0,0 +1,401 @@
+// Native feeder simulator ([env:native]).
+//
+// Runs the real control logic from feeder.cpp and the logger against the
+// in-memory HAL on a virtual clock. A small mechanical model turns the auger
+// while the relay is on and closes the step switch once per revolution, with
+// contact bounce. Idle stretches are skipped to the next minute boundary, so
+// weeks of feeding cycles run in seconds. A board profile with several
+// channels gets an auger per channel; channels without a stored schedule
+// feed at channel 1's times, each a minute later than the one before.
+//
+//   .pio/build/native/program [--days N] [--start YYYY-MM-DD] [--seed N]
+//                             [--jam-rate P] [--stall-ms N] [--serial] [--log]
+//                             [--metrics] [--trace FILE] [--log-level LEVEL]
+//                             [--storage spiffs|littlefs|ring] [--sync-after S]
+//                             [--power-off S]
+//   .pio/build/native/program --replay FILE... [--segment N] [--tolerance-ms N] [--verbose]
+//
+// --stall-ms runs feederLoop() only every N ms while the switch keeps moving,
+// to check that step counting survives a control task that is held up.
+// --trace records a field trace (trace.h) of the simulation into FILE;
+// --replay feeds a trace (from the simulator or a unit's /trace) through
+// the control logic again and diffs the relay timeline (replay.h).
+// --log-level sets the runtime log level (INFO by default, DEBUG adds the
+// per-step and wake records).
+// --storage picks the log backend (hal.h). spiffs and littlefs are the same
+// in-memory filesystem here; ring runs ring_fs.h on a NOR flash model whose
+// program/erase times show up in the log_flush_us metric.
+// --sync-after leaves the wall clock at 1970 for the first S seconds, as on a
+// cold boot without SNTP; the feeding days start counting then.
+// --power-off boots as after S seconds without power: the clock resumes from
+// the NVS checkpoint written just before the power went (wall_clock.h), so
+// the schedule runs S seconds behind until --sync-after corrects it (never
+// without).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include "feeder.h"
+#include "hal.h"
+#include "hal_native.h"
+#include "logger.h"
+#include "metrics.h"
+#include "replay.h"
+#include "trace.h"
+#include "wall_clock.h"
+
+// The unit tests (test/) link the same sources and bring their own main()
+#ifndef PIO_UNIT_TESTING
+
+struct SimOptions {
+  int days = 14;
+  const char *start = "2026-03-23"; // a week before the CEST switch
+  unsigned seed = 1;
+  double jamRate = 0.0;             // probability that a run jams the auger
+  uint32_t stallMs = 0;             // main loop period while the auger moves
+  bool serial = false;
+  bool dumpLog = false;
+  const char *logLevel = nullptr;
+  bool dumpMetrics = false;
+  const char *traceFile = nullptr;
+  hal::StorageBackend storage = hal::STORAGE_DEFAULT;
+  uint32_t syncAfterS = 0;
+  uint32_t powerOffS = 0;
+  ReplayOptions replay;
+};
+
+// Auger with a cam-operated step switch: closed for SWITCH_CLOSED_MS of every
+// revolution, bouncing for a few ms on each transition.
+class Auger {
+ public:
+  static const uint32_t REV_MS_MIN = 1500;
+  static const uint32_t REV_MS_MAX = 2500;
+  static const uint32_t SWITCH_CLOSED_MS = 300;
+  static const uint32_t BOUNCE_MS = 4;
+
+  explicit Auger(unsigned seed) : rng_(seed) {}
+
+  // Advance the mechanics to nowMs given the relay state; returns switch level.
+  int update(uint32_t nowMs, bool powered) {
+    if (powered && !wasPowered_) {
+      jammed_ = nextRandom() < jamRate * 1000000.0;
+      revStart_ = nowMs;
+      revMs_ = nextRevMs();
+    }
+    wasPowered_ = powered;
+    if (powered && !jammed_) {
+      while (nowMs - revStart_ >= revMs_) {
+        revStart_ += revMs_;
+        revMs_ = nextRevMs();
+      }
+      phase_ = nowMs - revStart_;
+    }
+    // Cam closes the switch at the end of each revolution
+    uint32_t closeAt = revMs_ - SWITCH_CLOSED_MS;
+    bool closed = phase_ >= closeAt;
+    if (closed && !closed_) steps_++;
+    closed_ = closed;
+    // Contacts chatter for a few ms after each transition while turning
+    uint32_t sinceEdge = closed ? phase_ - closeAt : phase_;
+    bool contact = closed;
+    if (moving() && sinceEdge < BOUNCE_MS && (sinceEdge & 1)) contact = !contact;
+    // Pin level as wired on the selected board profile
+    int level = contact ? Board::SWITCH_CLOSED_LEVEL : !Board::SWITCH_CLOSED_LEVEL;
+    return level;
+  }
+
+  bool moving() const { return wasPowered_ && !jammed_; }
+  bool jammed() const { return jammed_; }
+  uint32_t steps() const { return steps_; }
+
+  double jamRate = 0.0;
+
+ private:
+  uint32_t nextRandom() {
+    rng_ = rng_ * 1103515245u + 12345u;
+    return (rng_ >> 8) % 1000000u;
+  }
+  uint32_t nextRevMs() { return REV_MS_MIN + nextRandom() % (REV_MS_MAX - REV_MS_MIN); }
+
+  unsigned rng_;
+  bool wasPowered_ = false;
+  bool jammed_ = false;
+  uint32_t revStart_ = 0;
+  uint32_t revMs_ = REV_MS_MAX;
+  uint32_t phase_ = 0;
+  bool closed_ = false;
+  uint32_t steps_ = 0;
+};
+
+// Let the last trace batch age into the file, then copy the rotated and the
+// current file out of the in-memory filesystem, oldest first.
+static bool writeTrace(const char *path) {
+  hal::native::advance(TRACE_FLUSH_MAX_AGE_MS);
+  feederService();
+  FILE *out = fopen(path, "wb");
+  if (!out) {
+    fprintf(stderr, "cannot write %s\n", path);
+    return false;
+  }
+  uint8_t buf[512];
+  for (bool old : {true, false}) {
+    size_t n;
+    for (uint32_t off = 0; (n = traceRead(old, off, buf, sizeof(buf))) > 0; off += n) fwrite(buf, 1, n, out);
+  }
+  fclose(out);
+  return true;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [--days N] [--start YYYY-MM-DD] [--seed N] [--jam-rate P] [--stall-ms N] [--serial] [--log] [--metrics] [--trace FILE] [--log-level LEVEL] [--storage spiffs|littlefs|ring] [--sync-after S] [--power-off S]\n", prog);
+  fprintf(stderr, "       %s --replay FILE... [--segment N] [--tolerance-ms N] [--verbose]\n", prog);
+}
+
+static bool storageFromName(const char *name, hal::StorageBackend &out) {
+  for (hal::StorageBackend b : {hal::STORAGE_SPIFFS, hal::STORAGE_LITTLEFS, hal::STORAGE_RING}) {
+    if (!strcmp(name, hal::storageBackendName(b))) {
+      out = b;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool parseArgs(int argc, char **argv, SimOptions &o) {
+  for (int i = 1; i < argc; ++i) {
+    const char *a = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (!strcmp(a, "--days") && hasValue) o.days = atoi(argv[++i]);
+    else if (!strcmp(a, "--start") && hasValue) o.start = argv[++i];
+    else if (!strcmp(a, "--seed") && hasValue) o.seed = (unsigned)atoi(argv[++i]);
+    else if (!strcmp(a, "--jam-rate") && hasValue) o.jamRate = atof(argv[++i]);
+    else if (!strcmp(a, "--stall-ms") && hasValue) o.stallMs = (uint32_t)atoi(argv[++i]);
+    else if (!strcmp(a, "--serial")) o.serial = true;
+    else if (!strcmp(a, "--log")) o.dumpLog = true;
+    else if (!strcmp(a, "--metrics")) o.dumpMetrics = true;
+    else if (!strcmp(a, "--trace") && hasValue) o.traceFile = argv[++i];
+    else if (!strcmp(a, "--sync-after") && hasValue) o.syncAfterS = (uint32_t)atoi(argv[++i]);
+    else if (!strcmp(a, "--power-off") && hasValue) o.powerOffS = (uint32_t)atoi(argv[++i]);
+    else if (!strcmp(a, "--log-level") && hasValue) o.logLevel = argv[++i];
+    else if (!strcmp(a, "--storage") && hasValue) {
+      if (!storageFromName(argv[++i], o.storage)) return false;
+    }
+    else if (!strcmp(a, "--replay") && hasValue) {
+      o.replay.files.push_back(argv[++i]);
+      while (i + 1 < argc && argv[i + 1][0] != '-') o.replay.files.push_back(argv[++i]);
+    }
+    else if (!strcmp(a, "--segment") && hasValue) o.replay.segment = atoi(argv[++i]);
+    else if (!strcmp(a, "--tolerance-ms") && hasValue) o.replay.toleranceMs = (uint32_t)atoi(argv[++i]);
+    else if (!strcmp(a, "--verbose")) o.replay.verbose = true;
+    else return false;
+  }
+  return o.days > 0;
+}
+
+int main(int argc, char **argv) {
+  SimOptions opt;
+  if (!parseArgs(argc, argv, opt)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  clockInit(TZ_RULE);
+  hal::native::setConsoleEcho(opt.serial);
+  if (opt.logLevel) {
+    LogLevel level;
+    if (!logLevelFromName(opt.logLevel, level)) {
+      usage(argv[0]);
+      return 2;
+    }
+    logSetLevel(level); // logInit() restores it from the (in-memory) NVS
+  }
+  if (!hal::mountFilesystem(opt.storage)) {
+    fprintf(stderr, "mounting %s failed\n", hal::storageBackendName(opt.storage));
+    return 1;
+  }
+  if (!opt.replay.files.empty()) {
+    int rc = replayTrace(opt.replay);
+    if (opt.dumpLog) logRenderText([](const char *data, size_t len) { fwrite(data, 1, len, stdout); });
+    return rc;
+  }
+
+  struct tm start = {};
+  if (sscanf(opt.start, "%d-%d-%d", &start.tm_year, &start.tm_mon, &start.tm_mday) != 3) {
+    usage(argv[0]);
+    return 2;
+  }
+  start.tm_year -= 1900;
+  start.tm_mon -= 1;
+  start.tm_isdst = -1;
+  time_t startEpoch = mktime(&start);
+  if (opt.powerOffS) {
+    // The last NVS checkpoint before the power went; RTC memory is lost with it
+    hal::native::setEpoch(startEpoch - opt.syncAfterS - opt.powerOffS);
+    clockCheckpoint();
+    uint8_t lost[hal::RETAINED_BYTES] = {};
+    hal::retainedPut(lost, sizeof(lost));
+  }
+  // Before the sync the clock counts from 0 at boot, as time() does on the
+  // board; without --sync-after or --power-off SNTP is there from the start
+  bool sntpAtBoot = !opt.syncAfterS && !opt.powerOffS;
+  hal::native::setEpoch(sntpAtBoot ? startEpoch : 0);
+  if (sntpAtBoot) clockNoteSync();
+  clockResume();
+
+  logInit();
+  if (opt.traceFile) traceStart();
+  setupPins();
+  loadScheduleFromPrefs();
+  for (uint8_t ch = 1; ch < FEEDER_CHANNELS; ++ch) {
+    if (scheduleCount[ch]) continue;
+    scheduleCount[ch] = scheduleCount[0];
+    for (uint8_t i = 0; i < scheduleCount[0]; ++i) {
+      ScheduleEntry e = schedule[0][i];
+      uint32_t minute = (e.hour * 60u + e.minute + ch) % (24 * 60);
+      e.hour = minute / 60;
+      e.minute = minute % 60;
+      schedule[ch][i] = e;
+    }
+    postScheduleToControl(ch);
+  }
+
+  // Channel 0 keeps the seed so a single-channel run stays as it was
+  std::vector<Auger> augers;
+  for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+    augers.emplace_back(opt.seed + ch * 7919u);
+    augers[ch].jamRate = opt.jamRate;
+  }
+  uint32_t runs = 0, timeouts = 0, jamStops = 0, longestRunMs = 0, longestJamMs = 0;
+  uint32_t channelRuns[FEEDER_CHANNELS] = {};
+  uint32_t runStartMs[FEEDER_CHANNELS] = {};
+  uint32_t lastLoopMs = 0;
+  bool relayWasOn[FEEDER_CHANNELS] = {};
+  // Control task wake bookkeeping, as hal_esp32 reports it
+  uint64_t lastCallUs = 0, dueUs = 0, edgeUs = 0;
+  bool edgePending = false;
+  uint32_t maxSwitchLatencyUs = 0;
+
+  const uint64_t endUs = (opt.days * 86400ULL + opt.syncAfterS) * 1000000ULL;
+  bool synced = opt.syncAfterS == 0;
+  ClockStatus clockBeforeSync = {};
+  while (hal::native::nowUs() < endUs) {
+    uint32_t nowMs = hal::millis();
+    if (!synced && nowMs >= opt.syncAfterS * 1000) {
+      synced = true;
+      clockBeforeSync = clockStatus();
+      hal::native::setEpoch(startEpoch - opt.syncAfterS); // start date at the sync
+      clockNoteSync();
+      logEvent(LOG_INFO, EV_CLOCK_SYNCED, {(int32_t)opt.syncAfterS});
+    }
+    bool moving = false;
+    for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+      bool relayOn = hal::native::pinLevel(Board::relayPin(ch)) == Board::RELAY_ON_LEVEL;
+      int level = augers[ch].update(nowMs, relayOn);
+      if (level != hal::native::pinLevel(Board::switchPin(ch)) && !edgePending) {
+        edgePending = true;
+        edgeUs = hal::native::nowUs();
+      }
+      hal::native::setPin(Board::switchPin(ch), level);
+      moving = moving || relayOn || augers[ch].moving();
+    }
+
+    // The control task runs on a switch edge or when its sleep ends;
+    // --stall-ms holds it off for that long after each pass.
+    uint64_t nowUs = hal::native::nowUs();
+    bool stalled = nowMs - lastLoopMs < opt.stallMs;
+    if (stalled || (!edgePending && nowUs < dueUs)) {
+      // Step the mechanics at 1 ms while anything moves, else jump ahead
+      uint32_t step = 1;
+      if (!stalled && !moving) step = (uint32_t)((dueUs - nowUs) / 1000);
+      if (!synced && step > opt.syncAfterS * 1000 - nowMs) step = opt.syncAfterS * 1000 - nowMs;
+      hal::native::advance(step ? step : 1);
+      continue;
+    }
+    lastLoopMs = nowMs;
+    hal::ControlWake wake = {hal::WAKE_DEADLINE, (uint32_t)((nowUs - lastCallUs) / 1000), 0, 0};
+    if (edgePending) {
+      wake.reason = hal::WAKE_SWITCH;
+      wake.latencyUs = (uint32_t)(nowUs - edgeUs);
+      if (wake.latencyUs > maxSwitchLatencyUs) maxSwitchLatencyUs = wake.latencyUs;
+      edgePending = false;
+    } else if (nowUs > dueUs) {
+      wake.latencyUs = (uint32_t)(nowUs - dueUs);
+    }
+    uint32_t sleepMs = feederLoop(wake);
+    lastCallUs = nowUs;
+    dueUs = nowUs + sleepMs * 1000ULL;
+    feederService();
+
+    for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+      bool relayOn = hal::native::pinLevel(Board::relayPin(ch)) == Board::RELAY_ON_LEVEL;
+      if (relayOn && !relayWasOn[ch]) {
+        runs++;
+        channelRuns[ch]++;
+        runStartMs[ch] = nowMs;
+      } else if (!relayOn && relayWasOn[ch]) {
+        uint32_t len = nowMs - runStartMs[ch];
+        if (len > longestRunMs) longestRunMs = len;
+        if (len >= SCHEDULED_RUN_MAX_MS) {
+          timeouts++;
+        } else if (augers[ch].jammed()) {
+          jamStops++;
+          if (len > longestJamMs) longestJamMs = len;
+        }
+      }
+      relayWasOn[ch] = relayOn;
+    }
+    if (sleepMs) continue; // a zero sleep means run again right away
+    hal::native::advance(1);
+  }
+  logFlush();
+  if (opt.traceFile && !writeTrace(opt.traceFile)) return 1;
+
+  if (opt.dumpLog) {
+    logRenderText([](const char *data, size_t len) { fwrite(data, 1, len, stdout); });
+  }
+  if (opt.dumpMetrics) {
+    metricsRender([](const char *data, size_t len) { fwrite(data, 1, len, stdout); });
+  }
+
+  printf("simulated days:     %d (from %s)\n", opt.days, opt.start);
+  printf("relay runs:         %u (%.2f/day)", runs, (double)runs / opt.days);
+  uint32_t steps = 0;
+  for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+    if (FEEDER_CHANNELS > 1) printf("%s ch%u %u", ch ? "," : "", ch + 1, channelRuns[ch]);
+    steps += augers[ch].steps();
+  }
+  printf("\n");
+  printf("step switch closes: %u\n", steps);
+  printf("failsafe timeouts:  %u\n", timeouts);
+  printf("jams detected:      %u (longest %u ms)\n", jamStops, longestJamMs);
+  printf("longest run:        %u ms\n", longestRunMs);
+  printf("max switch latency: %u us\n", maxSwitchLatencyUs);
+  for (uint8_t ch = 0; ch < FEEDER_CHANNELS; ++ch) {
+    DebounceStats sw = feederSwitchStats(ch);
+    char label[8] = "";
+    if (FEEDER_CHANNELS > 1) snprintf(label, sizeof(label), "ch%u ", ch + 1);
+    printf("switch debouncer:   %s%u pulses (%u..%u ms), %u glitches (longest %u us)\n", label, sw.pulses,
+           sw.minPulseMs, sw.maxPulseMs, sw.glitches, sw.maxGlitchUs);
+  }
+  if (opt.powerOffS) {
+    ClockStatus clock = opt.syncAfterS ? clockBeforeSync : clockStatus();
+    printf("%-20s%s, error %s %u ms (%u s behind)\n", opt.syncAfterS ? "clock at sync:" : "clock at end:",
+           clockSourceName(clock.source), clock.errorLowerBound ? "at least" : "up to", clock.errorMs, opt.powerOffS);
+  }
+  hal::FlashStats flash = hal::flashStats();
+  printf("log storage:        %s, %u B programmed, %u B erased (dropped %u)\n", hal::storageBackendName(opt.storage),
+         flash.programmedBytes, flash.erasedBytes, logDroppedCount());
+  printf("log files:          /log.bin %zu B", hal::native::fileSize("/log.bin"));
+  char name[16];
+  for (int i = 1; i <= LOG_ROTATE_COUNT; ++i) {
+    snprintf(name, sizeof(name), "/log.%d.bin", i);
+    printf(", %s %zu B", name, hal::native::fileSize(name));
+  }
+  printf("\n");
+  return 0;
+}
+#endif
@@ -0,0 +1,400 @@
+#include "ring_fs.h"
+
+#include <stddef.h>
+#include <string.h>
+
+// Sector header as stored on flash. An erased sector reads all 0xFF.
+struct RingHeader {
+  uint32_t magic;
+  uint32_t file;
+  uint32_t seq;     // allocation order across the whole ring
+  uint16_t index;
+  uint16_t removed; // 0xFFFF while the file exists, 0 once removed
+};
+static_assert(sizeof(RingHeader) == RING_HEADER_SIZE, "ring header layout");
+
+const uint32_t RING_MAGIC = 0x32534652; // "RFS2": end slots at the sector end
+const uint32_t RING_FREE = 0;
+const uint32_t RING_STALE = 0xFFFFFFFF;
+const uint16_t RING_NONE = 0xFFFF;
+const size_t RING_NAMES_OFFSET = RING_HEADER_SIZE;
+const uint16_t RING_READ_SLOTS = 64; // end slots read at a time by mount
+
+// End slot k, counted from the end of the sector downwards.
+static size_t endSlotOffset(uint16_t k) {
+  return FLASH_SECTOR_SIZE - ((size_t)k + 1) * RING_END_SLOT_SIZE;
+}
+
+static bool validName(const char *name) {
+  size_t len = strlen(name);
+  return len > 0 && len < RING_NAME_LEN;
+}
+
+// Handle for one open file. Reads go through the ring by file id, so a
+// handle whose file was removed just reads nothing.
+class RingFile : public hal::FileImpl {
+ public:
+  RingFile(RingFs &fs, uint32_t id, size_t pos) : fs_(fs), id_(id), pos_(pos) {}
+
+  size_t read(uint8_t *buf, size_t len) override {
+    size_t n = fs_.read(id_, pos_, buf, len);
+    pos_ += n;
+    return n;
+  }
+
+  size_t write(const uint8_t *buf, size_t len) override {
+    return fs_.append(id_, buf, len);
+  }
+
+  size_t size() override { return fs_.size(id_); }
+
+  bool seek(size_t pos) override {
+    if (pos > size()) return false;
+    pos_ = pos;
+    return true;
+  }
+
+ private:
+  RingFs &fs_;
+  uint32_t id_;
+  size_t pos_;
+};
+
+bool RingFs::prepare() {
+  size_t sectors = flash_.size() / FLASH_SECTOR_SIZE;
+  count_ = sectors > RING_MAX_SECTORS ? RING_MAX_SECTORS : (uint16_t)sectors;
+  if (count_ < 2) return false;
+  if (!sectors_) sectors_.reset(new Sector[RING_MAX_SECTORS]);
+  for (uint16_t i = 0; i < count_; ++i) sectors_[i] = {RING_FREE, 0, 0, RING_NONE, 0, false};
+  memset(files_, 0, sizeof(files_));
+  cursor_ = 0;
+  nextId_ = 1;
+  nextSeq_ = 1;
+  return true;
+}
+
+bool RingFs::blank(uint16_t sector, size_t offset, size_t to) {
+  uint8_t buf[256];
+  size_t base = (size_t)sector * FLASH_SECTOR_SIZE;
+  while (offset < to) {
+    size_t n = to - offset;
+    if (n > sizeof(buf)) n = sizeof(buf);
+    if (!flash_.read(base + offset, buf, n)) return false;
+    for (size_t i = 0; i < n; ++i) {
+      if (buf[i] != 0xFF) return false;
+    }
+    offset += n;
+  }
+  return true;
+}
+
+// Fill level from the last programmed end slot. Slots are read downwards
+// from the sector end, a block at a time, until an erased one or the data.
+void RingFs::readEnds(uint16_t sector) {
+  Sector &s = sectors_[sector];
+  size_t base = (size_t)sector * FLASH_SECTOR_SIZE;
+  uint16_t ends[RING_READ_SLOTS];
+  for (;;) {
+    // Slots between the data and the last one read: an append never
+    // writes data where its end slot would not fit after it
+    size_t room = endSlotOffset(s.ends) + RING_END_SLOT_SIZE - (RING_DATA_OFFSET + s.used);
+    uint16_t n = (uint16_t)(room / RING_END_SLOT_SIZE);
+    if (n > RING_READ_SLOTS) n = RING_READ_SLOTS;
+    if (n == 0) {
+      s.sealed = true; // full
+      return;
+    }
+    // Slot s.ends + i is ends[n - 1 - i]
+    if (!flash_.read(base + endSlotOffset(s.ends + n - 1), ends, n * RING_END_SLOT_SIZE)) {
+      s.sealed = true;
+      return;
+    }
+    for (uint16_t i = 0; i < n; ++i) {
+      uint16_t end = ends[n - 1 - i];
+      if (end == 0xFFFF) return;
+      // Fill levels only grow and stay below their slot; anything else is
+      // damage, so stop appending here
+      if (end < s.used || RING_DATA_OFFSET + end > endSlotOffset(s.ends)) {
+        s.sealed = true;
+        return;
+      }
+      s.used = end;
+      s.ends++;
+      if (endSlotOffset(s.ends) < RING_DATA_OFFSET + s.used) {
+        s.sealed = true; // full
+        return;
+      }
+    }
+  }
+}
+
+// File table entry from a first sector; false if it has no name yet (the
+// file was being created when the power went). A slot is complete once its
+// last byte, the terminator, is programmed; a torn rename leaves the name
+// before it.
+bool RingFs::addEntry(uint16_t sector, uint32_t id) {
+  char names[RING_NAME_SLOTS][RING_NAME_LEN];
+  if (!flash_.read((size_t)sector * FLASH_SECTOR_SIZE + RING_NAMES_OFFSET, names, sizeof(names))) return false;
+  uint8_t n = 0;
+  while (n < RING_NAME_SLOTS && (uint8_t)names[n][0] != 0xFF) n++;
+  int valid = n - 1;
+  while (valid >= 0 && names[valid][RING_NAME_LEN - 1] != '\0') valid--;
+  if (valid < 0) return false;
+  Entry *e = find((uint32_t)0);
+  if (!e) return false;
+  e->id = id;
+  memcpy(e->name, names[valid], RING_NAME_LEN);
+  e->names = n;
+  e->first = e->last = sector;
+  e->size = 0;
+  return true;
+}
+
+bool RingFs::mount() {
+  mutex_.lock();
+  if (!prepare()) {
+    mutex_.unlock();
+    return false;
+  }
+  uint32_t newestSeq = 0;
+  for (uint16_t i = 0; i < count_; ++i) {
+    Sector &s = sectors_[i];
+    RingHeader h;
+    if (!flash_.read((size_t)i * FLASH_SECTOR_SIZE, &h, sizeof(h))) {
+      s.file = RING_STALE;
+      continue;
+    }
+    if (h.magic == 0xFFFFFFFF && h.file == 0xFFFFFFFF) continue; // erased, checked again before use
+    if (h.magic != RING_MAGIC || h.file == RING_FREE || h.file == RING_STALE) {
+      s.file = RING_STALE;
+      continue;
+    }
+    s.file = h.file;
+    s.index = h.index;
+    readEnds(i);
+    if (h.file >= nextId_) nextId_ = h.file + 1;
+    if (h.seq >= newestSeq) {
+      newestSeq = h.seq;
+      cursor_ = (i + 1) % count_;
+    }
+    if (h.index == 0 && h.removed == 0xFFFF && !addEntry(i, h.file)) s.file = RING_STALE;
+  }
+  nextSeq_ = newestSeq + 1;
+
+  // Chain each file's sectors in order; whatever no file reaches is stale
+  uint8_t linked[RING_MAX_SECTORS / 8] = {0};
+  for (Entry &e : files_) {
+    if (!e.id) continue;
+    for (uint16_t at = e.first;;) {
+      linked[at / 8] |= 1 << (at % 8);
+      e.size += sectors_[at].used;
+      e.last = at;
+      uint16_t next = RING_NONE;
+      for (uint16_t i = 0; i < count_ && next == RING_NONE; ++i) {
+        if (sectors_[i].file == e.id && sectors_[i].index == sectors_[at].index + 1) next = i;
+      }
+      if (next == RING_NONE) break;
+      sectors_[at].next = next;
+      at = next;
+    }
+    // An append torn between data and end slot leaves bytes past the fill
+    // level that can't be programmed again
+    Sector &tail = sectors_[e.last];
+    if (!tail.sealed && !blank(e.last, RING_DATA_OFFSET + tail.used, endSlotOffset(tail.ends) + RING_END_SLOT_SIZE)) {
+      tail.sealed = true;
+    }
+  }
+  for (uint16_t i = 0; i < count_; ++i) {
+    if (sectors_[i].file != RING_FREE && !(linked[i / 8] & (1 << (i % 8)))) sectors_[i].file = RING_STALE;
+  }
+  // Two files of one name (a reset in the middle of a rename): the newer wins
+  for (Entry &a : files_) {
+    for (Entry &b : files_) {
+      if (a.id && b.id && a.id < b.id && !strcmp(a.name, b.name)) removeLocked(a);
+    }
+  }
+  mutex_.unlock();
+  return true;
+}
+
+bool RingFs::format() {
+  mutex_.lock();
+  bool ok = prepare() && flash_.erase(0, (size_t)count_ * FLASH_SECTOR_SIZE);
+  mutex_.unlock();
+  return ok;
+}
+
+// Claim the next usable sector from the cursor on, erasing it if needed.
+uint16_t RingFs::allocate(uint32_t file, uint16_t index) {
+  for (uint16_t n = 0; n < count_; ++n) {
+    uint16_t i = (cursor_ + n) % count_;
+    Sector &s = sectors_[i];
+    if (s.file != RING_FREE && s.file != RING_STALE) continue;
+    if (s.file == RING_STALE || !blank(i, 0, FLASH_SECTOR_SIZE)) {
+      if (!flash_.erase((size_t)i * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE)) continue;
+    }
+    RingHeader h = {RING_MAGIC, file, nextSeq_++, index, 0xFFFF};
+    if (!flash_.write((size_t)i * FLASH_SECTOR_SIZE, &h, sizeof(h))) {
+      s.file = RING_STALE;
+      continue;
+    }
+    s = {file, index, 0, RING_NONE, 0, false};
+    cursor_ = (i + 1) % count_;
+    return i;
+  }
+  return RING_NONE;
+}
+
+RingFs::Entry *RingFs::find(const char *name) {
+  for (Entry &e : files_) {
+    if (e.id && !strcmp(e.name, name)) return &e;
+  }
+  return nullptr;
+}
+
+RingFs::Entry *RingFs::find(uint32_t id) {
+  for (Entry &e : files_) {
+    if (e.id == id) return &e;
+  }
+  return nullptr;
+}
+
+RingFs::Entry *RingFs::create(const char *name) {
+  Entry *e = find((uint32_t)0);
+  if (!e) return nullptr;
+  uint32_t id = nextId_;
+  uint16_t first = allocate(id, 0);
+  if (first == RING_NONE) return nullptr;
+  nextId_++;
+  char slot[RING_NAME_LEN] = {0};
+  strncpy(slot, name, RING_NAME_LEN - 1);
+  if (!flash_.write((size_t)first * FLASH_SECTOR_SIZE + RING_NAMES_OFFSET, slot, RING_NAME_LEN)) {
+    sectors_[first].file = RING_STALE;
+    return nullptr;
+  }
+  e->id = id;
+  memcpy(e->name, slot, RING_NAME_LEN);
+  e->names = 1;
+  e->first = e->last = first;
+  e->size = 0;
+  return e;
+}
+
+void RingFs::removeLocked(Entry &e) {
+  uint16_t removed = 0;
+  flash_.write((size_t)e.first * FLASH_SECTOR_SIZE + offsetof(RingHeader, removed), &removed, sizeof(removed));
+  for (uint16_t i = e.first; i != RING_NONE; i = sectors_[i].next) sectors_[i].file = RING_STALE;
+  e.id = 0;
+}
+
+hal::File RingFs::open(const char *path, const char *mode) {
+  if (!count_ || !validName(path)) return hal::File();
+  mutex_.lock();
+  Entry *e = find(path);
+  if (e && mode[0] == 'w') {
+    removeLocked(*e);
+    e = nullptr;
+  }
+  if (!e && mode[0] != 'r') e = create(path);
+  uint32_t id = e ? e->id : 0;
+  size_t pos = e && mode[0] == 'a' ? e->size : 0;
+  mutex_.unlock();
+  if (!id) return hal::File();
+  return hal::File(std::make_shared<RingFile>(*this, id, pos));
+}
+
+bool RingFs::exists(const char *path) {
+  mutex_.lock();
+  bool found = find(path) != nullptr;
+  mutex_.unlock();
+  return found;
+}
+
+bool RingFs::remove(const char *path) {
+  mutex_.lock();
+  Entry *e = find(path);
+  if (e) removeLocked(*e);
+  mutex_.unlock();
+  return e != nullptr;
+}
+
+bool RingFs::rename(const char *from, const char *to) {
+  if (!validName(to)) return false;
+  mutex_.lock();
+  Entry *e = find(from);
+  bool ok = e && !find(to) && e->names < RING_NAME_SLOTS;
+  if (ok) {
+    char slot[RING_NAME_LEN] = {0};
+    strncpy(slot, to, RING_NAME_LEN - 1);
+    size_t at = (size_t)e->first * FLASH_SECTOR_SIZE + RING_NAMES_OFFSET + e->names * RING_NAME_LEN;
+    ok = flash_.write(at, slot, RING_NAME_LEN);
+    // A torn slot write leaves the old name after a reset; the slot stays
+    // used either way
+    e->names++;
+    if (ok) memcpy(e->name, slot, RING_NAME_LEN);
+  }
+  mutex_.unlock();
+  return ok;
+}
+
+size_t RingFs::read(uint32_t id, size_t pos, uint8_t *buf, size_t len) {
+  mutex_.lock();
+  Entry *e = id ? find(id) : nullptr;
+  size_t done = 0;
+  for (uint16_t i = e ? e->first : RING_NONE; i != RING_NONE && done < len; i = sectors_[i].next) {
+    const Sector &s = sectors_[i];
+    if (pos >= s.used) {
+      pos -= s.used;
+      continue;
+    }
+    size_t n = s.used - pos;
+    if (n > len - done) n = len - done;
+    if (!flash_.read((size_t)i * FLASH_SECTOR_SIZE + RING_DATA_OFFSET + pos, buf + done, n)) break;
+    done += n;
+    pos = 0;
+  }
+  mutex_.unlock();
+  return done;
+}
+
+size_t RingFs::append(uint32_t id, const uint8_t *buf, size_t len) {
+  mutex_.lock();
+  Entry *e = id ? find(id) : nullptr;
+  size_t done = 0;
+  while (e && done < len) {
+    Sector &s = sectors_[e->last];
+    size_t slot = endSlotOffset(s.ends);
+    // At least one byte has to fit below the next end slot
+    if (s.sealed || slot <= RING_DATA_OFFSET + s.used) {
+      uint16_t next = allocate(id, s.index + 1);
+      if (next == RING_NONE) break;
+      s.next = next;
+      e->last = next;
+      continue;
+    }
+    size_t n = slot - (RING_DATA_OFFSET + s.used);
+    if (n > len - done) n = len - done;
+    size_t base = (size_t)e->last * FLASH_SECTOR_SIZE;
+    uint16_t end = (uint16_t)(s.used + n);
+    // Data first: until its end slot is programmed the append doesn't exist
+    if (!flash_.write(base + RING_DATA_OFFSET + s.used, buf + done, n) ||
+        !flash_.write(base + slot, &end, sizeof(end))) {
+      s.sealed = true;
+      break;
+    }
+    s.ends++;
+    s.used = end;
+    e->size += n;
+    done += n;
+  }
+  mutex_.unlock();
+  return done;
+}
+
+size_t RingFs::size(uint32_t id) {
+  mutex_.lock();
+  Entry *e = id ? find(id) : nullptr;
+  size_t size = e ? e->size : 0;
+  mutex_.unlock();
+  return size;
+}
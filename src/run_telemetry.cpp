@@ -0,0 +1,111 @@
+#include "run_telemetry.h"
+
+#include <string.h>
+#include <algorithm>
+
+const char *runOutcomeName(RunOutcome outcome) {
+  switch (outcome) {
+    case RUN_ACTIVE: return "active";
+    case RUN_COMPLETE: return "complete";
+    case RUN_JAMMED: return "jammed";
+    case RUN_TIMEOUT: return "timeout";
+    case RUN_STOPPED: return "stopped";
+  }
+  return "?";
+}
+
+// Quantiles are recomputed here, once per step, so the per-pass jam check is
+// a single compare. Sorting 32 values costs a few microseconds.
+void StepModel::add(uint32_t ms) {
+  samples_[next_] = ms > UINT16_MAX ? UINT16_MAX : ms;
+  next_ = (next_ + 1) % STEP_MODEL_SAMPLES;
+  if (count_ < STEP_MODEL_SAMPLES) count_++;
+
+  uint16_t sorted[STEP_MODEL_SAMPLES];
+  memcpy(sorted, samples_, count_ * sizeof(uint16_t));
+  std::sort(sorted, sorted + count_);
+  p50_ = sorted[(count_ - 1) / 2];
+  p95_ = sorted[(count_ * 95 + 99) / 100 - 1];
+  limitMs_ = std::max(JAM_FACTOR * p95_, JAM_MIN_MS);
+}
+
+void RunTelemetry::begin(uint32_t nowUs, uint32_t epoch, int entry, uint8_t steps) {
+  current_ = {};
+  current_.startEpoch = epoch;
+  current_.entry = entry >= 0 && entry < MAX_SCHEDULE_ENTRIES ? entry : -1;
+  current_.stepsWanted = steps;
+  current_.outcome = RUN_ACTIVE;
+  startUs_ = lastStepUs_ = nowUs;
+  slowestMs_ = 0;
+  active_ = true;
+}
+
+void RunTelemetry::step(uint32_t edgeUs) {
+  if (!active_) return;
+  uint32_t ms = (edgeUs - lastStepUs_) / 1000;
+  lastStepUs_ = edgeUs;
+  if (ms > slowestMs_) slowestMs_ = ms;
+  if (current_.steps < RUN_MAX_STEPS) current_.stepMs[current_.steps] = ms > UINT16_MAX ? UINT16_MAX : ms;
+  if (current_.steps < UINT8_MAX) current_.steps++;
+  if (current_.entry < 0) return;
+  lock_.lock();
+  models_[current_.entry].add(ms);
+  lock_.unlock();
+}
+
+void RunTelemetry::end(uint32_t nowUs, RunOutcome outcome) {
+  if (!active_) return;
+  active_ = false;
+  current_.durationMs = (nowUs - startUs_) / 1000;
+  current_.limitMs = limitMs();
+  current_.outcome = outcome;
+  lock_.lock();
+  history_[historyNext_] = current_;
+  historyNext_ = (historyNext_ + 1) % RUN_HISTORY;
+  if (historyCount_ < RUN_HISTORY) historyCount_++;
+  lock_.unlock();
+}
+
+uint32_t RunTelemetry::limitMs() const {
+  return current_.entry >= 0 ? models_[current_.entry].limitMs() : 0;
+}
+
+uint32_t RunTelemetry::p95Ms() const {
+  return current_.entry >= 0 ? models_[current_.entry].p95() : 0;
+}
+
+bool RunTelemetry::jammed(uint32_t nowUs) const {
+  uint32_t limit = limitMs();
+  return active_ && limit && stepElapsedMs(nowUs) >= limit;
+}
+
+uint32_t RunTelemetry::msUntilJam(uint32_t nowUs) const {
+  uint32_t limit = limitMs();
+  if (!active_ || !limit) return UINT32_MAX;
+  uint32_t elapsed = stepElapsedMs(nowUs);
+  return elapsed >= limit ? 0 : limit - elapsed;
+}
+
+void RunTelemetry::resetModel(uint8_t i) {
+  if (i >= MAX_SCHEDULE_ENTRIES) return;
+  lock_.lock();
+  models_[i].reset();
+  lock_.unlock();
+}
+
+uint8_t RunTelemetry::history(RunRecord *out, uint8_t max) const {
+  lock_.lock();
+  uint8_t n = std::min(max, historyCount_);
+  for (uint8_t i = 0; i < n; ++i) {
+    out[i] = history_[(historyNext_ + RUN_HISTORY - 1 - i) % RUN_HISTORY];
+  }
+  lock_.unlock();
+  return n;
+}
+
+void RunTelemetry::models(StepModel *out, uint8_t count) const {
+  if (count > MAX_SCHEDULE_ENTRIES) count = MAX_SCHEDULE_ENTRIES;
+  lock_.lock();
+  for (uint8_t i = 0; i < count; ++i) out[i] = models_[i];
+  lock_.unlock();
+}
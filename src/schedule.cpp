@@ -0,0 +1,111 @@
+#include "schedule.h"
+
+#include <string.h>
+
+time_t scheduleNextFire(const ScheduleEntry &e, time_t after) {
+  if (!(e.weekdays & ALL_WEEKDAYS)) return 0;
+  struct tm base;
+  if (!localtime_r(&after, &base)) return 0;
+  // Today plus a full week covers every weekday mask
+  for (int day = 0; day <= 7; ++day) {
+    struct tm c = base;
+    c.tm_mday += day;
+    c.tm_hour = e.hour;
+    c.tm_min = e.minute;
+    c.tm_sec = 0;
+    c.tm_isdst = -1; // let mktime pick; a time skipped by DST moves forward
+    time_t t = mktime(&c);
+    if (t == (time_t)-1 || t <= after) continue;
+    if (e.weekdays & (1 << c.tm_wday)) return t;
+  }
+  return 0;
+}
+
+void ScheduleEngine::setEntries(const ScheduleEntry *entries, uint8_t count, uint32_t nowMs) {
+  if (count > MAX_SCHEDULE_ENTRIES) count = MAX_SCHEDULE_ENTRIES;
+  memcpy(entries_, entries, count * sizeof(ScheduleEntry));
+  count_ = count;
+  for (uint8_t i = 0; i < count_; ++i) {
+    next_[i] = 0;
+    lastFired_[i] = 0;
+    order_[i] = i;
+  }
+  armed_ = false;
+  deadlineMs_ = nowMs;
+}
+
+void ScheduleEngine::arm(uint8_t i, time_t after) {
+  next_[i] = scheduleNextFire(entries_[i], after);
+}
+
+// Insertion sort: at most MAX_SCHEDULE_ENTRIES, and usually only the entry
+// that just fired is out of place.
+void ScheduleEngine::sortOrder() {
+  auto key = [this](uint8_t i) { return next_[i] ? next_[i] : (time_t)INT32_MAX; };
+  for (uint8_t a = 1; a < count_; ++a) {
+    uint8_t idx = order_[a];
+    time_t k = key(idx);
+    uint8_t b = a;
+    while (b > 0 && key(order_[b - 1]) > k) {
+      order_[b] = order_[b - 1];
+      --b;
+    }
+    order_[b] = idx;
+  }
+}
+
+void ScheduleEngine::updateDeadline(time_t nowEpoch, uint32_t nowMs) {
+  uint32_t waitMs = SCHEDULE_RECHECK_MS;
+  if (count_ && next_[order_[0]]) {
+    time_t left = next_[order_[0]] - nowEpoch;
+    if (left <= 0) waitMs = 0;
+    else if ((uint64_t)left * 1000 < waitMs) waitMs = (uint32_t)left * 1000;
+  }
+  deadlineMs_ = nowMs + waitMs;
+}
+
+int ScheduleEngine::poll(time_t nowEpoch, uint32_t nowMs, uint32_t &lateS, int &skippedOut) {
+  lateS = 0;
+  skippedOut = NONE;
+  if ((int32_t)(nowMs - deadlineMs_) < 0) return NONE;
+
+  if (nowEpoch < SCHEDULE_MIN_VALID_EPOCH) {
+    // No wall time yet: check again later
+    armed_ = false;
+    deadlineMs_ = nowMs + SCHEDULE_RECHECK_MS;
+    return NONE;
+  }
+  if (!armed_) {
+    for (uint8_t i = 0; i < count_; ++i) arm(i, nowEpoch);
+    armed_ = true;
+    sortOrder();
+    updateDeadline(nowEpoch, nowMs);
+    return NONE;
+  }
+
+  // Clock went backwards: entries now more than a week out are re-armed,
+  // but never for a slot they already ran.
+  bool resort = false;
+  for (uint8_t i = 0; i < count_; ++i) {
+    if (next_[i] && next_[i] - nowEpoch > 8 * 86400) {
+      arm(i, nowEpoch > lastFired_[i] ? nowEpoch : lastFired_[i]);
+      resort = true;
+    }
+  }
+  if (resort) sortOrder();
+
+  int result = NONE;
+  if (count_) {
+    uint8_t i = order_[0];
+    if (next_[i] && next_[i] <= nowEpoch) {
+      lateS = (uint32_t)(nowEpoch - next_[i]);
+      lastFired_[i] = next_[i];
+      arm(i, nowEpoch);
+      sortOrder();
+      if (lateS <= SCHEDULE_CATCH_UP_S) result = i;
+      else skippedOut = i;
+    }
+  }
+  updateDeadline(nowEpoch, nowMs);
+  return result;
+}
@@ -0,0 +1,76 @@
+#include "settings.h"
+
+#include <string.h>
+
+#include "feeder.h"
+#include "hal.h"
+
+static const char *const SETTINGS_NS = "settings";
+static const char *const SETTINGS_KEY = "blob";
+const size_t SETTINGS_HEADER_SIZE = 4;
+const size_t SETTINGS_MAX_BLOB = SETTINGS_HEADER_SIZE + sizeof(Settings) + 4;
+
+// Copy of the stored blob, so unchanged saves need no NVS read
+static uint8_t storedBlob[SETTINGS_MAX_BLOB];
+static size_t storedLen = 0;
+
+static uint32_t crc32(const uint8_t *data, size_t len) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; ++i) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; ++b) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+void settingsDefaults(Settings &s) {
+  memset(&s, 0, sizeof(s));
+  // Further channels start without feeding times until they are set up
+  ChannelSettings &c = s.channels[0];
+  c.scheduleCount = 3;
+  c.schedule[0] = {8, 0, STEPS_PER_RUN, ALL_WEEKDAYS};
+  c.schedule[1] = {16, 40, STEPS_PER_RUN, ALL_WEEKDAYS};
+  c.schedule[2] = {18, 0, STEPS_PER_RUN, ALL_WEEKDAYS};
+}
+
+SettingsLoadResult settingsLoad(Settings &s) {
+  uint8_t blob[SETTINGS_MAX_BLOB];
+  size_t len = hal::nvsGetBlob(SETTINGS_NS, SETTINGS_KEY, blob, sizeof(blob));
+  if (len == 0) return SETTINGS_MISSING;
+  if (len < SETTINGS_HEADER_SIZE + 4 || len > sizeof(blob)) return SETTINGS_INVALID;
+  uint16_t version, payloadLen;
+  uint32_t crc;
+  memcpy(&version, blob, 2);
+  memcpy(&payloadLen, blob + 2, 2);
+  memcpy(&crc, blob + len - 4, 4);
+  if (version > SETTINGS_VERSION || SETTINGS_HEADER_SIZE + payloadLen + 4 != len ||
+      crc32(blob, len - 4) != crc) {
+    return SETTINGS_INVALID;
+  }
+  // Older, shorter payloads keep the caller's values for the newer fields
+  memcpy(&s, blob + SETTINGS_HEADER_SIZE, payloadLen < sizeof(s) ? payloadLen : sizeof(s));
+  for (ChannelSettings &c : s.channels) {
+    if (c.scheduleCount > MAX_SCHEDULE_ENTRIES) c.scheduleCount = MAX_SCHEDULE_ENTRIES;
+  }
+  memcpy(storedBlob, blob, len);
+  storedLen = len;
+  return SETTINGS_LOADED;
+}
+
+SettingsSaveResult settingsSave(const Settings &s) {
+  uint8_t blob[SETTINGS_MAX_BLOB];
+  uint16_t version = SETTINGS_VERSION;
+  uint16_t payloadLen = sizeof(s);
+  memcpy(blob, &version, 2);
+  memcpy(blob + 2, &payloadLen, 2);
+  memcpy(blob + SETTINGS_HEADER_SIZE, &s, sizeof(s));
+  size_t len = SETTINGS_HEADER_SIZE + sizeof(s);
+  uint32_t crc = crc32(blob, len);
+  memcpy(blob + len, &crc, 4);
+  len += 4;
+  if (len == storedLen && memcmp(blob, storedBlob, len) == 0) return SETTINGS_UNCHANGED;
+  if (!hal::nvsPutBlob(SETTINGS_NS, SETTINGS_KEY, blob, len)) return SETTINGS_WRITE_FAILED;
+  memcpy(storedBlob, blob, len);
+  storedLen = len;
+  return SETTINGS_SAVED;
+}
@@ -0,0 +1,103 @@
+#include "trace.h"
+
+#include <atomic>
+
+#include "hal.h"
+#include "metrics.h"
+#include "spsc_queue.h"
+
+// Control task -> traceFlushPoll(). A feeding produces a few dozen records
+// (mostly contact bounce), so this holds several runs between flushes.
+static SpscQueue<TraceRecord, 128> traceQueue;
+static std::atomic<bool> traceOn{false};
+static std::atomic<bool> traceSnapshotWanted{false};
+static uint32_t traceDropped = 0; // control task only
+static void (*traceSink)(const TraceRecord &) = nullptr;
+
+// Serialises appends and rotation against traceRead().
+static hal::Mutex traceFileMutex;
+
+bool traceActive() { return traceOn.load(std::memory_order_relaxed); }
+
+void traceRecord(TraceType type, uint64_t us, uint8_t arg, uint32_t value, uint16_t aux) {
+  if (!traceActive()) return;
+  TraceRecord r = {us, value, aux, type, arg};
+  if (traceSink) {
+    traceSink(r);
+    return;
+  }
+  if (traceDropped) {
+    // Note the gap first, so a replay knows the trace is incomplete
+    TraceRecord gap = {us, traceDropped, 0, TR_DROPPED, 0};
+    if (!traceQueue.push(gap)) {
+      traceDropped++;
+      return;
+    }
+    traceDropped = 0;
+  }
+  if (!traceQueue.push(r)) traceDropped++;
+}
+
+bool traceSnapshotDue() {
+  return traceActive() && traceSnapshotWanted.exchange(false, std::memory_order_relaxed);
+}
+
+void traceStart() {
+  traceSnapshotWanted = true;
+  traceOn = true;
+  hal::wakeControl();
+}
+
+void traceCapture(void (*sink)(const TraceRecord &)) {
+  traceSink = sink;
+  traceOn = true;
+}
+
+// Caller holds traceFileMutex. The next file starts with a fresh snapshot.
+static void rotateTrace() {
+  hal::FileSystem &fs = hal::filesystem();
+  if (fs.exists(TRACE_OLD_PATH)) fs.remove(TRACE_OLD_PATH);
+  if (fs.rename(TRACE_PATH, TRACE_OLD_PATH)) metricsCount(CTR_FS_RENAMES);
+  traceSnapshotWanted = true;
+  hal::wakeControl();
+}
+
+void traceFlushPoll() {
+  if (!traceActive() || traceSink) return;
+  TraceRecord oldest;
+  if (!traceQueue.peek(oldest)) return;
+  uint32_t ageMs = (uint32_t)((hal::micros() - oldest.us) / 1000);
+  if (traceQueue.size() < TRACE_FLUSH_RECORDS && ageMs < TRACE_FLUSH_MAX_AGE_MS) return;
+
+  traceFileMutex.lock();
+  hal::File f = hal::filesystem().open(TRACE_PATH, FILE_APPEND);
+  if (!f) {
+    // Keep the records queued; recording drops once the queue is full
+    traceFileMutex.unlock();
+    return;
+  }
+  TraceRecord batch[TRACE_FLUSH_RECORDS];
+  size_t n;
+  do {
+    n = 0;
+    while (n < TRACE_FLUSH_RECORDS && traceQueue.pop(batch[n])) n++;
+    if (n) f.write((const uint8_t *)batch, n * sizeof(TraceRecord));
+  } while (n == TRACE_FLUSH_RECORDS);
+  size_t size = f.size();
+  f.close();
+  if (size >= TRACE_MAX_SIZE) rotateTrace();
+  traceFileMutex.unlock();
+}
+
+size_t traceRead(bool old, uint32_t offset, uint8_t *buf, size_t len) {
+  const char *path = old ? TRACE_OLD_PATH : TRACE_PATH;
+  size_t n = 0;
+  traceFileMutex.lock();
+  if (hal::filesystem().exists(path)) {
+    hal::File f = hal::filesystem().open(path, FILE_READ);
+    if (f && f.seek(offset)) n = f.read(buf, len);
+    if (f) f.close();
+  }
+  traceFileMutex.unlock();
+  return n;
+}
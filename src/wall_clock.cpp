@@ -0,0 +1,407 @@
+#include "wall_clock.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+
+#include "hal.h"
+#include "logger.h"
+
+const uint32_t DAY_S = 86400;
+const uint32_t OFFSET_SCAN_STEP_S = 7 * DAY_S; // shorter than any gap between two transitions
+const uint8_t OFFSET_SCAN_STEPS = 53;          // a year each way
+
+struct OffsetPeriod {
+  uint32_t from;
+  uint32_t until;
+  int32_t offset;
+};
+
+const uint32_t CHECKPOINT_MAGIC = 0x4B434C4B; // "KLCK"
+static const char *const CHECKPOINT_NS = "clock";
+static const char *const CHECKPOINT_KEY = "cp";
+
+// Same layout in RTC memory and NVS
+struct ClockCheckpoint {
+  uint32_t magic;
+  uint32_t errorMs;
+  uint64_t epochMs;
+  int32_t driftPpb;
+  uint32_t check; // FNV-1a of everything before it
+};
+static_assert(sizeof(ClockCheckpoint) <= hal::RETAINED_BYTES, "checkpoint must fit in retained memory");
+
+// Where the time came from and what it is worth. offsetMs is epochMs() -
+// micros() / 1000 as last set by us or SNTP; anything else moving it is
+// left alone by the drift correction.
+struct ClockState {
+  ClockSource source;
+  uint32_t baseErrorMs;   // error when the clock was set ...
+  uint64_t baseUs;        // ... at this micros()
+  int64_t offsetMs;
+  int64_t appliedMs;      // drift correction stepped in since baseUs
+  int64_t syncOffsetMs;   // offsetMs at the last SNTP sync, for the drift
+  uint64_t syncUs;        // valid once source is CLOCK_SNTP
+  int32_t driftPpb;
+  bool nvsDue;
+  uint32_t nvsWrittenMs;
+};
+
+static std::atomic<uint32_t> bootEpoch{0};
+static OffsetPeriod cachedPeriod = {0, 0, 0};
+static ClockState state = {CLOCK_NONE, 0, 0, 0, 0, 0, 0, CLOCK_DRIFT_UNKNOWN, false, 0};
+static hal::SpinLock clockLock;
+
+// Days since 1970-01-01 of a proleptic Gregorian date, and back
+// (H. Hinnant's algorithms).
+static int64_t daysFromCivil(int y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  unsigned yoe = (unsigned)(y - era * 400);
+  unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void civilFromDays(int64_t z, int &y, unsigned &m, unsigned &d) {
+  z += 719468;
+  int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  unsigned doe = (unsigned)(z - era * 146097);
+  unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned mp = (5 * doy + 2) / 153;
+  d = doy - (153 * mp + 2) / 5 + 1;
+  m = mp < 10 ? mp + 3 : mp - 9;
+  y = (int)(yoe + era * 400) + (m <= 2);
+}
+
+// The slow path: one localtime_r().
+static int32_t offsetAt(uint32_t epoch) {
+  time_t t = epoch;
+  struct tm tm;
+  if (!localtime_r(&t, &tm)) return 0;
+  int64_t local = daysFromCivil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) * DAY_S +
+                  tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+  return (int32_t)(local - (int64_t)epoch);
+}
+
+// First second after same (which has offset) where the offset differs, if
+// that happens before other; other if not.
+static uint32_t transitionBetween(uint32_t same, uint32_t other, int32_t offset) {
+  bool forward = other > same;
+  while (forward ? other - same > 1 : same - other > 1) {
+    uint32_t mid = forward ? same + (other - same) / 2 : other + (same - other) / 2;
+    if (offsetAt(mid) == offset) same = mid;
+    else other = mid;
+  }
+  return other;
+}
+
+// Offset at epoch and how far it holds either way, found by stepping a
+// week at a time to the neighbouring transitions.
+static OffsetPeriod findPeriod(uint32_t epoch) {
+  OffsetPeriod p = {epoch, epoch, offsetAt(epoch)};
+  uint32_t t = epoch;
+  uint8_t i = 0;
+  for (; i < OFFSET_SCAN_STEPS && t < UINT32_MAX - OFFSET_SCAN_STEP_S; ++i) {
+    uint32_t next = t + OFFSET_SCAN_STEP_S;
+    if (offsetAt(next) != p.offset) {
+      p.until = transitionBetween(t, next, p.offset);
+      break;
+    }
+    t = next;
+  }
+  if (p.until == epoch) p.until = t; // no transition within a year (or no DST at all)
+  t = epoch;
+  for (i = 0; i < OFFSET_SCAN_STEPS && t > OFFSET_SCAN_STEP_S; ++i) {
+    uint32_t prev = t - OFFSET_SCAN_STEP_S;
+    if (offsetAt(prev) != p.offset) {
+      p.from = transitionBetween(t, prev, p.offset) + 1;
+      break;
+    }
+    t = prev;
+  }
+  if (p.from == epoch) p.from = t;
+  return p;
+}
+
+void clockInit(const char *tzRule) {
+  setenv("TZ", tzRule, 1);
+  tzset();
+  clockLock.lock();
+  cachedPeriod = {0, 0, 0};
+  clockLock.unlock();
+}
+
+bool clockSynced() {
+  if (bootEpoch.load(std::memory_order_relaxed)) return true;
+  uint64_t nowMs = hal::epochMs();
+  if (nowMs / 1000 < CLOCK_MIN_VALID_EPOCH) return false;
+  uint32_t boot = (uint32_t)((nowMs - hal::millis() + 500) / 1000);
+  uint32_t none = 0;
+  bootEpoch.compare_exchange_strong(none, boot, std::memory_order_relaxed);
+  return true;
+}
+
+uint32_t clockStamp() {
+  return clockSynced() ? (uint32_t)hal::epochNow() : hal::millis() / 1000;
+}
+
+uint32_t clockBootEpoch() {
+  return bootEpoch.load(std::memory_order_relaxed);
+}
+
+int32_t clockUtcOffset(uint32_t epoch, uint32_t *from, uint32_t *until) {
+  clockLock.lock();
+  OffsetPeriod p = cachedPeriod;
+  clockLock.unlock();
+  if (epoch < p.from || epoch >= p.until) {
+    p = findPeriod(epoch);
+    clockLock.lock();
+    cachedPeriod = p;
+    clockLock.unlock();
+  }
+  if (from) *from = p.from;
+  if (until) *until = p.until;
+  return p.offset;
+}
+
+static int64_t wallOffsetMs() {
+  uint64_t us = hal::micros();
+  return (int64_t)hal::epochMs() - (int64_t)(us / 1000);
+}
+
+static uint32_t checkpointCheck(const ClockCheckpoint &cp) {
+  const uint8_t *p = (const uint8_t *)&cp;
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < offsetof(ClockCheckpoint, check); ++i) h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+static bool checkpointValid(const ClockCheckpoint &cp) {
+  return cp.magic == CHECKPOINT_MAGIC && cp.check == checkpointCheck(cp) &&
+         cp.epochMs / 1000 >= CLOCK_MIN_VALID_EPOCH;
+}
+
+// How much the error grows over elapsedMs on the crystal.
+static uint32_t errorGrowthMs(uint64_t elapsedMs, int32_t driftPpb) {
+  uint64_t ppb = driftPpb == CLOCK_DRIFT_UNKNOWN ? CLOCK_DRIFT_UNKNOWN_PPB : CLOCK_DRIFT_RESIDUAL_PPB;
+  uint64_t ms = elapsedMs * ppb / 1000000000ULL;
+  return ms > UINT32_MAX ? UINT32_MAX : (uint32_t)ms;
+}
+
+static uint32_t errorAt(const ClockState &st, uint64_t nowUs) {
+  uint64_t ms = st.baseErrorMs + (uint64_t)errorGrowthMs((nowUs - st.baseUs) / 1000, st.driftPpb);
+  return ms > UINT32_MAX ? UINT32_MAX : (uint32_t)ms;
+}
+
+void clockResume() {
+  ClockCheckpoint rtc, nvs;
+  bool haveRtc = hal::retainedGet(&rtc, sizeof(rtc)) == sizeof(rtc) && checkpointValid(rtc);
+  bool haveNvs = hal::nvsGetBlob(CHECKPOINT_NS, CHECKPOINT_KEY, &nvs, sizeof(nvs)) == sizeof(nvs) &&
+                 checkpointValid(nvs);
+  // RTC memory is the newer one when both survived
+  const ClockCheckpoint *newest = haveRtc ? &rtc : haveNvs ? &nvs : nullptr;
+  int32_t drift = newest ? newest->driftPpb : CLOCK_DRIFT_UNKNOWN;
+
+  clockLock.lock();
+  bool resumed = state.source == CLOCK_NONE;
+  if (state.driftPpb == CLOCK_DRIFT_UNKNOWN) state.driftPpb = drift;
+  clockLock.unlock();
+  if (hal::startPeriodic("clock", clockPoll, CLOCK_CHECKPOINT_MS) < 0) {
+    logEvent(LOG_ERROR, EV_TASK_START_FAILED, {}, "clock");
+  }
+  if (!resumed) return;
+
+  ClockSource source = CLOCK_NONE;
+  uint32_t errorMs = 0;
+  uint64_t nowMs = hal::epochMs();
+  if (nowMs / 1000 >= CLOCK_MIN_VALID_EPOCH) {
+    // The RTC timer kept running through the reset
+    source = CLOCK_RTC;
+    if (haveRtc && nowMs >= rtc.epochMs) errorMs = rtc.errorMs + errorGrowthMs(nowMs - rtc.epochMs, drift);
+  } else if (haveRtc) {
+    // Written at most CLOCK_CHECKPOINT_MS before the reset; split the difference
+    source = CLOCK_RTC;
+    hal::setEpochMs(rtc.epochMs + CLOCK_CHECKPOINT_MS / 2 + hal::millis());
+    errorMs = rtc.errorMs + CLOCK_CHECKPOINT_MS / 2 + errorGrowthMs(CLOCK_CHECKPOINT_MS, drift);
+  } else if (haveNvs) {
+    // Nobody knows how long the power was off: stay at the earliest time it can be
+    source = CLOCK_NVS;
+    hal::setEpochMs(nvs.epochMs + hal::millis());
+    errorMs = nvs.errorMs + CLOCK_NVS_CHECKPOINT_S * 1000 + errorGrowthMs(CLOCK_NVS_CHECKPOINT_S * 1000ULL, drift);
+  }
+  if (source == CLOCK_NONE) {
+    logEvent(LOG_WARN, EV_CLOCK_LOST);
+    return;
+  }
+
+  clockLock.lock();
+  if (state.source == CLOCK_NONE) {
+    state.source = source;
+    state.baseErrorMs = errorMs;
+    state.baseUs = hal::micros();
+    state.offsetMs = wallOffsetMs();
+    state.appliedMs = 0;
+  }
+  clockLock.unlock();
+  logEvent(source == CLOCK_RTC ? LOG_INFO : LOG_WARN, source == CLOCK_RTC ? EV_CLOCK_KEPT : EV_CLOCK_RESUMED,
+           {(int32_t)errorMs, drift == CLOCK_DRIFT_UNKNOWN ? 0 : drift});
+}
+
+void clockNoteSync() {
+  uint64_t nowUs = hal::micros();
+  int64_t offset = wallOffsetMs();
+  clockLock.lock();
+  ClockState was = state;
+  int32_t sample = CLOCK_DRIFT_UNKNOWN;
+  uint64_t spanMs = (nowUs - state.syncUs) / 1000;
+  // Between two syncs only the crystal moved the offset (our own drift
+  // steps aside, which SNTP has just undone)
+  if (state.source == CLOCK_SNTP && spanMs >= CLOCK_DRIFT_MIN_SPAN_S * 1000ULL) {
+    int64_t ppb = (offset - state.syncOffsetMs) * 1000000000LL / (int64_t)spanMs;
+    if (ppb >= -CLOCK_DRIFT_MAX_PPB && ppb <= CLOCK_DRIFT_MAX_PPB) sample = (int32_t)ppb;
+  }
+  if (sample != CLOCK_DRIFT_UNKNOWN) {
+    // Smoothed over about four syncs against network jitter
+    state.driftPpb = state.driftPpb == CLOCK_DRIFT_UNKNOWN ? sample : state.driftPpb + (sample - state.driftPpb) / 4;
+  }
+  state.source = CLOCK_SNTP;
+  state.baseErrorMs = CLOCK_SNTP_ERROR_MS;
+  state.baseUs = nowUs;
+  state.offsetMs = offset;
+  state.appliedMs = 0;
+  state.syncOffsetMs = offset;
+  state.syncUs = nowUs;
+  // The first sync since boot fixes what a resume got wrong: keep it
+  if (was.source != CLOCK_SNTP || sample != CLOCK_DRIFT_UNKNOWN) state.nvsDue = true;
+  int32_t drift = state.driftPpb;
+  clockLock.unlock();
+
+  if (was.source == CLOCK_NONE) return;
+  // How far off the clock was: the offline error after a resume, the
+  // residual drift between routine syncs
+  LogLevel level = was.source == CLOCK_SNTP ? LOG_DEBUG : LOG_INFO;
+  int64_t stepMs = offset - was.offsetMs;
+  if (stepMs > INT32_MAX) stepMs = INT32_MAX;
+  if (stepMs < INT32_MIN + 1) stepMs = INT32_MIN + 1;
+  logEvent(level, EV_CLOCK_CORRECTED,
+           {(int32_t)stepMs, (int32_t)((nowUs - was.baseUs) / 1000000), (int32_t)errorAt(was, nowUs),
+            drift == CLOCK_DRIFT_UNKNOWN ? 0 : drift},
+           clockSourceName(was.source));
+}
+
+static ClockCheckpoint checkpointNow(const ClockState &st, uint64_t nowUs) {
+  ClockCheckpoint cp = {CHECKPOINT_MAGIC, errorAt(st, nowUs), hal::epochMs(), st.driftPpb, 0};
+  cp.check = checkpointCheck(cp);
+  return cp;
+}
+
+static void writeCheckpoints(bool nvs) {
+  uint64_t nowUs = hal::micros();
+  clockLock.lock();
+  ClockState st = state;
+  if (nvs) {
+    state.nvsDue = false;
+    state.nvsWrittenMs = hal::millis();
+  }
+  clockLock.unlock();
+  if (hal::epochMs() / 1000 < CLOCK_MIN_VALID_EPOCH) return;
+  ClockCheckpoint cp = checkpointNow(st, nowUs);
+  hal::retainedPut(&cp, sizeof(cp));
+  if (nvs) hal::nvsPutBlob(CHECKPOINT_NS, CHECKPOINT_KEY, &cp, sizeof(cp));
+}
+
+void clockCheckpoint() {
+  writeCheckpoints(true);
+}
+
+void clockPoll() {
+  uint64_t nowUs = hal::micros();
+  clockLock.lock();
+  ClockState st = state;
+  clockLock.unlock();
+  if (st.source == CLOCK_NONE) return;
+
+  // Step out the known drift, but only on a clock nobody else has moved
+  if (st.driftPpb != CLOCK_DRIFT_UNKNOWN) {
+    int64_t wantMs = (int64_t)((nowUs - st.baseUs) / 1000) * st.driftPpb / 1000000000LL;
+    int64_t stepMs = wantMs - st.appliedMs;
+    int64_t offset = wallOffsetMs();
+    bool ours = offset - st.offsetMs <= 1 && st.offsetMs - offset <= 1;
+    if (ours && (stepMs >= CLOCK_STEP_MIN_MS || stepMs <= -(int64_t)CLOCK_STEP_MIN_MS)) {
+      hal::setEpochMs(hal::epochMs() + stepMs);
+      clockLock.lock();
+      if (state.baseUs == st.baseUs) {
+        state.appliedMs += stepMs;
+        state.offsetMs += stepMs;
+      }
+      clockLock.unlock();
+    }
+  }
+  writeCheckpoints(st.nvsDue || hal::millis() - st.nvsWrittenMs >= CLOCK_NVS_CHECKPOINT_S * 1000);
+}
+
+ClockStatus clockStatus() {
+  uint64_t nowUs = hal::micros();
+  clockLock.lock();
+  ClockState st = state;
+  clockLock.unlock();
+  ClockStatus s = {st.source, 0, st.driftPpb, 0, st.source == CLOCK_NVS};
+  if (st.source != CLOCK_NONE) {
+    s.errorMs = errorAt(st, nowUs);
+    s.sinceSetS = (uint32_t)((nowUs - st.baseUs) / 1000000);
+  }
+  return s;
+}
+
+const char *clockSourceName(ClockSource source) {
+  switch (source) {
+    case CLOCK_NVS: return "nvs";
+    case CLOCK_RTC: return "rtc";
+    case CLOCK_SNTP: return "sntp";
+    default: return "none";
+  }
+}
+
+static void put2(char *out, unsigned v) {
+  out[0] = (char)('0' + v / 10 % 10);
+  out[1] = (char)('0' + v % 10);
+}
+
+size_t ClockFormatter::format(uint32_t stamp, char *buf) {
+  if (clockIsUptime(stamp)) {
+    int n = snprintf(buf, CLOCK_TEXT_LEN, "boot+%02u:%02u:%02u", (unsigned)(stamp / 3600),
+                     (unsigned)(stamp / 60 % 60), (unsigned)(stamp % 60));
+    return n > 0 ? (size_t)n : 0;
+  }
+  if (stamp < from_ || stamp >= until_) offset_ = clockUtcOffset(stamp, &from_, &until_);
+  int64_t local = (int64_t)stamp + offset_;
+  if (local < dayStart_ || local >= dayStart_ + DAY_S) {
+    int64_t days = local / DAY_S;
+    int y;
+    unsigned m, d;
+    civilFromDays(days, y, m, d);
+    put2(text_, (unsigned)y / 100);
+    put2(text_ + 2, (unsigned)y % 100);
+    text_[4] = '-';
+    put2(text_ + 5, m);
+    text_[7] = '-';
+    put2(text_ + 8, d);
+    text_[10] = ' ';
+    text_[13] = ':';
+    text_[16] = ':';
+    dayStart_ = days * DAY_S;
+  }
+  uint32_t sec = (uint32_t)(local - dayStart_);
+  put2(text_ + 11, sec / 3600);
+  put2(text_ + 14, sec / 60 % 60);
+  put2(text_ + 17, sec % 60);
+  memcpy(buf, text_, CLOCK_TEXT_LEN - 1);
+  buf[CLOCK_TEXT_LEN - 1] = '\0';
+  return CLOCK_TEXT_LEN - 1;
+}
@@ -0,0 +1,183 @@
+// SwitchDebouncer against recorded bounce traces: switch times, the glitch
+// and pulse width counters, and independence from when edges are processed.
+
+#include <unity.h>
+
+#include "debounce.h"
+
+// 1 ms samples, 20 ms to switch either way
+static const DebounceConfig CFG = {1000, 20, 20, 0};
+
+struct Edge {
+  uint32_t us;
+  bool closed;
+};
+
+// Contact closing and, 200 ms later, opening again, as captured from the
+// feeder's microswitch (edge times relative to the first edge)
+static const Edge PRESS[] = {
+    {10000, true},  {10300, false}, {10800, true},   {11500, false},
+    {11900, true},  {210000, false}, {210200, true}, {210900, false},
+};
+static const uint32_t PRESS_END_US = 400000;
+
+struct Change {
+  uint32_t us;
+  bool closed;
+};
+
+struct Replay {
+  Change changes[8];
+  int count = 0;
+  uint32_t at = 0; // changedAtUs of the last call
+  void note(SwitchDebouncer &d, bool changed) {
+    if (changed && count < 8) changes[count++] = {at, d.closed()};
+  }
+};
+
+// Feed the trace shifted by `offsetUs`, polling every `pollUs` in between
+// (0: only at the edges and the end)
+static Replay replay(SwitchDebouncer &d, const Edge *trace, int n, uint32_t endUs, uint32_t offsetUs = 0,
+                     uint32_t pollUs = 0) {
+  Replay r;
+  uint32_t t = 0;
+  d.reset(offsetUs, false);
+  for (int i = 0; i < n; ++i) {
+    if (pollUs) {
+      for (; t + pollUs < trace[i].us; t += pollUs) r.note(d, d.poll(offsetUs + t + pollUs, r.at));
+    }
+    r.note(d, d.edge(offsetUs + trace[i].us, trace[i].closed, r.at));
+  }
+  r.note(d, d.poll(offsetUs + endUs, r.at));
+  return r;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_press_switches_once_each_way() {
+  SwitchDebouncer d(CFG);
+  Replay r = replay(d, PRESS, sizeof(PRESS) / sizeof(PRESS[0]), PRESS_END_US);
+  TEST_ASSERT_EQUAL_INT(2, r.count);
+  // Closed samples from 11 ms (the one at 11 ms still sees the contact
+  // closed) reach 20 at 30 ms; open from 210 ms reaches 0 at 230 ms
+  TEST_ASSERT_TRUE(r.changes[0].closed);
+  TEST_ASSERT_EQUAL_UINT32(30000, r.changes[0].us);
+  TEST_ASSERT_FALSE(r.changes[1].closed);
+  TEST_ASSERT_EQUAL_UINT32(230000, r.changes[1].us);
+  const DebounceStats &s = d.stats();
+  TEST_ASSERT_EQUAL_UINT32(1, s.pulses);
+  TEST_ASSERT_EQUAL_UINT32(0, s.glitches); // bounce while switching is not a glitch
+  TEST_ASSERT_EQUAL_UINT32(200, s.minPulseMs);
+  TEST_ASSERT_EQUAL_UINT32(200, s.maxPulseMs);
+}
+
+void test_result_independent_of_polling() {
+  const int n = sizeof(PRESS) / sizeof(PRESS[0]);
+  SwitchDebouncer lazy(CFG), eager(CFG);
+  Replay a = replay(lazy, PRESS, n, PRESS_END_US);
+  Replay b = replay(eager, PRESS, n, PRESS_END_US, 0, 137);
+  TEST_ASSERT_EQUAL_INT(a.count, b.count);
+  for (int i = 0; i < a.count; ++i) {
+    TEST_ASSERT_EQUAL_UINT32(a.changes[i].us, b.changes[i].us);
+    TEST_ASSERT_EQUAL(a.changes[i].closed, b.changes[i].closed);
+  }
+  TEST_ASSERT_EQUAL_UINT32(lazy.stats().maxPulseMs, eager.stats().maxPulseMs);
+}
+
+void test_microsecond_clock_wrap() {
+  // Same trace across the 32-bit wrap of micros()
+  const uint32_t offset = 0xFFFFFFFF - 100000;
+  SwitchDebouncer d(CFG);
+  Replay r = replay(d, PRESS, sizeof(PRESS) / sizeof(PRESS[0]), PRESS_END_US, offset);
+  TEST_ASSERT_EQUAL_INT(2, r.count);
+  TEST_ASSERT_EQUAL_UINT32(offset + 30000, r.changes[0].us);
+  TEST_ASSERT_EQUAL_UINT32(offset + 230000, r.changes[1].us);
+  TEST_ASSERT_EQUAL_UINT32(200, d.stats().maxPulseMs);
+}
+
+void test_glitch_counted_and_measured() {
+  // 3 ms spike with bounce (motor noise on the switch line)
+  static const Edge SPIKE[] = {{50000, true}, {50100, false}, {50300, true}, {53000, false}};
+  SwitchDebouncer d(CFG);
+  Replay r = replay(d, SPIKE, 4, 200000);
+  TEST_ASSERT_EQUAL_INT(0, r.count);
+  TEST_ASSERT_FALSE(d.closed());
+  const DebounceStats &s = d.stats();
+  TEST_ASSERT_EQUAL_UINT32(0, s.pulses);
+  TEST_ASSERT_EQUAL_UINT32(1, s.glitches);
+  TEST_ASSERT_EQUAL_UINT32(3000, s.maxGlitchUs);
+  TEST_ASSERT_EQUAL_UINT32(0, s.minPulseMs);
+}
+
+void test_glitch_counted_after_window_only() {
+  static const Edge SPIKE[] = {{50000, true}, {53000, false}};
+  SwitchDebouncer d(CFG);
+  replay(d, SPIKE, 2, 72000);
+  TEST_ASSERT_EQUAL_UINT32(0, d.stats().glitches); // could still be bounce
+  uint32_t at;
+  d.poll(73000, at);
+  TEST_ASSERT_EQUAL_UINT32(1, d.stats().glitches);
+}
+
+void test_spikes_within_window_are_one_glitch() {
+  static const Edge SPIKES[] = {{50000, true}, {52000, false}, {60000, true}, {61000, false}};
+  SwitchDebouncer d(CFG);
+  Replay r = replay(d, SPIKES, 4, 200000);
+  TEST_ASSERT_EQUAL_INT(0, r.count);
+  TEST_ASSERT_EQUAL_UINT32(1, d.stats().glitches);
+  TEST_ASSERT_EQUAL_UINT32(11000, d.stats().maxGlitchUs);
+}
+
+void test_threshold() {
+  // Clean closures on the sample grid: 20 samples switch, 19 do not
+  static const Edge SHORT[] = {{100000, true}, {119999, false}};
+  static const Edge ENOUGH[] = {{100000, true}, {120000, false}};
+  SwitchDebouncer a(CFG), b(CFG);
+  Replay ra = replay(a, SHORT, 2, 300000);
+  Replay rb = replay(b, ENOUGH, 2, 300000);
+  TEST_ASSERT_EQUAL_INT(0, ra.count);
+  TEST_ASSERT_EQUAL_UINT32(1, a.stats().glitches);
+  TEST_ASSERT_EQUAL_INT(2, rb.count);
+  TEST_ASSERT_EQUAL_UINT32(120000, rb.changes[0].us);
+  TEST_ASSERT_EQUAL_UINT32(1, b.stats().pulses);
+  TEST_ASSERT_EQUAL_UINT32(0, b.stats().glitches);
+}
+
+void test_pulse_width_range() {
+  static const Edge TWO[] = {{100000, true}, {200000, false}, {500000, true}, {800000, false}};
+  SwitchDebouncer d(CFG);
+  replay(d, TWO, 4, 1000000);
+  const DebounceStats &s = d.stats();
+  TEST_ASSERT_EQUAL_UINT32(2, s.pulses);
+  TEST_ASSERT_EQUAL_UINT32(100, s.minPulseMs);
+  TEST_ASSERT_EQUAL_UINT32(300, s.maxPulseMs);
+}
+
+void test_us_until_settled() {
+  SwitchDebouncer d(CFG);
+  d.reset(0, false);
+  uint32_t at;
+  d.edge(100000, true, at);
+  TEST_ASSERT_TRUE(d.settling());
+  TEST_ASSERT_EQUAL_UINT32(20000, d.usUntilSettled(100000));
+  TEST_ASSERT_FALSE(d.poll(119999, at));
+  TEST_ASSERT_TRUE(d.poll(120000, at));
+  TEST_ASSERT_EQUAL_UINT32(120000, at);
+  TEST_ASSERT_FALSE(d.settling());
+  TEST_ASSERT_EQUAL_UINT32(0, d.usUntilSettled(120000));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_press_switches_once_each_way);
+  RUN_TEST(test_result_independent_of_polling);
+  RUN_TEST(test_microsecond_clock_wrap);
+  RUN_TEST(test_glitch_counted_and_measured);
+  RUN_TEST(test_glitch_counted_after_window_only);
+  RUN_TEST(test_spikes_within_window_are_one_glitch);
+  RUN_TEST(test_threshold);
+  RUN_TEST(test_pulse_width_range);
+  RUN_TEST(test_us_until_settled);
+  return UNITY_END();
+}
@@ -0,0 +1,158 @@
+// FormReader and the form number helpers: percent-decoding (including
+// malformed escapes), field splitting, overlong numbers and time fields.
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "form.h"
+
+// Form bodies are decoded in place, so every test works on its own copy
+static char body[256];
+
+static FormReader reader(const char *s) {
+  strcpy(body, s);
+  return FormReader(body, strlen(s));
+}
+
+static FormView view(const char *s) { return {s, strlen(s)}; }
+
+void setUp() {}
+void tearDown() {}
+
+void test_fields_in_order_unknown_keys_included() {
+  FormReader r = reader("count=3&color=rot&h0=08%3A00");
+  FormView k, v;
+  TEST_ASSERT_TRUE(r.next(k, v));
+  TEST_ASSERT_EQUAL_STRING("count", k.data);
+  TEST_ASSERT_EQUAL_STRING("3", v.data);
+  // Keys the handler doesn't know come back like any other; it skips them
+  TEST_ASSERT_TRUE(r.next(k, v));
+  TEST_ASSERT_TRUE(k.is("color"));
+  TEST_ASSERT_TRUE(v.is("rot"));
+  TEST_ASSERT_TRUE(r.next(k, v));
+  TEST_ASSERT_TRUE(k.is("h0"));
+  TEST_ASSERT_TRUE(v.is("08:00"));
+  TEST_ASSERT_FALSE(r.next(k, v));
+  TEST_ASSERT_FALSE(r.malformed());
+}
+
+void test_empty_fields_and_missing_value() {
+  FormReader r = reader("&a=1&&flag&b=&");
+  FormView k, v;
+  TEST_ASSERT_TRUE(r.next(k, v));
+  TEST_ASSERT_TRUE(k.is("a"));
+  TEST_ASSERT_TRUE(r.next(k, v));
+  TEST_ASSERT_TRUE(k.is("flag"));
+  TEST_ASSERT_EQUAL_size_t(0, v.len);
+  TEST_ASSERT_EQUAL_STRING("", v.data);
+  TEST_ASSERT_TRUE(r.next(k, v));
+  TEST_ASSERT_TRUE(k.is("b"));
+  TEST_ASSERT_EQUAL_size_t(0, v.len);
+  TEST_ASSERT_FALSE(r.next(k, v));
+}
+
+void test_decoding() {
+  FormReader r = reader("a%3Db=x+y%2bz%26&%41=%e4");
+  FormView k, v;
+  TEST_ASSERT_TRUE(r.next(k, v));
+  // Escaped '=' and '&' are data, not separators
+  TEST_ASSERT_EQUAL_STRING("a=b", k.data);
+  TEST_ASSERT_EQUAL_STRING("x y+z&", v.data);
+  TEST_ASSERT_TRUE(r.next(k, v));
+  TEST_ASSERT_EQUAL_STRING("A", k.data);
+  TEST_ASSERT_EQUAL_size_t(1, v.len);
+  TEST_ASSERT_EQUAL_UINT8(0xE4, (uint8_t)v.data[0]);
+  TEST_ASSERT_FALSE(r.malformed());
+}
+
+void test_malformed_escapes_kept() {
+  const char *cases[][2] = {{"a=%zz", "%zz"}, {"a=1%", "1%"}, {"a=%4", "%4"}, {"a=%4g1", "%4g1"}};
+  for (auto &c : cases) {
+    FormReader r = reader(c[0]);
+    FormView k, v;
+    TEST_ASSERT_TRUE(r.next(k, v));
+    TEST_ASSERT_EQUAL_STRING(c[1], v.data);
+    TEST_ASSERT_TRUE(r.malformed());
+  }
+}
+
+void test_malformed_escape_does_not_spill_into_next_field() {
+  // "%4" at the end of a field must not pair with the '&' or what follows
+  FormReader r = reader("a=%4&b=1");
+  FormView k, v;
+  TEST_ASSERT_TRUE(r.next(k, v));
+  TEST_ASSERT_EQUAL_STRING("%4", v.data);
+  TEST_ASSERT_TRUE(r.next(k, v));
+  TEST_ASSERT_TRUE(k.is("b"));
+  TEST_ASSERT_TRUE(v.is("1"));
+  TEST_ASSERT_TRUE(r.malformed());
+}
+
+void test_uint() {
+  uint32_t n = 77;
+  TEST_ASSERT_TRUE(formUInt(view("0"), 0, 10, n));
+  TEST_ASSERT_EQUAL_UINT32(0, n);
+  TEST_ASSERT_TRUE(formUInt(view("999999999"), 0, UINT32_MAX, n));
+  TEST_ASSERT_EQUAL_UINT32(999999999, n);
+  n = 77;
+  TEST_ASSERT_FALSE(formUInt(view(""), 0, 10, n));
+  TEST_ASSERT_FALSE(formUInt(view("-1"), 0, 10, n));
+  TEST_ASSERT_FALSE(formUInt(view("+1"), 0, 10, n));
+  TEST_ASSERT_FALSE(formUInt(view("1 "), 0, 10, n));
+  TEST_ASSERT_FALSE(formUInt(view("0x10"), 0, 100, n));
+  TEST_ASSERT_FALSE(formUInt(view("11"), 0, 10, n));
+  TEST_ASSERT_FALSE(formUInt(view("4"), 5, 10, n));
+  TEST_ASSERT_EQUAL_UINT32(77, n); // untouched on failure
+}
+
+void test_uint_overlong() {
+  uint32_t n = 77;
+  // Would wrap a uint32_t to something small and in range
+  TEST_ASSERT_FALSE(formUInt(view("4294967297"), 0, 100, n));
+  // Leading zeros count too: ten digits are refused whatever their value
+  TEST_ASSERT_FALSE(formUInt(view("0000000001"), 0, 100, n));
+  TEST_ASSERT_FALSE(formUInt(view("99999999999999999999"), 0, UINT32_MAX, n));
+  TEST_ASSERT_EQUAL_UINT32(77, n);
+}
+
+void test_hour_minute() {
+  uint8_t h = 99, m = 99;
+  TEST_ASSERT_TRUE(formHourMinute(view("08:00"), h, m));
+  TEST_ASSERT_EQUAL_UINT8(8, h);
+  TEST_ASSERT_EQUAL_UINT8(0, m);
+  TEST_ASSERT_TRUE(formHourMinute(view("7:05"), h, m));
+  TEST_ASSERT_EQUAL_UINT8(7, h);
+  TEST_ASSERT_EQUAL_UINT8(5, m);
+  TEST_ASSERT_TRUE(formHourMinute(view("23:59:30"), h, m));
+  TEST_ASSERT_EQUAL_UINT8(23, h);
+  TEST_ASSERT_EQUAL_UINT8(59, m);
+}
+
+void test_hour_minute_rejects() {
+  const char *bad[] = {"", ":", "8", "24:00", "08:60", "8:5", "008:00", "08:000", "08:00:60",
+                       "08:00:0", "08-00", "08:0a", " 8:00", "08:00:00:00", "08:00x00"};
+  for (const char *s : bad) {
+    uint8_t h = 99, m = 99;
+    if (formHourMinute(view(s), h, m)) {
+      printf("accepted '%s'\n", s);
+      TEST_ASSERT_TRUE(false);
+    }
+    TEST_ASSERT_EQUAL_UINT8(99, h);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_fields_in_order_unknown_keys_included);
+  RUN_TEST(test_empty_fields_and_missing_value);
+  RUN_TEST(test_decoding);
+  RUN_TEST(test_malformed_escapes_kept);
+  RUN_TEST(test_malformed_escape_does_not_spill_into_next_field);
+  RUN_TEST(test_uint);
+  RUN_TEST(test_uint_overlong);
+  RUN_TEST(test_hour_minute);
+  RUN_TEST(test_hour_minute_rejects);
+  return UNITY_END();
+}
@@ -0,0 +1,149 @@
+// JsonIn pull reader (numbers, keys, skipping unknown members, nesting
+// limit) and JsonOut windows.
+
+#include <unity.h>
+
+#include <string.h>
+
+#include "json.h"
+
+static JsonIn in(const char *s) { return JsonIn(s, strlen(s)); }
+
+void setUp() {}
+void tearDown() {}
+
+void test_uint() {
+  uint32_t n = 77;
+  JsonIn j = in(" 0 , 999999999]");
+  TEST_ASSERT_TRUE(j.uint(n));
+  TEST_ASSERT_EQUAL_UINT32(0, n);
+  TEST_ASSERT_TRUE(j.consume(','));
+  TEST_ASSERT_TRUE(j.uint(n));
+  TEST_ASSERT_EQUAL_UINT32(999999999, n);
+  TEST_ASSERT_TRUE(j.consume(']'));
+  TEST_ASSERT_TRUE(j.atEnd());
+}
+
+void test_uint_rejects() {
+  const char *bad[] = {"1234567890", "4294967297", "00000000001", "-1", "1.5", "1e3", "2E1", "\"3\"", "", "x"};
+  for (const char *s : bad) {
+    uint32_t n = 77;
+    JsonIn j = in(s);
+    TEST_ASSERT_FALSE(j.uint(n));
+    TEST_ASSERT_EQUAL_UINT32(77, n);
+  }
+}
+
+void test_key() {
+  char k[8];
+  JsonIn j = in(" { \"hour\" : 8 }");
+  TEST_ASSERT_TRUE(j.consume('{'));
+  TEST_ASSERT_TRUE(j.key(k, sizeof(k)));
+  TEST_ASSERT_EQUAL_STRING("hour", k);
+  uint32_t n;
+  TEST_ASSERT_TRUE(j.uint(n));
+  TEST_ASSERT_TRUE(j.consume('}'));
+  TEST_ASSERT_TRUE(j.atEnd());
+}
+
+void test_key_rejects() {
+  char k[8];
+  // Seven characters plus the terminator fit, eight don't
+  JsonIn fits = in("\"weekday\":1");
+  TEST_ASSERT_TRUE(fits.key(k, sizeof(k)));
+  JsonIn tooLong = in("\"weekdays\":1");
+  TEST_ASSERT_FALSE(tooLong.key(k, sizeof(k)));
+  JsonIn escaped = in("\"h\\u0041\":1");
+  TEST_ASSERT_FALSE(escaped.key(k, sizeof(k)));
+  JsonIn noColon = in("\"hour\" 1");
+  TEST_ASSERT_FALSE(noColon.key(k, sizeof(k)));
+  JsonIn unterminated = in("\"hour");
+  TEST_ASSERT_FALSE(unterminated.key(k, sizeof(k)));
+}
+
+// Walks an object the way the API handlers do: known keys are read, any
+// other member is skipped whatever its type
+static bool readHour(const char *s, uint32_t &hour) {
+  JsonIn j = in(s);
+  char k[16];
+  bool have = false;
+  if (!j.consume('{')) return false;
+  if (!j.consume('}')) {
+    do {
+      if (!j.key(k, sizeof(k))) return false;
+      if (!strcmp(k, "hour")) {
+        if (!j.uint(hour)) return false;
+        have = true;
+      } else if (!j.skipValue()) {
+        return false;
+      }
+    } while (j.consume(','));
+    if (!j.consume('}')) return false;
+  }
+  return have && j.atEnd();
+}
+
+void test_unknown_keys_skipped() {
+  uint32_t h = 0;
+  TEST_ASSERT_TRUE(readHour("{\"note\":\"a \\\"}\\\" b\",\"x\":[1,{\"y\":[true,null]},-2.5e-3],\"hour\":7,"
+                            "\"z\":{},\"w\":[]}",
+                            h));
+  TEST_ASSERT_EQUAL_UINT32(7, h);
+}
+
+void test_unknown_keys_malformed() {
+  uint32_t h = 0;
+  TEST_ASSERT_FALSE(readHour("{\"x\":[1,2,\"hour\":7}", h));
+  TEST_ASSERT_FALSE(readHour("{\"x\":{\"a\" 1},\"hour\":7}", h));
+  TEST_ASSERT_FALSE(readHour("{\"x\":\"open,\"hour\":7}", h)); // string runs to the end
+  TEST_ASSERT_FALSE(readHour("{\"x\":,\"hour\":7}", h));
+  TEST_ASSERT_FALSE(readHour("{\"hour\":7} trailing", h));
+  TEST_ASSERT_FALSE(readHour("{\"hour\":7", h));
+}
+
+void test_nesting_limit() {
+  // The member value sits at depth 0; eight more levels are allowed
+  JsonIn a = in("[[[[[[[[1]]]]]]]]");
+  TEST_ASSERT_TRUE(a.skipValue());
+  TEST_ASSERT_TRUE(a.atEnd());
+  JsonIn b = in("[[[[[[[[[1]]]]]]]]]");
+  TEST_ASSERT_FALSE(b.skipValue());
+}
+
+void test_out_window() {
+  // Rendering the same document in 7-byte windows gives the whole of it
+  auto render = [](JsonOut &o) {
+    o.print("{\"entries\":[");
+    for (int i = 0; i < 5; ++i) o.printf("%s{\"h\":%d,\"m\":%02d}", i ? "," : "", 8 + i, i * 7);
+    o.print("]}");
+  };
+  JsonOut count;
+  render(count);
+  char whole[128], part[8];
+  size_t n = 0;
+  for (size_t from = 0; from < count.size(); from += 7) {
+    JsonOut o(part, from, 7);
+    render(o);
+    TEST_ASSERT_EQUAL_size_t(count.size(), o.size());
+    memcpy(whole + n, part, o.copied());
+    n += o.copied();
+  }
+  whole[n] = '\0';
+  TEST_ASSERT_EQUAL_size_t(count.size(), n);
+  TEST_ASSERT_EQUAL_STRING("{\"entries\":[{\"h\":8,\"m\":00},{\"h\":9,\"m\":07},{\"h\":10,\"m\":14},"
+                           "{\"h\":11,\"m\":21},{\"h\":12,\"m\":28}]}",
+                           whole);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_uint);
+  RUN_TEST(test_uint_rejects);
+  RUN_TEST(test_key);
+  RUN_TEST(test_key_rejects);
+  RUN_TEST(test_unknown_keys_skipped);
+  RUN_TEST(test_unknown_keys_malformed);
+  RUN_TEST(test_nesting_limit);
+  RUN_TEST(test_out_window);
+  return UNITY_END();
+}
@@ -0,0 +1,304 @@
+// RingFs recovery: a power cut at any byte of a run of appends, creates and
+// renames leaves a mountable ring in which every file holds a prefix of
+// what was appended to it, under its old or its new name, and appending
+// goes on after the reset.
+
+#include <unity.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "ring_fs.h"
+
+// NOR flash that loses power after a number of programmed bytes: the write
+// that crosses the limit stops there and every write or erase after it
+// fails, until powerOn().
+class CutFlash : public FlashPartition {
+ public:
+  explicit CutFlash(size_t sectors) : mem_(sectors * FLASH_SECTOR_SIZE, 0xFF) {}
+
+  size_t size() const override { return mem_.size(); }
+
+  bool read(size_t offset, void *buf, size_t len) override {
+    if (offset + len > mem_.size()) return false;
+    memcpy(buf, mem_.data() + offset, len);
+    return true;
+  }
+
+  bool write(size_t offset, const void *buf, size_t len) override {
+    if (offset + len > mem_.size()) return false;
+    const uint8_t *src = (const uint8_t *)buf;
+    for (size_t i = 0; i < len; ++i) {
+      // Programming can only clear bits; ring_fs must never need more
+      TEST_ASSERT_EQUAL_UINT8(src[i], mem_[offset + i] & src[i]);
+    }
+    for (size_t i = 0; i < len; ++i) {
+      if (budget_ == 0) off_ = true;
+      if (off_) return false;
+      budget_--;
+      mem_[offset + i] &= src[i];
+      programmed++;
+    }
+    return true;
+  }
+
+  bool erase(size_t offset, size_t len) override {
+    if (off_ || offset % FLASH_SECTOR_SIZE || len % FLASH_SECTOR_SIZE || offset + len > mem_.size()) return false;
+    memset(mem_.data() + offset, 0xFF, len);
+    return true;
+  }
+
+  void cutAfter(size_t bytes) { budget_ = bytes; }
+  void powerOn() {
+    budget_ = SIZE_MAX;
+    off_ = false;
+  }
+  uint8_t *raw(size_t offset) { return mem_.data() + offset; }
+
+  size_t programmed = 0;
+
+ private:
+  std::vector<uint8_t> mem_;
+  size_t budget_ = SIZE_MAX;
+  bool off_ = false;
+};
+
+static const size_t SECTORS = 8;
+
+// Content of a file by position, so any prefix can be checked
+static uint8_t pattern(char file, size_t pos) { return (uint8_t)(pos * 7 + file); }
+
+// One write() call, as the logger's flush does
+static size_t appendPattern(hal::File &f, char file, size_t len) {
+  std::vector<uint8_t> buf(len);
+  size_t pos = f.size();
+  for (size_t i = 0; i < len; ++i) buf[i] = pattern(file, pos + i);
+  return f.write(buf.data(), len);
+}
+
+static bool holdsPattern(RingFs &fs, const char *name, char file, size_t &size) {
+  hal::File f = fs.open(name, FILE_READ);
+  if (!f) return false;
+  size = f.size();
+  uint8_t buf[512];
+  size_t pos = 0;
+  for (size_t n; (n = f.read(buf, sizeof(buf))) > 0; pos += n) {
+    for (size_t i = 0; i < n; ++i) {
+      if (buf[i] != pattern(file, pos + i)) return false;
+    }
+  }
+  return pos == size;
+}
+
+// Files as the workload leaves them after each step
+struct State {
+  bool hasA;
+  const char *nameA; // file 'A' is renamed half way
+  size_t sizeA;
+  bool hasC;
+  size_t sizeC;
+};
+
+static const size_t STEPS_MAX = 64;
+static State states[STEPS_MAX + 1];
+static size_t progAfter[STEPS_MAX + 1];
+static size_t steps;
+
+// Appends of mixed sizes across sector boundaries, a rename of the open
+// file and a second file created in between. Stops at the first failure
+// (the power cut).
+static void workload(CutFlash &flash, RingFs &fs, bool record) {
+  static const size_t SIZES[] = {12, 1, 300, 40, 7, 2000, 12, 12, 1500, 3, 900};
+  State s = {false, "/a", 0, false, 0};
+  size_t step = 0;
+  auto done = [&]() {
+    if (record) {
+      states[step + 1] = s;
+      progAfter[step + 1] = flash.programmed;
+    }
+    step++;
+  };
+  if (record) {
+    states[0] = s;
+    progAfter[0] = flash.programmed;
+  }
+  hal::File a = fs.open("/a", FILE_APPEND);
+  if (!a) return;
+  s.hasA = true;
+  done();
+  hal::File c;
+  for (int round = 0; round < 2; ++round) {
+    for (size_t len : SIZES) {
+      size_t n = appendPattern(a, 'A', len);
+      s.sizeA += n;
+      if (n != len) return;
+      done();
+    }
+    if (round == 0) {
+      if (!fs.rename("/a", "/a.1")) return;
+      s.nameA = "/a.1";
+      done();
+      c = fs.open("/c", FILE_APPEND);
+      if (!c) return;
+      s.hasC = true;
+      done();
+    }
+    size_t n = appendPattern(c, 'C', 100);
+    s.sizeC += n;
+    if (n != 100) return;
+    done();
+  }
+  if (record) steps = step;
+}
+
+static CutFlash *flash;
+
+void setUp() {
+  flash = new CutFlash(SECTORS);
+  RingFs fs(*flash);
+  fs.format();
+}
+
+void tearDown() { delete flash; }
+
+void test_workload_survives_remount() {
+  {
+    RingFs fs(*flash);
+    TEST_ASSERT_TRUE(fs.mount());
+    workload(*flash, fs, true);
+  }
+  TEST_ASSERT_TRUE(steps > 20 && steps <= STEPS_MAX);
+  RingFs fs(*flash);
+  TEST_ASSERT_TRUE(fs.mount());
+  size_t size;
+  TEST_ASSERT_FALSE(fs.exists("/a"));
+  TEST_ASSERT_TRUE(holdsPattern(fs, "/a.1", 'A', size));
+  TEST_ASSERT_EQUAL_size_t(states[steps].sizeA, size);
+  TEST_ASSERT_TRUE(holdsPattern(fs, "/c", 'C', size));
+  TEST_ASSERT_EQUAL_size_t(200, size);
+}
+
+void test_power_cut_at_every_byte() {
+  {
+    RingFs fs(*flash);
+    fs.mount();
+    workload(*flash, fs, true);
+  }
+  size_t total = progAfter[steps];
+  TEST_ASSERT_TRUE(total > 2 * FLASH_SECTOR_SIZE);
+  for (size_t cut = 0; cut < total; ++cut) {
+    delete flash;
+    flash = new CutFlash(SECTORS);
+    {
+      RingFs fs(*flash);
+      fs.format();
+      fs.mount();
+      flash->cutAfter(cut);
+      workload(*flash, fs, false);
+    }
+    flash->powerOn();
+    // The step that was running: the files are as before or after it
+    size_t step = 0;
+    while (progAfter[step + 1] <= cut) step++;
+    const State &before = states[step], &after = states[step + 1];
+
+    RingFs fs(*flash);
+    TEST_ASSERT_TRUE(fs.mount());
+    const char *nameA = fs.exists(after.nameA) ? after.nameA : before.nameA;
+    size_t sizeA = 0, sizeC = 0;
+    if (before.hasA) TEST_ASSERT_TRUE(fs.exists(nameA));
+    if (!fs.exists(nameA)) continue; // cut while creating it
+    if (!holdsPattern(fs, nameA, 'A', sizeA) || sizeA < before.sizeA || sizeA > after.sizeA) {
+      printf("cut at byte %zu (step %zu): %s holds %zu bytes, %zu..%zu expected\n", cut, step, nameA, sizeA,
+             before.sizeA, after.sizeA);
+      TEST_ASSERT_TRUE(false);
+    }
+    if (before.hasC) TEST_ASSERT_TRUE(fs.exists("/c"));
+    if (fs.exists("/c")) {
+      TEST_ASSERT_TRUE(holdsPattern(fs, "/c", 'C', sizeC));
+      TEST_ASSERT_TRUE(sizeC >= before.sizeC && sizeC <= after.sizeC);
+    }
+
+    // Appending goes on where the file ends
+    hal::File f = fs.open(nameA, FILE_APPEND);
+    TEST_ASSERT_TRUE((bool)f);
+    TEST_ASSERT_EQUAL_size_t(500, appendPattern(f, 'A', 500));
+    RingFs again(*flash);
+    TEST_ASSERT_TRUE(again.mount());
+    size_t grown;
+    TEST_ASSERT_TRUE(holdsPattern(again, nameA, 'A', grown));
+    TEST_ASSERT_EQUAL_size_t(sizeA + 500, grown);
+  }
+}
+
+void test_torn_rename_keeps_old_name() {
+  {
+    RingFs fs(*flash);
+    fs.mount();
+    hal::File f = fs.open("/log.bin", FILE_APPEND);
+    appendPattern(f, 'L', 1000);
+    flash->cutAfter(5); // a third of the name slot
+    TEST_ASSERT_FALSE(fs.rename("/log.bin", "/log.1.bin"));
+  }
+  flash->powerOn();
+  RingFs fs(*flash);
+  TEST_ASSERT_TRUE(fs.mount());
+  size_t size;
+  TEST_ASSERT_FALSE(fs.exists("/log.1.bin"));
+  TEST_ASSERT_TRUE(holdsPattern(fs, "/log.bin", 'L', size));
+  TEST_ASSERT_EQUAL_size_t(1000, size);
+  // The torn slot stays used; the next rename takes the one after it
+  TEST_ASSERT_TRUE(fs.rename("/log.bin", "/log.1.bin"));
+  RingFs again(*flash);
+  TEST_ASSERT_TRUE(again.mount());
+  TEST_ASSERT_TRUE(holdsPattern(again, "/log.1.bin", 'L', size));
+  TEST_ASSERT_EQUAL_size_t(1000, size);
+}
+
+void test_small_appends_fill_sectors() {
+  RingFs fs(*flash);
+  fs.mount();
+  hal::File f = fs.open("/log.bin", FILE_APPEND);
+  while (appendPattern(f, 'S', 12) == 12) {
+  }
+  // Each sector takes 12 data and 2 end slot bytes per append, until its
+  // end slots meet the data
+  size_t perSector = (FLASH_SECTOR_SIZE - RING_DATA_OFFSET) / (12 + RING_END_SLOT_SIZE) * 12;
+  TEST_ASSERT_TRUE(f.size() >= SECTORS * perSector);
+  size_t size;
+  RingFs again(*flash);
+  TEST_ASSERT_TRUE(again.mount());
+  TEST_ASSERT_TRUE(holdsPattern(again, "/log.bin", 'S', size));
+  TEST_ASSERT_EQUAL_size_t(f.size(), size);
+}
+
+void test_foreign_data_is_reused() {
+  // What another filesystem left behind, and a sector whose erase was cut
+  // short (erased header, old bytes further on)
+  for (size_t i = 0; i < SECTORS * FLASH_SECTOR_SIZE; ++i) *flash->raw(i) = (uint8_t)(i * 31 + 5);
+  memset(flash->raw(0), 0xFF, 2048);
+  {
+    RingFs fs(*flash);
+    TEST_ASSERT_TRUE(fs.mount());
+    TEST_ASSERT_FALSE(fs.exists("/log.bin"));
+    hal::File f = fs.open("/log.bin", FILE_APPEND);
+    TEST_ASSERT_EQUAL_size_t(5000, appendPattern(f, 'F', 5000));
+  }
+  RingFs fs(*flash);
+  TEST_ASSERT_TRUE(fs.mount());
+  size_t size;
+  TEST_ASSERT_TRUE(holdsPattern(fs, "/log.bin", 'F', size));
+  TEST_ASSERT_EQUAL_size_t(5000, size);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_workload_survives_remount);
+  RUN_TEST(test_power_cut_at_every_byte);
+  RUN_TEST(test_torn_rename_keeps_old_name);
+  RUN_TEST(test_small_appends_fill_sectors);
+  RUN_TEST(test_foreign_data_is_reused);
+  return UNITY_END();
+}
@@ -0,0 +1,228 @@
+// ScheduleEngine: catch-up and skip around SCHEDULE_CATCH_UP_S, clock jumps
+// and the two DST transitions of TZ_RULE.
+
+#include <unity.h>
+
+#include "feeder.h"
+#include "schedule.h"
+
+// Epoch of a UTC date and time, independent of TZ and of mktime
+static time_t utc(int y, int mo, int d, int h, int mi, int s = 0) {
+  y -= mo <= 2;
+  int era = (y >= 0 ? y : y - 399) / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (mo + (mo > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long days = (long)era * 146097 + doe - 719468;
+  return (time_t)(days * 86400 + h * 3600 + mi * 60 + s);
+}
+
+// Wall clock and millis() advancing together, polling the engine whenever
+// its deadline has passed
+struct SimClock {
+  ScheduleEngine engine;
+  time_t epoch = 0;
+  uint32_t ms = 0;
+  int fires[8];
+  uint32_t late[8];
+  int fireCount = 0;
+  int skipped[8];
+  int skipCount = 0;
+
+  void poll() {
+    // Overdue entries come one per poll() with a zero wait in between
+    for (int n = 0; n < 100 && (int32_t)(ms - engine.deadlineMs()) >= 0; ++n) {
+      uint32_t lateS;
+      int skippedOut;
+      int i = engine.poll(epoch, ms, lateS, skippedOut);
+      if (i != ScheduleEngine::NONE && fireCount < 8) {
+        late[fireCount] = lateS;
+        fires[fireCount++] = i;
+      }
+      if (skippedOut != ScheduleEngine::NONE && skipCount < 8) skipped[skipCount++] = skippedOut;
+    }
+  }
+  // Let `seconds` pass in steps of `stepS`, polling as the firmware would
+  void run(uint32_t seconds, uint32_t stepS = 1) {
+    for (uint32_t t = 0; t < seconds; t += stepS) {
+      epoch += stepS;
+      ms += stepS * 1000;
+      poll();
+    }
+  }
+  // Wall clock jump (SNTP correction); the engine sees it at its next
+  // deadline, which is when `to` is the wall time
+  void jump(time_t to) {
+    epoch = to;
+    ms = engine.deadlineMs();
+    poll();
+  }
+};
+
+static const ScheduleEntry AT_0800 = {8, 0, 1, ALL_WEEKDAYS};
+static SimClock *clk;
+
+void setUp() {
+  clockInit(TZ_RULE);
+  clk = new SimClock();
+}
+
+void tearDown() { delete clk; }
+
+static void start(const ScheduleEntry *entries, uint8_t count, time_t at) {
+  clk->epoch = at;
+  clk->engine.setEntries(entries, count, clk->ms);
+  clk->poll();
+}
+
+void test_next_fire_is_local_time() {
+  // 08:00 CEST = 06:00 UTC in summer, 08:00 CET = 07:00 UTC in winter
+  TEST_ASSERT_EQUAL_INT64(utc(2026, 7, 1, 6, 0), scheduleNextFire(AT_0800, utc(2026, 7, 1, 0, 0)));
+  TEST_ASSERT_EQUAL_INT64(utc(2026, 12, 1, 7, 0), scheduleNextFire(AT_0800, utc(2026, 12, 1, 0, 0)));
+  // Strictly after: at the fire time itself the next one is tomorrow
+  TEST_ASSERT_EQUAL_INT64(utc(2026, 12, 2, 7, 0), scheduleNextFire(AT_0800, utc(2026, 12, 1, 7, 0)));
+}
+
+void test_next_fire_weekdays() {
+  ScheduleEntry sundays = {8, 0, 1, 0x01};
+  // 2026-12-01 is a Tuesday, the next Sunday the 6th
+  TEST_ASSERT_EQUAL_INT64(utc(2026, 12, 6, 7, 0), scheduleNextFire(sundays, utc(2026, 12, 1, 0, 0)));
+  ScheduleEntry never = {8, 0, 1, 0};
+  TEST_ASSERT_EQUAL_INT64(0, scheduleNextFire(never, utc(2026, 12, 1, 0, 0)));
+}
+
+void test_no_fire_before_valid_time() {
+  start(&AT_0800, 1, 1000); // 1970: clock not set yet
+  clk->run(2 * 86400, 60);
+  TEST_ASSERT_EQUAL_INT(0, clk->fireCount);
+}
+
+void test_fires_once_a_day() {
+  start(&AT_0800, 1, utc(2026, 12, 1, 0, 0));
+  clk->run(3 * 86400);
+  TEST_ASSERT_EQUAL_INT(3, clk->fireCount);
+  TEST_ASSERT_EQUAL_UINT32(0, clk->late[0]);
+  TEST_ASSERT_EQUAL_INT(0, clk->skipCount);
+}
+
+void test_first_valid_time_only_arms() {
+  // Booted (or synced) half an hour after the slot: no catch-up
+  start(&AT_0800, 1, utc(2026, 12, 1, 7, 1));
+  clk->run(3600);
+  TEST_ASSERT_EQUAL_INT(0, clk->fireCount);
+  TEST_ASSERT_EQUAL_INT(0, clk->skipCount);
+}
+
+void test_catch_up_at_limit() {
+  start(&AT_0800, 1, utc(2026, 12, 1, 6, 0));
+  clk->jump(utc(2026, 12, 1, 7, 0) + SCHEDULE_CATCH_UP_S);
+  TEST_ASSERT_EQUAL_INT(1, clk->fireCount);
+  TEST_ASSERT_EQUAL_UINT32(SCHEDULE_CATCH_UP_S, clk->late[0]);
+  TEST_ASSERT_EQUAL_INT(0, clk->skipCount);
+}
+
+void test_skip_past_limit() {
+  start(&AT_0800, 1, utc(2026, 12, 1, 6, 0));
+  clk->jump(utc(2026, 12, 1, 7, 0) + SCHEDULE_CATCH_UP_S + 1);
+  TEST_ASSERT_EQUAL_INT(0, clk->fireCount);
+  TEST_ASSERT_EQUAL_INT(1, clk->skipCount);
+  // Re-armed for tomorrow, not again today
+  clk->run(86400, 60);
+  TEST_ASSERT_EQUAL_INT(1, clk->fireCount);
+  TEST_ASSERT_EQUAL_INT(1, clk->skipCount);
+}
+
+void test_several_overdue_oldest_first() {
+  ScheduleEntry two[] = {{8, 4, 1, ALL_WEEKDAYS}, {8, 2, 1, ALL_WEEKDAYS}};
+  start(two, 2, utc(2026, 12, 1, 6, 0));
+  clk->jump(utc(2026, 12, 1, 7, 5));
+  TEST_ASSERT_EQUAL_INT(2, clk->fireCount);
+  TEST_ASSERT_EQUAL_INT(1, clk->fires[0]);
+  TEST_ASSERT_EQUAL_UINT32(180, clk->late[0]);
+  TEST_ASSERT_EQUAL_INT(0, clk->fires[1]);
+  TEST_ASSERT_EQUAL_UINT32(60, clk->late[1]);
+}
+
+void test_backward_jump_does_not_refire() {
+  start(&AT_0800, 1, utc(2026, 12, 1, 6, 0));
+  clk->run(3600 + 60);
+  TEST_ASSERT_EQUAL_INT(1, clk->fireCount);
+  // SNTP corrects a fast clock by 30 minutes, back before the slot
+  clk->jump(utc(2026, 12, 1, 6, 45));
+  clk->run(3600);
+  TEST_ASSERT_EQUAL_INT(1, clk->fireCount);
+  clk->run(86400);
+  TEST_ASSERT_EQUAL_INT(2, clk->fireCount);
+}
+
+void test_large_backward_jump_rearms() {
+  start(&AT_0800, 1, utc(2026, 12, 20, 6, 0));
+  clk->run(3600 + 60);
+  TEST_ASSERT_EQUAL_INT(1, clk->fireCount);
+  // A wrong time was set 19 days ahead; the real date is the 1st
+  clk->jump(utc(2026, 12, 1, 6, 0));
+  clk->run(3 * 86400, 60);
+  // Never fires before the slot it already ran, so no feeding for now...
+  TEST_ASSERT_EQUAL_INT(1, clk->fireCount);
+  TEST_ASSERT_EQUAL_INT(0, clk->skipCount);
+  // ...but the next fire is the day after that slot, not a week later
+  TEST_ASSERT_EQUAL_INT64(utc(2026, 12, 21, 7, 0), clk->engine.nextFire(0));
+}
+
+void test_forward_jump_skips_days() {
+  start(&AT_0800, 1, utc(2026, 12, 1, 6, 0));
+  clk->jump(utc(2026, 12, 4, 12, 0));
+  // Only the oldest missed slot is reported, then it is re-armed from now
+  TEST_ASSERT_EQUAL_INT(0, clk->fireCount);
+  TEST_ASSERT_EQUAL_INT(1, clk->skipCount);
+  TEST_ASSERT_EQUAL_INT64(utc(2026, 12, 5, 7, 0), clk->engine.nextFire(0));
+}
+
+void test_dst_gap_moves_forward() {
+  // 2026-03-29: 02:00 CET -> 03:00 CEST, 02:30 does not exist
+  ScheduleEntry at0230 = {2, 30, 1, ALL_WEEKDAYS};
+  TEST_ASSERT_EQUAL_INT64(utc(2026, 3, 29, 1, 30), scheduleNextFire(at0230, utc(2026, 3, 28, 23, 0)));
+  start(&at0230, 1, utc(2026, 3, 28, 22, 0));
+  clk->run(86400);
+  TEST_ASSERT_EQUAL_INT(1, clk->fireCount);
+  TEST_ASSERT_EQUAL_UINT32(0, clk->late[0]);
+  // Next night 02:30 CEST again
+  TEST_ASSERT_EQUAL_INT64(utc(2026, 3, 30, 0, 30), clk->engine.nextFire(0));
+}
+
+void test_dst_fall_back_fires_once() {
+  // 2026-10-25: 03:00 CEST -> 02:00 CET, 02:30 happens twice
+  ScheduleEntry at0230 = {2, 30, 1, ALL_WEEKDAYS};
+  start(&at0230, 1, utc(2026, 10, 24, 20, 0));
+  clk->run(86400);
+  TEST_ASSERT_EQUAL_INT(1, clk->fireCount);
+  TEST_ASSERT_EQUAL_INT(0, clk->skipCount);
+  TEST_ASSERT_EQUAL_INT64(utc(2026, 10, 26, 1, 30), clk->engine.nextFire(0));
+}
+
+void test_dst_fall_back_day_is_25_hours() {
+  // An entry outside the repeated hour fires 25 h after the one before
+  start(&AT_0800, 1, utc(2026, 10, 24, 0, 0));
+  clk->run(3 * 86400, 60);
+  TEST_ASSERT_EQUAL_INT(3, clk->fireCount);
+  TEST_ASSERT_EQUAL_INT64(utc(2026, 10, 27, 7, 0), clk->engine.nextFire(0));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_next_fire_is_local_time);
+  RUN_TEST(test_next_fire_weekdays);
+  RUN_TEST(test_no_fire_before_valid_time);
+  RUN_TEST(test_fires_once_a_day);
+  RUN_TEST(test_first_valid_time_only_arms);
+  RUN_TEST(test_catch_up_at_limit);
+  RUN_TEST(test_skip_past_limit);
+  RUN_TEST(test_several_overdue_oldest_first);
+  RUN_TEST(test_backward_jump_does_not_refire);
+  RUN_TEST(test_large_backward_jump_rearms);
+  RUN_TEST(test_forward_jump_skips_days);
+  RUN_TEST(test_dst_gap_moves_forward);
+  RUN_TEST(test_dst_fall_back_fires_once);
+  RUN_TEST(test_dst_fall_back_day_is_25_hours);
+  return UNITY_END();
+}
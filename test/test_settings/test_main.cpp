@@ -0,0 +1,199 @@
+// Settings blob in NVS: round trip, rejected blobs (bad CRC, newer version,
+// wrong length), older shorter payloads and the legacy per-key schedule.
+
+#include <unity.h>
+
+#include <string.h>
+
+#include "feeder.h"
+#include "hal.h"
+#include "settings.h"
+
+static uint32_t crc32(const uint8_t *data, size_t len) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; ++i) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; ++b) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+// Store a blob as another firmware version would have written it; payloads
+// up to 64 bytes longer than Settings, for the oversized case
+static void putBlob(uint16_t version, const void *payload, uint16_t len, uint16_t lenField) {
+  uint8_t blob[4 + sizeof(Settings) + 64 + 4];
+  TEST_ASSERT_TRUE(4 + (size_t)len + 4 <= sizeof(blob));
+  memcpy(blob, &version, 2);
+  memcpy(blob + 2, &lenField, 2);
+  memcpy(blob + 4, payload, len);
+  uint32_t crc = crc32(blob, 4 + len);
+  memcpy(blob + 4 + len, &crc, 4);
+  hal::nvsPutBlob("settings", "blob", blob, 4 + len + 4);
+}
+
+static void putBlob(uint16_t version, const void *payload, uint16_t len) { putBlob(version, payload, len, len); }
+
+// Recognisable contents for the caller's copy, to see what load touched
+static void fillMarker(Settings &s) {
+  memset(&s, 0, sizeof(s));
+  for (ChannelSettings &c : s.channels) {
+    c.scheduleCount = 1;
+    c.schedule[0] = {23, 59, 9, 0x01};
+  }
+}
+
+static bool isMarker(const Settings &s) {
+  Settings m;
+  fillMarker(m);
+  return memcmp(&s, &m, sizeof(s)) == 0;
+}
+
+void setUp() {
+  // settingsSave() compares against the last blob it saw; start every test
+  // from a known one, then from empty NVS
+  Settings zero;
+  memset(&zero, 0, sizeof(zero));
+  putBlob(SETTINGS_VERSION, &zero, sizeof(zero));
+  settingsLoad(zero);
+  hal::nvsClear("settings");
+  hal::nvsClear("schedule");
+}
+
+void tearDown() {}
+
+void test_missing() {
+  Settings s;
+  fillMarker(s);
+  TEST_ASSERT_EQUAL(SETTINGS_MISSING, settingsLoad(s));
+  TEST_ASSERT_TRUE(isMarker(s));
+}
+
+void test_round_trip() {
+  Settings saved;
+  settingsDefaults(saved);
+  saved.channels[1].scheduleCount = 1;
+  saved.channels[1].schedule[0] = {6, 30, 2, 0x3E};
+  TEST_ASSERT_EQUAL(SETTINGS_SAVED, settingsSave(saved));
+  Settings loaded;
+  fillMarker(loaded);
+  TEST_ASSERT_EQUAL(SETTINGS_LOADED, settingsLoad(loaded));
+  TEST_ASSERT_EQUAL_MEMORY(&saved, &loaded, sizeof(saved));
+  // Same content again: no NVS write
+  TEST_ASSERT_EQUAL(SETTINGS_UNCHANGED, settingsSave(loaded));
+}
+
+void test_bad_crc() {
+  Settings saved;
+  settingsDefaults(saved);
+  TEST_ASSERT_EQUAL(SETTINGS_SAVED, settingsSave(saved));
+  uint8_t blob[4 + sizeof(Settings) + 4];
+  size_t len = hal::nvsGetBlob("settings", "blob", blob, sizeof(blob));
+  TEST_ASSERT_EQUAL_size_t(sizeof(blob), len);
+  blob[5] ^= 0x10; // one bit of channel 0's first entry
+  hal::nvsPutBlob("settings", "blob", blob, len);
+  Settings s;
+  fillMarker(s);
+  TEST_ASSERT_EQUAL(SETTINGS_INVALID, settingsLoad(s));
+  TEST_ASSERT_TRUE(isMarker(s));
+}
+
+void test_newer_version() {
+  // Written by a later firmware (after a downgrade): its fields may mean
+  // something else, so nothing of it is used even with a valid CRC
+  Settings newer;
+  settingsDefaults(newer);
+  putBlob(SETTINGS_VERSION + 1, &newer, sizeof(newer));
+  Settings s;
+  fillMarker(s);
+  TEST_ASSERT_EQUAL(SETTINGS_INVALID, settingsLoad(s));
+  TEST_ASSERT_TRUE(isMarker(s));
+}
+
+void test_length_field_mismatch() {
+  Settings saved;
+  settingsDefaults(saved);
+  putBlob(SETTINGS_VERSION, &saved, sizeof(saved), sizeof(saved) + 1);
+  Settings s;
+  fillMarker(s);
+  TEST_ASSERT_EQUAL(SETTINGS_INVALID, settingsLoad(s));
+  TEST_ASSERT_TRUE(isMarker(s));
+}
+
+void test_truncated_and_oversized() {
+  Settings s;
+  fillMarker(s);
+  uint8_t tiny[6] = {SETTINGS_VERSION, 0, 0, 0, 0, 0};
+  hal::nvsPutBlob("settings", "blob", tiny, sizeof(tiny));
+  TEST_ASSERT_EQUAL(SETTINGS_INVALID, settingsLoad(s));
+  uint8_t big[4 + sizeof(Settings) + 64] = {0};
+  putBlob(SETTINGS_VERSION, big, sizeof(Settings) + 32);
+  TEST_ASSERT_EQUAL(SETTINGS_INVALID, settingsLoad(s));
+  TEST_ASSERT_TRUE(isMarker(s));
+}
+
+void test_shorter_version_1_blob() {
+  // Version 1 stored one schedule, which becomes channel 0; the other
+  // channels keep what the caller passed in
+  ChannelSettings v1;
+  memset(&v1, 0, sizeof(v1));
+  v1.scheduleCount = 2;
+  v1.schedule[0] = {7, 15, 3, ALL_WEEKDAYS};
+  v1.schedule[1] = {19, 45, 2, 0x41};
+  putBlob(1, &v1, sizeof(v1));
+  Settings s;
+  fillMarker(s);
+  TEST_ASSERT_EQUAL(SETTINGS_LOADED, settingsLoad(s));
+  TEST_ASSERT_EQUAL_MEMORY(&v1, &s.channels[0], sizeof(v1));
+  Settings m;
+  fillMarker(m);
+  TEST_ASSERT_EQUAL_MEMORY(&m.channels[1], &s.channels[1], sizeof(Settings) - sizeof(ChannelSettings));
+  // Saving writes the current version with the full payload
+  TEST_ASSERT_EQUAL(SETTINGS_SAVED, settingsSave(s));
+  uint8_t header[4];
+  TEST_ASSERT_EQUAL_size_t(4 + sizeof(Settings) + 4, hal::nvsGetBlob("settings", "blob", header, 0));
+}
+
+void test_schedule_count_clamped() {
+  Settings bad;
+  settingsDefaults(bad);
+  bad.channels[0].scheduleCount = 200;
+  putBlob(SETTINGS_VERSION, &bad, sizeof(bad));
+  Settings s;
+  settingsDefaults(s);
+  TEST_ASSERT_EQUAL(SETTINGS_LOADED, settingsLoad(s));
+  TEST_ASSERT_EQUAL_UINT8(MAX_SCHEDULE_ENTRIES, s.channels[0].scheduleCount);
+}
+
+void test_legacy_keys_migrated() {
+  hal::nvsPutUInt("schedule", "n", 2);
+  hal::nvsPutUInt("schedule", "h0", 7);
+  hal::nvsPutUInt("schedule", "m0", 15);
+  hal::nvsPutUInt("schedule", "h1", 20); // m1, s1, w1 missing: defaults
+  loadScheduleFromPrefs();
+  TEST_ASSERT_EQUAL_UINT8(2, scheduleCount[0]);
+  TEST_ASSERT_EQUAL_UINT8(7, schedule[0][0].hour);
+  TEST_ASSERT_EQUAL_UINT8(15, schedule[0][0].minute);
+  TEST_ASSERT_EQUAL_UINT8(STEPS_PER_RUN, schedule[0][0].steps);
+  TEST_ASSERT_EQUAL_UINT8(20, schedule[0][1].hour);
+  TEST_ASSERT_EQUAL_UINT8(40, schedule[0][1].minute);
+  // Now in the blob, and the old keys are gone
+  Settings s;
+  settingsDefaults(s);
+  TEST_ASSERT_EQUAL(SETTINGS_LOADED, settingsLoad(s));
+  TEST_ASSERT_EQUAL_UINT8(2, s.channels[0].scheduleCount);
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, hal::nvsGetUInt("schedule", "n", UINT32_MAX));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_missing);
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_bad_crc);
+  RUN_TEST(test_newer_version);
+  RUN_TEST(test_length_field_mismatch);
+  RUN_TEST(test_truncated_and_oversized);
+  RUN_TEST(test_shorter_version_1_blob);
+  RUN_TEST(test_schedule_count_clamped);
+  RUN_TEST(test_legacy_keys_migrated);
+  return UNITY_END();
+}
@@ -0,0 +1,92 @@
+"""Compress the files in web/ into src/esp32/web_assets.h.
+
+Runs as a PlatformIO pre-build script ([env:d1_mini32] extra_scripts) and can
+also be run by hand: python tools/embed_web.py
+
+Every file becomes a gzip-compressed PROGMEM array plus a WebAsset entry with
+its URL path, MIME type and a strong ETag (hash of the uncompressed file).
+The header is only rewritten when its content changes, so unchanged assets
+don't trigger a rebuild.
+"""
+
+import gzip
+import hashlib
+import os
+import re
+
+MIME_TYPES = {
+    ".html": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".json": "application/json",
+    ".svg": "image/svg+xml",
+    ".ico": "image/x-icon",
+}
+
+
+def symbol_for(name):
+    return "WEB_" + re.sub(r"[^A-Za-z0-9]", "_", name).upper()
+
+
+def render(web_dir):
+    names = sorted(n for n in os.listdir(web_dir) if os.path.isfile(os.path.join(web_dir, n)))
+    out = [
+        "// Generated by tools/embed_web.py from web/ - do not edit.",
+        "#pragma once",
+        "",
+        "#include <pgmspace.h>",
+        "#include <stddef.h>",
+        "#include <stdint.h>",
+        "",
+        "struct WebAsset {",
+        "  const char *path;  // URL path, \"/\" + file name",
+        "  const char *mime;",
+        "  const char *etag;  // quoted, ready for the ETag header",
+        "  const uint8_t *gz; // gzip body in flash",
+        "  size_t gzLen;",
+        "};",
+        "",
+    ]
+    entries = []
+    for name in names:
+        with open(os.path.join(web_dir, name), "rb") as f:
+            raw = f.read()
+        # mtime=0 keeps the output stable between builds
+        gz = gzip.compress(raw, compresslevel=9, mtime=0)
+        etag = hashlib.sha1(raw).hexdigest()[:16]
+        mime = MIME_TYPES.get(os.path.splitext(name)[1], "application/octet-stream")
+        sym = symbol_for(name)
+        out.append("// %s: %d bytes, %d gzipped" % (name, len(raw), len(gz)))
+        out.append("static const uint8_t %s_GZ[] PROGMEM = {" % sym)
+        for i in range(0, len(gz), 16):
+            out.append("  " + ", ".join("0x%02x" % b for b in gz[i:i + 16]) + ",")
+        out.append("};")
+        out.append('static const WebAsset %s = {"/%s", "%s", "\\"%s\\"", %s_GZ, sizeof(%s_GZ)};'
+                   % (sym, name, mime, etag, sym, sym))
+        out.append("")
+        entries.append(sym)
+    out.append("static const WebAsset *const WEB_ASSETS[] = {%s};" % ", ".join("&" + e for e in entries))
+    out.append("")
+    return "\n".join(out)
+
+
+def generate(project_dir):
+    web_dir = os.path.join(project_dir, "web")
+    target = os.path.join(project_dir, "src", "esp32", "web_assets.h")
+    text = render(web_dir)
+    old = None
+    if os.path.exists(target):
+        with open(target) as f:
+            old = f.read()
+    if text != old:
+        with open(target, "w") as f:
+            f.write(text)
+        print("embed_web: wrote %s" % os.path.relpath(target, project_dir))
+
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+    generate(env["PROJECT_DIR"])  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        generate(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
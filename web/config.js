@@ -0,0 +1,37 @@
+// Builds the schedule rows from /config.json; field names match handleConfigSave().
+var DAYS = ['So', 'Mo', 'Di', 'Mi', 'Do', 'Fr', 'Sa'];
+
+function pad(n) { return (n < 10 ? '0' : '') + n; }
+
+function row(i, e) {
+  var isNew = !e;
+  e = e || {h: 0, m: 0, s: 3, d: 127};
+  var html = '<label>' + (isNew ? 'Neue Zeit' : 'Zeit ' + (i + 1)) + '</label>' +
+    "<input type='time' name='t" + i + "' value='" + (isNew ? '' : pad(e.h) + ':' + pad(e.m)) + "'>" +
+    '<label>Portionen</label>' +
+    "<input type='number' name='s" + i + "' min='1' max='20' value='" + e.s + "'>" +
+    "<div class='row days'>";
+  for (var k = 1; k <= 7; ++k) {
+    var wd = k % 7; // Monday first
+    html += "<label><input type='checkbox' name='d" + i + '_' + wd + "'" +
+      (e.d & (1 << wd) ? ' checked' : '') + '>' + DAYS[wd] + '</label>';
+  }
+  return html + '</div><br>';
+}
+
+// ?ch=N picks the feeder on boards with more than one.
+var ch = (/[?&]ch=(\d+)/.exec(location.search) || [0, '0'])[1];
+
+fetch('/config.json?ch=' + ch).then(function (r) { return r.json(); }).then(function (cfg) {
+  var html = "<input type='hidden' name='ch' value='" + cfg.channel + "'>";
+  cfg.entries.forEach(function (e, i) { html += row(i, e); });
+  if (cfg.entries.length < cfg.max) html += row(cfg.entries.length, null);
+  document.getElementById('rows').innerHTML = html;
+  if (cfg.channels > 1) {
+    var links = [];
+    for (var c = 0; c < cfg.channels; ++c) {
+      links.push(c == cfg.channel ? '<b>Kanal ' + (c + 1) + '</b>' : "<a href='/config?ch=" + c + "'>Kanal " + (c + 1) + '</a>');
+    }
+    document.getElementById('channels').innerHTML = links.join(' - ');
+  }
+});
@@ -0,0 +1,20 @@
+// Posts the page's forms as the raw urlencoded body with a content type the
+// server's web library leaves alone, so the handlers can parse it in place
+// (include/form.h). The response replaces the page, errors are shown.
+document.querySelectorAll('form').forEach(function (form) {
+  form.addEventListener('submit', function (ev) {
+    ev.preventDefault();
+    fetch(form.action, {
+      method: 'POST',
+      headers: {'Content-Type': 'application/octet-stream'},
+      body: new URLSearchParams(new FormData(form)).toString()
+    }).then(function (r) {
+      return r.text().then(function (text) {
+        if (!r.ok) throw new Error(text || r.status);
+        document.open();
+        document.write(text);
+        document.close();
+      });
+    }).catch(function (err) { alert('Speichern fehlgeschlagen: ' + err.message); });
+  });
+});
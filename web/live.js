@@ -0,0 +1,33 @@
+// Live view from /events; the browser reconnects on its own (retry line).
+var MAX_LINES = 20;
+var STATES = {started: 'Fütterung gestartet', complete: 'Fütterung fertig', timeout: 'Fütterung abgebrochen (Timeout)',
+  jammed: 'Fütterung abgebrochen (blockiert)'};
+
+function pad2(n) { return (n < 10 ? '0' : '') + n; }
+
+function show(e, text) {
+  var d = JSON.parse(e.data);
+  var t = new Date(d.t * 1000);
+  var li = document.createElement('li');
+  li.textContent = pad2(t.getHours()) + ':' + pad2(t.getMinutes()) + ':' + pad2(t.getSeconds()) + ' ' +
+    (d.ch === undefined ? '' : 'Kanal ' + (d.ch + 1) + ': ') + text(d);
+  var list = document.getElementById('live');
+  if (list.firstChild && list.firstChild.className == 'muted') list.removeChild(list.firstChild);
+  list.insertBefore(li, list.firstChild);
+  while (list.children.length > MAX_LINES) list.removeChild(list.lastChild);
+}
+
+if (window.EventSource) {
+  var es = new EventSource('/events');
+  es.addEventListener('relay', function (e) { show(e, function (d) { return 'Motor ' + (d.on ? 'an' : 'aus'); }); });
+  es.addEventListener('step', function (e) {
+    show(e, function (d) { return 'Schritt ' + d.count + (d.run ? '' : ' (ohne Fütterung)'); });
+  });
+  es.addEventListener('schedule', function (e) {
+    show(e, function (d) { return 'Zeitplan ' + pad2(d.hour) + ':' + pad2(d.minute) + ' fällig'; });
+  });
+  es.addEventListener('run', function (e) { show(e, function (d) { return STATES[d.state] || d.state; }); });
+  es.addEventListener('wifi', function (e) {
+    show(e, function (d) { return d.state == 'connected' ? 'WLAN verbunden, ' + d.ip : 'WLAN getrennt'; });
+  });
+}